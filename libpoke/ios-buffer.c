@@ -20,12 +20,24 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "ios.h"
 #include "ios-dev.h"
 
-#define IOB_CHUNK_SIZE          2048
-#define IOB_BUCKET_COUNT        8
+/* The buffer keeps the bytes of the stream that have not been
+   forgotten yet in chunks of IOB_CHUNK_SIZE bytes.  The chunks are
+   indexed directly by their number in a ring of pointers, which is
+   doubled in size whenever it gets full, so getting the chunk
+   containing any offset of the buffer takes constant time.
+
+   Forgotten chunks are kept in a pool of at most IOB_POOL_MAX chunks
+   to be reused, so a stream that is read and flushed as it goes
+   doesn't allocate memory once the pool is populated.  */
+
+#define IOB_CHUNK_SIZE          (64 * 1024)
+#define IOB_RING_MIN            16
+#define IOB_POOL_MAX            16
 
 #define IOB_CHUNK_OFFSET(offset)        \
   ((offset) % IOB_CHUNK_SIZE)
@@ -33,26 +45,36 @@
 #define IOB_CHUNK_NO(offset)            \
   ((offset) / IOB_CHUNK_SIZE)
 
-#define IOB_BUCKET_NO(chunk_no)         \
-  ((chunk_no) % IOB_BUCKET_COUNT)
+#define IOB_RING_SLOT(buffer, chunk_no)         \
+  ((chunk_no) & ((buffer)->ring_size - 1))
+
+/* NEXT links the chunks in the pool.  */
 
 struct ios_buffer_chunk
 {
   uint8_t bytes[IOB_CHUNK_SIZE];
-  int chunk_no;
   struct ios_buffer_chunk *next;
 };
 
 /* begin_offset is the first offset that's not yet flushed, initilized as 0.
    end_offset of an instream is the next byte to read to.  end_offset of an
-   outstream is the successor of the greatest offset that is written to.  */
+   outstream is the successor of the greatest offset that is written to.
+
+   RING holds the chunks numbered from FIRST_CHUNK_NO to
+   NEXT_CHUNK_NO - 1, the chunk number N being at the slot N modulo
+   RING_SIZE, which is a power of two.  POOL is the list of chunks
+   available for reuse, and POOL_SIZE its length.  */
 
 struct ios_buffer
 {
-  struct ios_buffer_chunk* chunks[IOB_BUCKET_COUNT];
+  struct ios_buffer_chunk **ring;
+  size_t ring_size;
+  ios_dev_off first_chunk_no;
+  ios_dev_off next_chunk_no;
+  struct ios_buffer_chunk *pool;
+  int pool_size;
   ios_dev_off begin_offset;
   ios_dev_off end_offset;
-  int next_chunk_no;
 };
 
 ios_dev_off
@@ -69,6 +91,18 @@ struct ios_buffer *
 ios_buffer_init ()
 {
   struct ios_buffer *bio = calloc (1, sizeof (struct ios_buffer));
+
+  if (!bio)
+    return NULL;
+
+  bio->ring = calloc (IOB_RING_MIN, sizeof (struct ios_buffer_chunk *));
+  if (!bio->ring)
+    {
+      free (bio);
+      return NULL;
+    }
+  bio->ring_size = IOB_RING_MIN;
+
   return bio;
 }
 
@@ -76,57 +110,103 @@ void
 ios_buffer_free (struct ios_buffer *buffer)
 {
   struct ios_buffer_chunk *chunk, *chunk_next;
+  ios_dev_off chunk_no;
 
   if (buffer == NULL)
     return;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
+  for (chunk_no = buffer->first_chunk_no;
+       chunk_no < buffer->next_chunk_no;
+       chunk_no++)
+    free (buffer->ring[IOB_RING_SLOT (buffer, chunk_no)]);
+
+  for (chunk = buffer->pool; chunk; chunk = chunk_next)
     {
-      chunk = buffer->chunks[i];
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          free (chunk);
-          chunk = chunk_next;
-        }
+      chunk_next = chunk->next;
+      free (chunk);
     }
 
+  free (buffer->ring);
   free (buffer);
   return;
 }
 
 struct ios_buffer_chunk*
-ios_buffer_get_chunk (struct ios_buffer *buffer, int chunk_no)
+ios_buffer_get_chunk (struct ios_buffer *buffer, ios_dev_off chunk_no)
 {
-  int bucket_no = IOB_BUCKET_NO (chunk_no);
-  struct ios_buffer_chunk *chunk = buffer->chunks[bucket_no];
+  if (chunk_no < buffer->first_chunk_no
+      || chunk_no >= buffer->next_chunk_no)
+    return NULL;
 
-  for ( ; chunk; chunk = chunk->next)
-    if (chunk->chunk_no == chunk_no)
-      return chunk;
+  return buffer->ring[IOB_RING_SLOT (buffer, chunk_no)];
+}
 
-  return NULL;
+/* Double the size of the ring of BUFFER.  */
+
+static int
+ios_buffer_grow_ring (struct ios_buffer *buffer)
+{
+  size_t new_size = buffer->ring_size * 2;
+  struct ios_buffer_chunk **new_ring;
+  ios_dev_off chunk_no;
+
+  if (new_size < buffer->ring_size
+      || new_size > SIZE_MAX / sizeof (struct ios_buffer_chunk *))
+    return IOD_ENOMEM;
+
+  new_ring = malloc (new_size * sizeof (struct ios_buffer_chunk *));
+  if (!new_ring)
+    return IOD_ENOMEM;
+
+  for (chunk_no = buffer->first_chunk_no;
+       chunk_no < buffer->next_chunk_no;
+       chunk_no++)
+    new_ring[chunk_no & (new_size - 1)]
+      = buffer->ring[IOB_RING_SLOT (buffer, chunk_no)];
+
+  free (buffer->ring);
+  buffer->ring = new_ring;
+  buffer->ring_size = new_size;
+  return IOD_OK;
 }
 
+/* Allocate the chunks following the last one in BUFFER up to the
+   chunk FINAL_CHUNK_NO, and set *FINAL_CHUNK to the later.  Chunks
+   are taken from the pool if possible.  Their contents are
+   undefined: the bytes of a stream are always written to the buffer
+   before being read from it.  */
+
 int
-ios_buffer_allocate_new_chunk (struct ios_buffer *buffer, int final_chunk_no,
+ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
+                               ios_dev_off final_chunk_no,
                                struct ios_buffer_chunk **final_chunk)
 {
   struct ios_buffer_chunk *chunk;
-  int bucket_no;
 
   assert (buffer->next_chunk_no <= final_chunk_no);
 
   do
     {
-      chunk = calloc (1, sizeof (struct ios_buffer_chunk));
-      if (!chunk)
+      if (buffer->next_chunk_no - buffer->first_chunk_no
+          == buffer->ring_size
+          && ios_buffer_grow_ring (buffer) != IOD_OK)
         return IOD_ERROR;
+
+      if (buffer->pool)
+        {
+          chunk = buffer->pool;
+          buffer->pool = chunk->next;
+          buffer->pool_size--;
+        }
+      else
+        {
+          chunk = malloc (sizeof (struct ios_buffer_chunk));
+          if (!chunk)
+            return IOD_ERROR;
+        }
+
       /* Place the new chunk into the buffer.  */
-      chunk->chunk_no = buffer->next_chunk_no;
-      bucket_no = IOB_BUCKET_NO (chunk->chunk_no);
-      chunk->next = buffer->chunks[bucket_no];
-      buffer->chunks[bucket_no] = chunk;
+      buffer->ring[IOB_RING_SLOT (buffer, buffer->next_chunk_no)] = chunk;
       buffer->next_chunk_no++;
     }
   while (buffer->next_chunk_no <= final_chunk_no);
@@ -137,6 +217,18 @@ ios_buffer_allocate_new_chunk (struct ios_buffer *buffer, int final_chunk_no,
   return 0;
 }
 
+/* Get the chunk CHUNK_NO of BUFFER, allocating it if needed.  */
+
+static inline struct ios_buffer_chunk *
+ios_buffer_get_chunk_alloc (struct ios_buffer *buffer, ios_dev_off chunk_no)
+{
+  struct ios_buffer_chunk *chunk = ios_buffer_get_chunk (buffer, chunk_no);
+
+  if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
+    return NULL;
+  return chunk;
+}
+
 /* Since ios_dev_stream_pread already needs to check begin_offset and
    end_offset, so this function does not.  It assumes that the given range
    already exists in the buffer.  */
@@ -145,37 +237,25 @@ int
 ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                   ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
-  ios_dev_off chunk_offset;
-  size_t already_read_count = 0,
-         to_be_read_count = 0;
-
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
-  chunk = ios_buffer_get_chunk (buffer, chunk_no);
-  if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-    return IOD_ERROR;
-
-  /* The amount we read from this chunk is the maximum of
-     the COUNT requested and the size of the rest of this chunk. */
-  to_be_read_count = IOB_CHUNK_SIZE - chunk_offset > count
-                     ? count
-                     : IOB_CHUNK_SIZE - chunk_offset;
-
-  memcpy (buf, (void *) chunk + chunk_offset, to_be_read_count);
+  uint8_t *bytes = buf;
 
-  while ((already_read_count += to_be_read_count) < count)
+  while (count > 0)
     {
-      to_be_read_count = count - already_read_count > IOB_CHUNK_SIZE
-                         ? IOB_CHUNK_SIZE
-                         : count - already_read_count;
+      struct ios_buffer_chunk *chunk
+        = ios_buffer_get_chunk_alloc (buffer, IOB_CHUNK_NO (offset));
+      size_t chunk_offset = IOB_CHUNK_OFFSET (offset);
+      size_t n = IOB_CHUNK_SIZE - chunk_offset;
 
-      chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
-      if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
+      if (!chunk)
         return IOD_ERROR;
-      memcpy (buf + already_read_count, chunk, to_be_read_count);
-    };
+      if (n > count)
+        n = count;
+
+      memcpy (bytes, chunk->bytes + chunk_offset, n);
+      bytes += n;
+      offset += n;
+      count -= n;
+    }
 
   return 0;
 }
@@ -188,42 +268,31 @@ int
 ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
                    ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
-  ios_dev_off chunk_offset;
-  size_t already_written_count = 0,
-         to_be_written_count = 0;
-
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
-  chunk = ios_buffer_get_chunk (buffer, chunk_no);
-  if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-    return IOD_ERROR;
+  const uint8_t *bytes = buf;
+  ios_dev_off end = offset + count;
 
-  /* The amount we write to this chunk is the maximum of the COUNT requested
-     and the size of the rest of this chunk. */
-  to_be_written_count = IOB_CHUNK_SIZE - chunk_offset > count
-                        ? count
-                        : IOB_CHUNK_SIZE - chunk_offset;
-
-  memcpy ((void *) chunk + chunk_offset, buf, to_be_written_count);
-
-  while ((already_written_count += to_be_written_count) < count)
+  while (count > 0)
     {
-      to_be_written_count = count - already_written_count > IOB_CHUNK_SIZE
-                            ? IOB_CHUNK_SIZE
-                            : count - already_written_count;
+      struct ios_buffer_chunk *chunk
+        = ios_buffer_get_chunk_alloc (buffer, IOB_CHUNK_NO (offset));
+      size_t chunk_offset = IOB_CHUNK_OFFSET (offset);
+      size_t n = IOB_CHUNK_SIZE - chunk_offset;
 
-      chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
-      if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
+      if (!chunk)
         return IOD_ERROR;
-      memcpy (chunk, buf + already_written_count, to_be_written_count);
-    };
+      if (n > count)
+        n = count;
+
+      memcpy (chunk->bytes + chunk_offset, bytes, n);
+      bytes += n;
+      offset += n;
+      count -= n;
+    }
 
   /* Lastly, keep track of the greatest offset we wrote to in the buffer.
      (In fact, end_offset is the least offset we have not written to yet.)  */
-  if (buffer->end_offset < offset + count)
-    buffer->end_offset = offset + count;
+  if (buffer->end_offset < end)
+    buffer->end_offset = end;
 
   return 0;
 }
@@ -231,27 +300,33 @@ ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
 int
 ios_buffer_forget_till (struct ios_buffer *buffer, ios_dev_off offset)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-  int chunk_no = IOB_CHUNK_NO (offset);
+  ios_dev_off chunk_no = IOB_CHUNK_NO (offset);
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
+  /* Each chunk is forgotten once, so this takes constant amortized
+     time.  */
+  while (buffer->first_chunk_no < chunk_no
+         && buffer->first_chunk_no < buffer->next_chunk_no)
     {
-      chunk = buffer->chunks[i];
-      buffer->chunks[i] = NULL;
-      while (chunk)
+      size_t slot = IOB_RING_SLOT (buffer, buffer->first_chunk_no);
+      struct ios_buffer_chunk *chunk = buffer->ring[slot];
+
+      if (buffer->pool_size < IOB_POOL_MAX)
         {
-          chunk_next = chunk->next;
-          if (chunk->chunk_no >= chunk_no)
-            {
-              chunk->next = buffer->chunks[i];
-              buffer->chunks[i] = chunk;
-            }
-          else
-            free (chunk);
-          chunk = chunk_next;
+          chunk->next = buffer->pool;
+          buffer->pool = chunk;
+          buffer->pool_size++;
         }
+      else
+        free (chunk);
+
+      buffer->ring[slot] = NULL;
+      buffer->first_chunk_no++;
     }
 
+  /* Chunks that were never allocated are not allocated later on.  */
+  if (buffer->next_chunk_no < buffer->first_chunk_no)
+    buffer->next_chunk_no = buffer->first_chunk_no;
+
   buffer->begin_offset = chunk_no * IOB_CHUNK_SIZE;
   assert (buffer->end_offset >= buffer->begin_offset);
   assert (buffer->begin_offset <= offset);
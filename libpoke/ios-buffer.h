@@ -27,10 +27,10 @@ ios_dev_off ios_buffer_get_begin_offset (struct ios_buffer *buffer);
 ios_dev_off ios_buffer_get_end_offset (struct ios_buffer *buffer);
 
 struct ios_buffer_chunk *ios_buffer_get_chunk (struct ios_buffer *buffer,
-                                               int chunk_no);
+                                               ios_dev_off chunk_no);
 
 int ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
-                                   int final_chunk_no,
+                                   ios_dev_off final_chunk_no,
                                    struct ios_buffer_chunk **final_chunk);
 
 int ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
@@ -0,0 +1,1264 @@
+/* ios-cache.c - Block cache for IO spaces.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/uio.h>
+#if HAVE_IOS_ASYNC_READAHEAD
+# include <pthread.h>
+#endif
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-cache.h"
+
+#define IOC_BLOCK_NO(offset)                    \
+  ((offset) / IOS_CACHE_BLOCK_SIZE)
+
+#define IOC_BLOCK_OFFSET(offset)                \
+  ((offset) % IOS_CACHE_BLOCK_SIZE)
+
+/* A cached block.
+
+   BLOCK_NO is the number of the block in the device, i.e. the block
+   caches the device bytes starting at BLOCK_NO * IOS_CACHE_BLOCK_SIZE.
+
+   VALID is the number of bytes in BYTES that contain data from the
+   device.  This is IOS_CACHE_BLOCK_SIZE for every block but the one
+   containing the end of the device.
+
+   DIRTY_BEGIN and DIRTY_END delimit the range of BYTES that has been
+   modified and not yet written back.  If they are equal, the block
+   is clean.
+
+   HASH_NEXT links the blocks that live in the same hash bucket.
+
+   LRU_PREV and LRU_NEXT link the blocks in least-recently-used
+   order.  */
+
+struct ios_cache_block
+{
+  ios_dev_off block_no;
+  size_t valid;
+  size_t dirty_begin;
+  size_t dirty_end;
+  struct ios_cache_block *hash_next;
+  struct ios_cache_block *lru_prev;
+  struct ios_cache_block *lru_next;
+  uint8_t bytes[IOS_CACHE_BLOCK_SIZE];
+};
+
+/* An asynchronous readahead request, covering NBLOCKS blocks starting
+   at the block BLOCK_NO.  The SIZE bytes of the device starting at
+   that block are read into BYTES.
+
+   DONE is set by the helper thread once the read is complete, and
+   RET is then the result of the read.  Both are protected by the
+   mutex of the cache.
+
+   ASYNC_P is set if the read has been started by the device itself,
+   using its pread_start operation, rather than by the helper thread.
+   DONE and RET are then set once pread_finish reports the completion
+   of the read.
+
+   STALE is set if the device is written in the range of the request
+   after issuing it.  The data of stale requests is not installed in
+   the cache.  */
+
+struct ios_cache_ra_req
+{
+  ios_dev_off block_no;
+  size_t nblocks;
+  size_t size;
+  uint8_t *bytes;
+  int ret;
+  int done;
+  int stale;
+  int async_p;
+};
+
+/* DEV and DEV_IF are the device operated through the cache.
+
+   BUCKETS is a hash table of NUM_BUCKETS entries, indexed by block
+   number.  NUM_BUCKETS is always a power of two.
+
+   MAX_BLOCKS is the budget of the cache, in blocks.  NUM_BLOCKS is
+   the number of blocks currently in the cache.
+
+   LRU_HEAD is the most recently used block, LRU_TAIL the least
+   recently used block.
+
+   DIRTY is the number of modified bytes in the cache that have not
+   been written back yet.
+
+   STATS are the statistics of the IO space owning the cache, where
+   the block lookups, the writes absorbed by the cache and the
+   requests performed on the device are accounted.
+
+   RA_NEXT is the block that would continue the current stream of
+   sequential accesses.  RA_WINDOW is the size of the readahead
+   window, in blocks, or zero if no stream has been detected.  RA_END
+   is the block following the last one that has been read ahead.
+
+   RA_REQ is the pending asynchronous readahead request, if any.
+   RA_THREAD is the helper thread serving the requests, which is
+   created on demand: RA_THREAD_P is 1 if the thread is running, 0 if
+   it has not been created yet and -1 if it couldn't be created.
+   RA_MUTEX protects RA_QUIT and the completion of the requests, and
+   RA_COND signals changes on them.  */
+
+struct ios_cache
+{
+  void *dev;
+  struct ios_dev_if *dev_if;
+  struct ios_cache_block **buckets;
+  size_t num_buckets;
+  size_t max_blocks;
+  size_t num_blocks;
+  struct ios_cache_block *lru_head;
+  struct ios_cache_block *lru_tail;
+  size_t dirty;
+  struct ios_stats *stats;
+  ios_dev_off ra_next;
+  ios_dev_off ra_end;
+  size_t ra_window;
+#if HAVE_IOS_ASYNC_READAHEAD
+  struct ios_cache_ra_req *ra_req;
+  int ra_thread_p;
+  int ra_quit;
+  pthread_t ra_thread;
+  pthread_mutex_t ra_mutex;
+  pthread_cond_t ra_cond;
+#endif
+};
+
+/* Modified data is written back once it amounts to half the budget
+   of the cache, so evicting a block seldom requires writing to the
+   device.  */
+
+#define IOC_DIRTY_MAX(cache)                                    \
+  ((cache)->max_blocks * IOS_CACHE_BLOCK_SIZE / 2)
+
+/* The cache detects streams of accesses to consecutive blocks, and
+   reads ahead the blocks following them.  The readahead window starts
+   at IOC_RA_MIN blocks and is doubled every time blocks are read
+   ahead, up to IOC_RA_MAX blocks or a quarter of the budget of the
+   cache, whatever is smaller.  It collapses as soon as a block out
+   of sequence is accessed.
+
+   If the device can be read from several threads, the blocks are
+   read ahead asynchronously by a helper thread, and installed in the
+   cache once the read completes.  Otherwise, the cache reads more
+   blocks at once when it misses within a stream.  */
+
+#define IOC_RA_MIN 4
+#define IOC_RA_MAX 64
+
+#define IOC_RA_MAX_WINDOW(cache)                                \
+  ((cache)->max_blocks / 4 < IOC_RA_MAX                         \
+   ? (cache)->max_blocks / 4 : IOC_RA_MAX)
+
+#if HAVE_IOS_ASYNC_READAHEAD
+
+static void
+ios_cache_ra_req_free (struct ios_cache_ra_req *req)
+{
+  free (req->bytes);
+  free (req);
+}
+
+/* Body of the helper thread of CACHE, which serves its readahead
+   requests.  */
+
+static void *
+ios_cache_ra_thread (void *data)
+{
+  struct ios_cache *cache = data;
+
+  pthread_mutex_lock (&cache->ra_mutex);
+  while (!cache->ra_quit)
+    {
+      struct ios_cache_ra_req *req = cache->ra_req;
+      int ret;
+
+      if (req == NULL || req->done || req->async_p)
+        {
+          pthread_cond_wait (&cache->ra_cond, &cache->ra_mutex);
+          continue;
+        }
+
+      pthread_mutex_unlock (&cache->ra_mutex);
+      ret = cache->dev_if->pread (cache->dev, req->bytes, req->size,
+                                  req->block_no * IOS_CACHE_BLOCK_SIZE);
+      pthread_mutex_lock (&cache->ra_mutex);
+
+      req->ret = ret;
+      req->done = 1;
+      pthread_cond_broadcast (&cache->ra_cond);
+    }
+  pthread_mutex_unlock (&cache->ra_mutex);
+
+  return NULL;
+}
+
+/* Detach the pending readahead request from CACHE and return it.  If
+   WAIT_P is set, wait for the request to complete.  Otherwise, return
+   NULL if the request is still in progress.  Also return NULL if
+   there is no pending request.  */
+
+static struct ios_cache_ra_req *
+ios_cache_ra_take (struct ios_cache *cache, int wait_p)
+{
+  struct ios_cache_ra_req *req = cache->ra_req;
+
+  if (req == NULL)
+    return NULL;
+
+  if (req->async_p)
+    {
+      req->ret = cache->dev_if->pread_finish (cache->dev, wait_p,
+                                              &req->done);
+      if (!req->done)
+        return NULL;
+      cache->ra_req = NULL;
+      return req;
+    }
+
+  pthread_mutex_lock (&cache->ra_mutex);
+  while (wait_p && !req->done)
+    pthread_cond_wait (&cache->ra_cond, &cache->ra_mutex);
+  if (req->done)
+    cache->ra_req = NULL;
+  else
+    req = NULL;
+  pthread_mutex_unlock (&cache->ra_mutex);
+
+  return req;
+}
+
+#endif /* HAVE_IOS_ASYNC_READAHEAD */
+
+/* Note that the COUNT bytes of the device starting at byte offset
+   OFFSET are about to be written, so any data read ahead in that
+   range is not valid anymore.  */
+
+static void
+ios_cache_ra_invalidate (struct ios_cache *cache, ios_dev_off offset,
+                         size_t count)
+{
+#if HAVE_IOS_ASYNC_READAHEAD
+  struct ios_cache_ra_req *req = cache->ra_req;
+
+  if (req
+      && offset < req->block_no * IOS_CACHE_BLOCK_SIZE + req->size
+      && offset + count > req->block_no * IOS_CACHE_BLOCK_SIZE)
+    req->stale = 1;
+#endif
+}
+
+/* Discard any readahead in progress in CACHE, stop its helper thread
+   and forget about the current stream.  */
+
+static void
+ios_cache_ra_stop (struct ios_cache *cache)
+{
+#if HAVE_IOS_ASYNC_READAHEAD
+  struct ios_cache_ra_req *req = ios_cache_ra_take (cache, 1);
+
+  if (req)
+    ios_cache_ra_req_free (req);
+
+  if (cache->ra_thread_p == 1)
+    {
+      pthread_mutex_lock (&cache->ra_mutex);
+      cache->ra_quit = 1;
+      pthread_cond_broadcast (&cache->ra_cond);
+      pthread_mutex_unlock (&cache->ra_mutex);
+
+      pthread_join (cache->ra_thread, NULL);
+      cache->ra_thread_p = 0;
+      cache->ra_quit = 0;
+    }
+#endif
+
+  cache->ra_window = 0;
+  cache->ra_end = 0;
+}
+
+static int
+ios_cache_alloc_buckets (struct ios_cache *cache, size_t size)
+{
+  size_t num_buckets = 1;
+
+  cache->max_blocks = size / IOS_CACHE_BLOCK_SIZE;
+  while (num_buckets < cache->max_blocks)
+    num_buckets <<= 1;
+
+  cache->buckets = calloc (num_buckets, sizeof (struct ios_cache_block *));
+  if (!cache->buckets)
+    return IOD_ENOMEM;
+  cache->num_buckets = num_buckets;
+  return IOD_OK;
+}
+
+struct ios_cache *
+ios_cache_new (void *dev, struct ios_dev_if *dev_if, size_t size,
+               struct ios_stats *stats)
+{
+  struct ios_cache *cache = calloc (1, sizeof (struct ios_cache));
+
+  if (!cache)
+    return NULL;
+
+  cache->dev = dev;
+  cache->dev_if = dev_if;
+  cache->stats = stats;
+  if (ios_cache_alloc_buckets (cache, size) != IOD_OK)
+    {
+      free (cache);
+      return NULL;
+    }
+
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_init (&cache->ra_mutex, NULL);
+  pthread_cond_init (&cache->ra_cond, NULL);
+#endif
+
+  return cache;
+}
+
+static void
+ios_cache_drop_all (struct ios_cache *cache)
+{
+  struct ios_cache_block *block, *next;
+
+  for (block = cache->lru_head; block; block = next)
+    {
+      next = block->lru_next;
+      free (block);
+    }
+
+  if (cache->buckets)
+    memset (cache->buckets, 0,
+            cache->num_buckets * sizeof (struct ios_cache_block *));
+  cache->lru_head = cache->lru_tail = NULL;
+  cache->num_blocks = 0;
+  cache->dirty = 0;
+}
+
+void
+ios_cache_free (struct ios_cache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  ios_cache_ra_stop (cache);
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_destroy (&cache->ra_mutex);
+  pthread_cond_destroy (&cache->ra_cond);
+#endif
+
+  ios_cache_drop_all (cache);
+  free (cache->buckets);
+  free (cache);
+}
+
+/* Read and write the device of CACHE, accounting the request in the
+   statistics of the cache.  */
+
+static int
+ios_cache_dev_pread (struct ios_cache *cache, void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  uint64_t start = ios_stats_start ();
+  int ret = cache->dev_if->pread (cache->dev, buf, count, offset);
+
+  ios_stats_read (cache->stats, count, start);
+  return ret;
+}
+
+static int
+ios_cache_dev_pwrite (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset)
+{
+  uint64_t start = ios_stats_start ();
+  int ret = cache->dev_if->pwrite (cache->dev, buf, count, offset);
+
+  ios_stats_write (cache->stats, count, start);
+  return ret;
+}
+
+static inline struct ios_cache_block **
+ios_cache_bucket (struct ios_cache *cache, ios_dev_off block_no)
+{
+  return &cache->buckets[block_no & (cache->num_buckets - 1)];
+}
+
+static struct ios_cache_block *
+ios_cache_lookup (struct ios_cache *cache, ios_dev_off block_no)
+{
+  struct ios_cache_block *block;
+
+  for (block = *ios_cache_bucket (cache, block_no);
+       block;
+       block = block->hash_next)
+    if (block->block_no == block_no)
+      return block;
+
+  return NULL;
+}
+
+static void
+ios_cache_lru_unlink (struct ios_cache *cache, struct ios_cache_block *block)
+{
+  if (block->lru_prev)
+    block->lru_prev->lru_next = block->lru_next;
+  else
+    cache->lru_head = block->lru_next;
+
+  if (block->lru_next)
+    block->lru_next->lru_prev = block->lru_prev;
+  else
+    cache->lru_tail = block->lru_prev;
+}
+
+static void
+ios_cache_lru_push (struct ios_cache *cache, struct ios_cache_block *block)
+{
+  block->lru_prev = NULL;
+  block->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = block;
+  cache->lru_head = block;
+  if (cache->lru_tail == NULL)
+    cache->lru_tail = block;
+}
+
+/* Remove BLOCK from the hash table and the LRU list of CACHE.  The
+   memory of the block is not freed.  */
+
+static void
+ios_cache_unlink (struct ios_cache *cache, struct ios_cache_block *block)
+{
+  struct ios_cache_block **p;
+
+  for (p = ios_cache_bucket (cache, block->block_no);
+       *p != block;
+       p = &(*p)->hash_next)
+    assert (*p != NULL);
+  *p = block->hash_next;
+
+  ios_cache_lru_unlink (cache, block);
+  cache->num_blocks--;
+}
+
+/* Add BLOCK to the hash table of CACHE, as the most recently used
+   block.  */
+
+static void
+ios_cache_link (struct ios_cache *cache, struct ios_cache_block *block)
+{
+  struct ios_cache_block **bucket = ios_cache_bucket (cache, block->block_no);
+
+  block->hash_next = *bucket;
+  *bucket = block;
+  ios_cache_lru_push (cache, block);
+  cache->num_blocks++;
+}
+
+static int
+ios_cache_block_writeback (struct ios_cache *cache,
+                           struct ios_cache_block *block)
+{
+  int ret;
+
+  if (block->dirty_begin == block->dirty_end)
+    return IOD_OK;
+
+  ios_cache_ra_invalidate (cache,
+                           block->block_no * IOS_CACHE_BLOCK_SIZE
+                           + block->dirty_begin,
+                           block->dirty_end - block->dirty_begin);
+  ret = ios_cache_dev_pwrite (cache,
+                              block->bytes + block->dirty_begin,
+                              block->dirty_end - block->dirty_begin,
+                              block->block_no * IOS_CACHE_BLOCK_SIZE
+                              + block->dirty_begin);
+  if (ret != IOD_OK)
+    return ret;
+
+  cache->dirty -= block->dirty_end - block->dirty_begin;
+  block->dirty_begin = block->dirty_end = 0;
+  return IOD_OK;
+}
+
+/* Write back the modified data in the N blocks in BLOCKS, which are
+   sorted by block number.  Runs of consecutive blocks whose modified
+   ranges are contiguous are written using a single vectored write,
+   if the device supports it.  */
+
+static int
+ios_cache_writeback_blocks (struct ios_cache *cache,
+                            struct ios_cache_block **blocks, size_t n)
+{
+  struct iovec iov[IOD_IOV_MAX];
+  size_t i, j, run, count;
+  uint64_t start;
+  int ret;
+
+  for (i = 0; i < n; i += run)
+    {
+      ios_dev_off offset;
+
+      for (run = 1; i + run < n && run < IOD_IOV_MAX; ++run)
+        {
+          struct ios_cache_block *prev = blocks[i + run - 1];
+          struct ios_cache_block *block = blocks[i + run];
+
+          if (cache->dev_if->pwritev == NULL
+              || block->block_no != prev->block_no + 1
+              || prev->dirty_end != IOS_CACHE_BLOCK_SIZE
+              || block->dirty_begin != 0)
+            break;
+        }
+
+      if (run == 1)
+        {
+          if ((ret = ios_cache_block_writeback (cache, blocks[i])) != IOD_OK)
+            return ret;
+          continue;
+        }
+
+      for (count = 0, j = 0; j < run; ++j)
+        {
+          struct ios_cache_block *block = blocks[i + j];
+
+          iov[j].iov_base = block->bytes + block->dirty_begin;
+          iov[j].iov_len = block->dirty_end - block->dirty_begin;
+          count += iov[j].iov_len;
+        }
+
+      offset = (blocks[i]->block_no * IOS_CACHE_BLOCK_SIZE
+                + blocks[i]->dirty_begin);
+      ios_cache_ra_invalidate (cache, offset,
+                               (blocks[i + run - 1]->block_no
+                                * IOS_CACHE_BLOCK_SIZE
+                                + blocks[i + run - 1]->dirty_end)
+                               - offset);
+      start = ios_stats_start ();
+      ret = cache->dev_if->pwritev (cache->dev, iov, run, offset);
+      ios_stats_write (cache->stats, count, start);
+      if (ret != IOD_OK)
+        return ret;
+
+      for (j = 0; j < run; ++j)
+        {
+          struct ios_cache_block *block = blocks[i + j];
+
+          cache->dirty -= block->dirty_end - block->dirty_begin;
+          block->dirty_begin = block->dirty_end = 0;
+        }
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_cache_block_cmp (const void *a, const void *b)
+{
+  const struct ios_cache_block *block_a
+    = *(const struct ios_cache_block **) a;
+  const struct ios_cache_block *block_b
+    = *(const struct ios_cache_block **) b;
+
+  return (block_a->block_no > block_b->block_no)
+    - (block_a->block_no < block_b->block_no);
+}
+
+/* Get memory for a new block in CACHE, evicting the least recently
+   used block if the cache is full.  The returned block is not linked
+   in the cache.  */
+
+static int
+ios_cache_take_block (struct ios_cache *cache,
+                      struct ios_cache_block **blockp)
+{
+  struct ios_cache_block *block;
+  int ret;
+
+  if (cache->num_blocks >= cache->max_blocks && cache->lru_tail)
+    {
+      /* Reuse the least recently used block.  */
+      block = cache->lru_tail;
+      if ((ret = ios_cache_block_writeback (cache, block)) != IOD_OK)
+        return ret;
+      ios_cache_unlink (cache, block);
+    }
+  else
+    {
+      block = malloc (sizeof (struct ios_cache_block));
+      if (!block)
+        return IOD_ENOMEM;
+    }
+
+  *blockp = block;
+  return IOD_OK;
+}
+
+/* Load the block BLOCK_NO from the device into CACHE, along with up
+   to NBLOCKS - 1 blocks following it that are not cached yet.  If the
+   device supports it, all the blocks are read with a single vectored
+   read.  Set *BLOCKP to the block BLOCK_NO.  */
+
+static int
+ios_cache_load (struct ios_cache *cache, ios_dev_off block_no,
+                size_t nblocks, struct ios_cache_block **blockp)
+{
+  struct ios_cache_block *blocks[IOD_IOV_MAX];
+  struct iovec iov[IOD_IOV_MAX];
+  ios_dev_off begin = block_no * IOS_CACHE_BLOCK_SIZE;
+  ios_dev_off dev_size = cache->dev_if->size (cache->dev);
+  size_t i, n, count = 0;
+  uint64_t start;
+  int ret = IOD_OK;
+
+  if (begin >= dev_size)
+    return IOD_EOF;
+
+  if (nblocks > IOD_IOV_MAX)
+    nblocks = IOD_IOV_MAX;
+  if (nblocks > cache->max_blocks)
+    nblocks = cache->max_blocks;
+  if (cache->dev_if->preadv == NULL)
+    nblocks = 1;
+
+  /* Determine the run of blocks to load, which ends at the end of
+     the device or at the first block that is already cached.  */
+  for (n = 1; n < nblocks; ++n)
+    if (begin + n * IOS_CACHE_BLOCK_SIZE >= dev_size
+        || ios_cache_lookup (cache, block_no + n))
+      break;
+
+  for (i = 0; i < n; ++i)
+    {
+      ios_dev_off block_begin = begin + i * IOS_CACHE_BLOCK_SIZE;
+
+      if ((ret = ios_cache_take_block (cache, &blocks[i])) != IOD_OK)
+        break;
+
+      blocks[i]->block_no = block_no + i;
+      blocks[i]->valid = (dev_size - block_begin > IOS_CACHE_BLOCK_SIZE
+                          ? IOS_CACHE_BLOCK_SIZE
+                          : dev_size - block_begin);
+      blocks[i]->dirty_begin = blocks[i]->dirty_end = 0;
+      iov[i].iov_base = blocks[i]->bytes;
+      iov[i].iov_len = blocks[i]->valid;
+      count += blocks[i]->valid;
+    }
+
+  /* Make do with the blocks we could get.  */
+  n = i;
+  if (n == 0)
+    return ret;
+
+  if (n == 1)
+    ret = ios_cache_dev_pread (cache, blocks[0]->bytes,
+                               blocks[0]->valid, begin);
+  else
+    {
+      start = ios_stats_start ();
+      ret = cache->dev_if->preadv (cache->dev, iov, n, begin);
+      ios_stats_read (cache->stats, count, start);
+    }
+
+  if (ret != IOD_OK)
+    {
+      for (i = 0; i < n; ++i)
+        free (blocks[i]);
+      return ret;
+    }
+
+  /* Link the blocks so the one requested ends up being the most
+     recently used.  */
+  for (i = n; i > 0; --i)
+    ios_cache_link (cache, blocks[i - 1]);
+
+  *blockp = blocks[0];
+  return IOD_OK;
+}
+
+/* Return 1 if CACHE reads ahead asynchronously, 0 otherwise.  */
+
+static int
+ios_cache_ra_async_p (struct ios_cache *cache)
+{
+#if HAVE_IOS_ASYNC_READAHEAD
+  return ((cache->dev_if->pread_start || cache->dev_if->thread_safe_p)
+          && cache->ra_thread_p >= 0);
+#else
+  return 0;
+#endif
+}
+
+#if HAVE_IOS_ASYNC_READAHEAD
+
+/* Install the blocks read by the readahead request REQ in CACHE,
+   except those that are already cached, and free REQ.  */
+
+static void
+ios_cache_ra_install (struct ios_cache *cache, struct ios_cache_ra_req *req)
+{
+  size_t i;
+
+  for (i = 0; i < req->nblocks && req->ret == IOD_OK && !req->stale; ++i)
+    {
+      struct ios_cache_block *block;
+      size_t block_begin = i * IOS_CACHE_BLOCK_SIZE;
+
+      if (ios_cache_lookup (cache, req->block_no + i))
+        continue;
+      if (ios_cache_take_block (cache, &block) != IOD_OK)
+        break;
+
+      block->block_no = req->block_no + i;
+      block->valid = (req->size - block_begin > IOS_CACHE_BLOCK_SIZE
+                      ? IOS_CACHE_BLOCK_SIZE
+                      : req->size - block_begin);
+      block->dirty_begin = block->dirty_end = 0;
+      memcpy (block->bytes, req->bytes + block_begin, block->valid);
+      ios_cache_link (cache, block);
+    }
+
+  ios_cache_ra_req_free (req);
+}
+
+/* Ask the device of CACHE, or else its helper thread, to read NBLOCKS
+   blocks starting at BLOCK_NO.  Return the number of blocks being
+   read ahead, which is zero if the request couldn't be issued.  */
+
+static size_t
+ios_cache_ra_issue (struct ios_cache *cache, ios_dev_off block_no,
+                    size_t nblocks)
+{
+  struct ios_cache_ra_req *req;
+  ios_dev_off begin = block_no * IOS_CACHE_BLOCK_SIZE;
+  ios_dev_off dev_size = cache->dev_if->size (cache->dev);
+
+  if (begin >= dev_size)
+    return 0;
+
+  req = malloc (sizeof (struct ios_cache_ra_req));
+  if (!req)
+    return 0;
+
+  req->block_no = block_no;
+  req->size = (dev_size - begin > nblocks * IOS_CACHE_BLOCK_SIZE
+               ? nblocks * IOS_CACHE_BLOCK_SIZE
+               : dev_size - begin);
+  req->nblocks = IOC_BLOCK_NO (req->size - 1) + 1;
+  req->ret = IOD_OK;
+  req->done = req->stale = req->async_p = 0;
+  req->bytes = malloc (req->size);
+  if (!req->bytes)
+    {
+      free (req);
+      return 0;
+    }
+
+  /* Devices that can read asynchronously by themselves don't need
+     the helper thread.  */
+  if (cache->dev_if->pread_start
+      && cache->dev_if->pread_start (cache->dev, req->bytes, req->size,
+                                     begin) == IOD_OK)
+    {
+      req->async_p = 1;
+      cache->ra_req = req;
+      ios_stats_read (cache->stats, req->size, 0);
+      return req->nblocks;
+    }
+
+  if (!cache->dev_if->thread_safe_p)
+    {
+      /* Read ahead synchronously from now on.  */
+      cache->ra_thread_p = -1;
+      ios_cache_ra_req_free (req);
+      return 0;
+    }
+
+  if (cache->ra_thread_p == 0)
+    {
+      if (pthread_create (&cache->ra_thread, NULL, ios_cache_ra_thread,
+                          cache) != 0)
+        {
+          /* Read ahead synchronously from now on.  */
+          cache->ra_thread_p = -1;
+          ios_cache_ra_req_free (req);
+          return 0;
+        }
+      cache->ra_thread_p = 1;
+    }
+
+  pthread_mutex_lock (&cache->ra_mutex);
+  cache->ra_req = req;
+  pthread_cond_broadcast (&cache->ra_cond);
+  pthread_mutex_unlock (&cache->ra_mutex);
+
+  ios_stats_read (cache->stats, req->size, 0);
+  return req->nblocks;
+}
+
+#endif /* HAVE_IOS_ASYNC_READAHEAD */
+
+/* Double the readahead window of CACHE, up to its maximum size.  */
+
+static void
+ios_cache_ra_grow (struct ios_cache *cache)
+{
+  cache->ra_window *= 2;
+  if (cache->ra_window > IOC_RA_MAX_WINDOW (cache))
+    cache->ra_window = IOC_RA_MAX_WINDOW (cache);
+}
+
+/* Update the readahead state of CACHE after an access to the block
+   BLOCK_NO, and read ahead asynchronously if appropriate.  */
+
+static void
+ios_cache_ra_update (struct ios_cache *cache, ios_dev_off block_no)
+{
+  /* Accessing the same block again doesn't break the stream, nor
+     advances it.  */
+  if (block_no + 1 == cache->ra_next)
+    return;
+
+  if (block_no != cache->ra_next
+      || IOC_RA_MAX_WINDOW (cache) < IOC_RA_MIN)
+    {
+      /* Random access.  Stop reading ahead.  */
+      cache->ra_next = block_no + 1;
+      cache->ra_window = 0;
+#if HAVE_IOS_ASYNC_READAHEAD
+      if (cache->ra_req)
+        cache->ra_req->stale = 1;
+#endif
+      return;
+    }
+
+  cache->ra_next = block_no + 1;
+  if (cache->ra_window == 0)
+    {
+      cache->ra_window = IOC_RA_MIN;
+      cache->ra_end = block_no + 1;
+    }
+
+#if HAVE_IOS_ASYNC_READAHEAD
+  /* Read the next window once the stream gets close to the end of
+     the blocks read ahead so far.  */
+  if (ios_cache_ra_async_p (cache)
+      && cache->ra_req == NULL
+      && cache->ra_end <= block_no + cache->ra_window / 2)
+    {
+      ios_dev_off begin = (cache->ra_end > block_no
+                           ? cache->ra_end : block_no + 1);
+      size_t n = ios_cache_ra_issue (cache, begin, cache->ra_window);
+
+      if (n > 0)
+        {
+          cache->ra_end = begin + n;
+          ios_cache_ra_grow (cache);
+        }
+    }
+#endif
+}
+
+/* Get the block BLOCK_NO of CACHE, loading it from the device if it
+   is not cached.  NBLOCKS is the number of consecutive blocks that
+   the caller is going to access, starting with BLOCK_NO.  */
+
+static int
+ios_cache_get_block (struct ios_cache *cache, ios_dev_off block_no,
+                     size_t nblocks, struct ios_cache_block **blockp)
+{
+  struct ios_cache_block *block;
+
+#if HAVE_IOS_ASYNC_READAHEAD
+  /* Install the blocks read ahead, if they are ready.  */
+  {
+    struct ios_cache_ra_req *req = ios_cache_ra_take (cache, 0);
+
+    if (req)
+      ios_cache_ra_install (cache, req);
+  }
+#endif
+
+  ios_cache_ra_update (cache, block_no);
+
+  block = ios_cache_lookup (cache, block_no);
+  if (block)
+    {
+      cache->stats->cache_hits++;
+      if (block != cache->lru_head)
+        {
+          ios_cache_lru_unlink (cache, block);
+          ios_cache_lru_push (cache, block);
+        }
+      *blockp = block;
+      return IOD_OK;
+    }
+
+  cache->stats->cache_misses++;
+
+#if HAVE_IOS_ASYNC_READAHEAD
+  /* If the block is being read ahead, wait for it rather than reading
+     it again.  */
+  if (cache->ra_req
+      && !cache->ra_req->stale
+      && block_no >= cache->ra_req->block_no
+      && block_no < cache->ra_req->block_no + cache->ra_req->nblocks)
+    {
+      ios_cache_ra_install (cache, ios_cache_ra_take (cache, 1));
+
+      block = ios_cache_lookup (cache, block_no);
+      if (block)
+        {
+          *blockp = block;
+          return IOD_OK;
+        }
+    }
+#endif
+
+  /* Within a stream, read ahead synchronously if it can't be done
+     asynchronously.  */
+  if (cache->ra_window > nblocks && !ios_cache_ra_async_p (cache))
+    {
+      nblocks = cache->ra_window;
+      ios_cache_ra_grow (cache);
+    }
+
+  return ios_cache_load (cache, block_no, nblocks, blockp);
+}
+
+int
+ios_cache_sync (struct ios_cache *cache, ios_dev_off offset, size_t count)
+{
+  ios_dev_off block_no, last_block_no;
+  struct ios_cache_block *block;
+  int ret;
+
+  ios_cache_ra_invalidate (cache, offset, count);
+
+  if (count == 0 || cache->num_blocks == 0)
+    return IOD_OK;
+
+  last_block_no = IOC_BLOCK_NO (offset + count - 1);
+  for (block_no = IOC_BLOCK_NO (offset);
+       block_no <= last_block_no;
+       block_no++)
+    {
+      block = ios_cache_lookup (cache, block_no);
+      if (!block)
+        continue;
+
+      if ((ret = ios_cache_block_writeback (cache, block)) != IOD_OK)
+        return ret;
+      ios_cache_unlink (cache, block);
+      free (block);
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                 ios_dev_off offset)
+{
+  struct ios_cache_block *block;
+  int ret;
+
+  if (cache->max_blocks == 0)
+    return ios_cache_dev_pread (cache, buf, count, offset);
+
+  while (count > 0)
+    {
+      size_t block_offset = IOC_BLOCK_OFFSET (offset);
+      size_t n = IOS_CACHE_BLOCK_SIZE - block_offset;
+
+      if (n > count)
+        n = count;
+
+      if (ios_cache_get_block (cache, IOC_BLOCK_NO (offset),
+                               IOC_BLOCK_NO (block_offset + count - 1) + 1,
+                               &block) != IOD_OK
+          || block_offset + n > block->valid)
+        goto direct;
+
+      memcpy (buf, block->bytes + block_offset, n);
+      buf = (uint8_t *) buf + n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+
+ direct:
+  /* The rest of the range is not covered by the cache, most likely
+     because it extends past the end of the device as it was when the
+     blocks got loaded.  Make sure the device is up to date and ask
+     it directly.  */
+  if ((ret = ios_cache_sync (cache, offset, count)) != IOD_OK)
+    return ret;
+  return ios_cache_dev_pread (cache, buf, count, offset);
+}
+
+/* Blocks are prefetched in batches of at most half the budget of the
+   cache, so the blocks of a batch don't evict each other.  */
+
+#define IOC_PREFETCH_MAX(cache) ((cache)->max_blocks / 2)
+
+static int
+ios_cache_block_no_cmp (const void *a, const void *b)
+{
+  ios_dev_off block_no_a = *(const ios_dev_off *) a;
+  ios_dev_off block_no_b = *(const ios_dev_off *) b;
+
+  return (block_no_a > block_no_b) - (block_no_a < block_no_b);
+}
+
+int
+ios_cache_prefetch (struct ios_cache *cache,
+                    const struct ios_dev_read_req *reqs, int nreqs)
+{
+  size_t max = IOC_PREFETCH_MAX (cache);
+  ios_dev_off dev_size;
+  ios_dev_off *block_nos;
+  struct ios_cache_block **blocks = NULL;
+  struct ios_dev_read_req *dev_reqs = NULL;
+  size_t i, n = 0, nblocks = 0, count = 0;
+  uint64_t start;
+  int j, ret = IOD_OK;
+
+  if (cache->dev_if->pread_batch == NULL || max == 0)
+    return IOD_OK;
+
+  block_nos = malloc (max * sizeof (ios_dev_off));
+  if (!block_nos)
+    return IOD_ENOMEM;
+
+  /* Collect the blocks covering the ranges that are not cached.  */
+  dev_size = cache->dev_if->size (cache->dev);
+  for (j = 0; j < nreqs && n < max; ++j)
+    {
+      ios_dev_off block_no, last_block_no;
+
+      if (reqs[j].count == 0 || reqs[j].offset >= dev_size)
+        continue;
+
+      last_block_no = IOC_BLOCK_NO (reqs[j].offset + reqs[j].count - 1);
+      for (block_no = IOC_BLOCK_NO (reqs[j].offset);
+           block_no <= last_block_no && n < max;
+           ++block_no)
+        if (block_no * IOS_CACHE_BLOCK_SIZE < dev_size
+            && !ios_cache_lookup (cache, block_no))
+          block_nos[n++] = block_no;
+    }
+
+  /* Sort them and drop the duplicates.  */
+  qsort (block_nos, n, sizeof (ios_dev_off), ios_cache_block_no_cmp);
+  for (i = 0; i < n; ++i)
+    if (nblocks == 0 || block_nos[i] != block_nos[nblocks - 1])
+      block_nos[nblocks++] = block_nos[i];
+
+  if (nblocks == 0)
+    goto done;
+
+  blocks = malloc (nblocks * sizeof (struct ios_cache_block *));
+  dev_reqs = malloc (nblocks * sizeof (struct ios_dev_read_req));
+  if (!blocks || !dev_reqs)
+    {
+      ret = IOD_ENOMEM;
+      goto done;
+    }
+
+  for (i = 0; i < nblocks; ++i)
+    {
+      ios_dev_off block_begin = block_nos[i] * IOS_CACHE_BLOCK_SIZE;
+
+      if ((ret = ios_cache_take_block (cache, &blocks[i])) != IOD_OK)
+        break;
+
+      blocks[i]->block_no = block_nos[i];
+      blocks[i]->valid = (dev_size - block_begin > IOS_CACHE_BLOCK_SIZE
+                          ? IOS_CACHE_BLOCK_SIZE
+                          : dev_size - block_begin);
+      blocks[i]->dirty_begin = blocks[i]->dirty_end = 0;
+      dev_reqs[i].offset = block_begin;
+      dev_reqs[i].buf = blocks[i]->bytes;
+      dev_reqs[i].count = blocks[i]->valid;
+      count += blocks[i]->valid;
+    }
+
+  /* Make do with the blocks we could get.  */
+  nblocks = i;
+  if (nblocks == 0)
+    goto done;
+
+  start = ios_stats_start ();
+  ret = cache->dev_if->pread_batch (cache->dev, dev_reqs, nblocks);
+  ios_stats_read (cache->stats, count, start);
+  for (i = 0; i < nblocks; ++i)
+    {
+      if (ret == IOD_OK)
+        ios_cache_link (cache, blocks[i]);
+      else
+        free (blocks[i]);
+    }
+  if (ret == IOD_OK)
+    cache->stats->cache_misses += nblocks;
+
+ done:
+  free (dev_reqs);
+  free (blocks);
+  free (block_nos);
+  return ret;
+}
+
+int
+ios_cache_pwrite (struct ios_cache *cache, const void *buf, size_t count,
+                  ios_dev_off offset)
+{
+  struct ios_cache_block *block;
+  int ret;
+
+  if (cache->max_blocks == 0)
+    return ios_cache_dev_pwrite (cache, buf, count, offset);
+
+  cache->stats->cache_writes++;
+
+  while (count > 0)
+    {
+      size_t block_offset = IOC_BLOCK_OFFSET (offset);
+      size_t n = IOS_CACHE_BLOCK_SIZE - block_offset;
+
+      if (n > count)
+        n = count;
+
+      if (ios_cache_get_block (cache, IOC_BLOCK_NO (offset), 1, &block)
+          != IOD_OK
+          || block_offset + n > block->valid)
+        goto direct;
+
+      memcpy (block->bytes + block_offset, buf, n);
+      cache->dirty -= block->dirty_end - block->dirty_begin;
+      if (block->dirty_begin == block->dirty_end)
+        {
+          block->dirty_begin = block_offset;
+          block->dirty_end = block_offset + n;
+        }
+      else
+        {
+          if (block_offset < block->dirty_begin)
+            block->dirty_begin = block_offset;
+          if (block_offset + n > block->dirty_end)
+            block->dirty_end = block_offset + n;
+        }
+      cache->dirty += block->dirty_end - block->dirty_begin;
+
+      buf = (const uint8_t *) buf + n;
+      offset += n;
+      count -= n;
+    }
+
+  if (cache->dirty > IOC_DIRTY_MAX (cache))
+    return ios_cache_writeback (cache);
+
+  return IOD_OK;
+
+ direct:
+  /* Writing past the end of the device may make it grow, or fail.
+     In either case the device has the last word, so write through.  */
+  if ((ret = ios_cache_sync (cache, offset, count)) != IOD_OK)
+    return ret;
+  return ios_cache_dev_pwrite (cache, buf, count, offset);
+}
+
+int
+ios_cache_writeback (struct ios_cache *cache)
+{
+  struct ios_cache_block **blocks, *block;
+  size_t n = 0;
+  int ret;
+
+  if (cache->dirty == 0)
+    return IOD_OK;
+
+  /* Write the modified blocks in ascending order, so adjacent blocks
+     can be written together.  */
+  blocks = malloc (cache->num_blocks * sizeof (struct ios_cache_block *));
+  if (!blocks)
+    {
+      for (block = cache->lru_head; block; block = block->lru_next)
+        if ((ret = ios_cache_block_writeback (cache, block)) != IOD_OK)
+          return ret;
+      return IOD_OK;
+    }
+
+  for (block = cache->lru_head; block; block = block->lru_next)
+    if (block->dirty_begin != block->dirty_end)
+      blocks[n++] = block;
+
+  qsort (blocks, n, sizeof (struct ios_cache_block *), ios_cache_block_cmp);
+  ret = ios_cache_writeback_blocks (cache, blocks, n);
+  free (blocks);
+  return ret;
+}
+
+size_t
+ios_cache_get_size (struct ios_cache *cache)
+{
+  return cache->max_blocks * IOS_CACHE_BLOCK_SIZE;
+}
+
+int
+ios_cache_set_size (struct ios_cache *cache, size_t size)
+{
+  int ret;
+
+  if ((ret = ios_cache_writeback (cache)) != IOD_OK)
+    return ret;
+  ios_cache_ra_stop (cache);
+  ios_cache_drop_all (cache);
+
+  free (cache->buckets);
+  cache->buckets = NULL;
+  cache->num_buckets = 0;
+  if ((ret = ios_cache_alloc_buckets (cache, size)) != IOD_OK)
+    {
+      /* Leave the cache in a usable, disabled state.  */
+      cache->max_blocks = 0;
+      return ret;
+    }
+
+  return IOD_OK;
+}
+
+size_t
+ios_cache_get_dirty (struct ios_cache *cache)
+{
+  return cache->dirty;
+}
@@ -0,0 +1,101 @@
+/* ios-cache.h - Block cache for IO spaces.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An IOS cache sits between an IO space and the IO device it
+   operates.  It keeps copies of fixed-size blocks of the device in
+   memory, which are read from the device on demand and evicted in
+   least-recently-used order once the budget of the cache is
+   exhausted.
+
+   Writes to cached blocks are not propagated to the device right
+   away: the modified ranges are recorded in the blocks and written
+   back when the block is evicted, when ios_cache_writeback is called
+   or when the modified data amounts to half the budget of the cache.
+   Reads of modified ranges are served from the cache.  Writes that
+   fall outside of the device (and thus may make it grow) are always
+   written through.
+
+   The functions below return IOD_* error codes, so they can be used
+   in place of the corresponding device interface functions.  */
+
+#define IOS_CACHE_BLOCK_SIZE 4096
+#define IOS_CACHE_DEFAULT_SIZE (256 * IOS_CACHE_BLOCK_SIZE)
+
+struct ios_cache;
+
+/* Create a new cache of at most SIZE bytes for the device DEV, which
+   is operated using DEV_IF.  The lookups in the cache and the
+   requests it performs on the device are accounted in STATS.  Return
+   NULL if there is not enough memory.  */
+
+struct ios_cache *ios_cache_new (void *dev, struct ios_dev_if *dev_if,
+                                 size_t size, struct ios_stats *stats);
+
+/* Free all the resources used by CACHE.  Note that this function
+   doesn't write back modified blocks: use ios_cache_writeback
+   before.  */
+
+void ios_cache_free (struct ios_cache *cache);
+
+/* Read COUNT bytes at byte offset OFFSET into BUF, through the
+   cache.  */
+
+int ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                     ios_dev_off offset);
+
+/* Load the blocks covering the NREQS byte ranges described by REQS
+   that are not cached yet, reading all of them from the device with
+   a single batched read.  Only the offsets and sizes of REQS are
+   used.  This does nothing if the device doesn't support batched
+   reads.  */
+
+int ios_cache_prefetch (struct ios_cache *cache,
+                        const struct ios_dev_read_req *reqs, int nreqs);
+
+/* Write COUNT bytes from BUF at byte offset OFFSET, through the
+   cache.  */
+
+int ios_cache_pwrite (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset);
+
+/* Write back the modified blocks in the COUNT bytes starting at byte
+   offset OFFSET and drop them from the cache, so the next access to
+   that range goes to the device.  */
+
+int ios_cache_sync (struct ios_cache *cache, ios_dev_off offset,
+                    size_t count);
+
+/* Write back all the modified blocks in CACHE, in ascending order of
+   offset.  Contiguous modified ranges spanning several blocks are
+   written in a single operation if the device supports vectored
+   writes.  */
+
+int ios_cache_writeback (struct ios_cache *cache);
+
+/* Get and set the budget of CACHE, in bytes.  Setting the budget
+   writes back and drops all the blocks in the cache.  A budget of
+   zero effectively disables the cache.  */
+
+size_t ios_cache_get_size (struct ios_cache *cache);
+
+int ios_cache_set_size (struct ios_cache *cache, size_t size);
+
+/* Get the number of modified bytes in CACHE that have not been
+   written back yet.  */
+
+size_t ios_cache_get_dirty (struct ios_cache *cache);
@@ -0,0 +1,303 @@
+/* ios-dev-cow.c - Copy-on-write overlay IO devices.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This IO device operates on top of some other IO space, the "base"
+   space.  Its handlers have the form cow:N, N being the id of the
+   base space.
+
+   Reads are served by the base space, but the bytes written to the
+   device are kept in a delta in memory, and never reach the base
+   space unless the changes are committed.  This allows to experiment
+   with big images, or images that can't be written to, without
+   copying them first or risking to corrupt them.
+
+   The delta is a transaction overlay (see ios-trans.h), which keeps
+   only the modified ranges, merged in as few extents as possible.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-trans.h"
+
+#define IOS_COW_HANDLER_PREFIX "cow:"
+
+/* State associated with a COW device.
+
+   The base space is looked up by BASE_ID every time it is accessed,
+   so the device notices if it gets closed.  */
+
+struct ios_dev_cow
+{
+  int base_id;
+  struct ios_trans *delta;
+  uint64_t flags;
+};
+
+static char *
+ios_dev_cow_get_if_name () {
+  return "COW";
+}
+
+static char *
+ios_dev_cow_handler_normalize (const char *handler, uint64_t flags,
+                               int *error)
+{
+  size_t prefix_len = strlen (IOS_COW_HANDLER_PREFIX);
+  char *new_handler = NULL;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (strncmp (handler, IOS_COW_HANDLER_PREFIX, prefix_len) == 0
+      && handler[prefix_len] != '\0'
+      && (strspn (handler + prefix_len, "0123456789")
+          == strlen (handler + prefix_len)))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+static void *
+ios_dev_cow_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_cow *cio = NULL;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int internal_error = IOD_ERROR;
+  long base_id;
+
+  /* There is nothing to create nor truncate.  */
+  if (flags_mode & (IOS_F_CREATE | IOS_F_TRUNCATE))
+    {
+      internal_error = IOD_EFLAGS;
+      goto err;
+    }
+
+  base_id = strtol (handler + strlen (IOS_COW_HANDLER_PREFIX), NULL, 10);
+  if (base_id > INT_MAX || ios_search_by_id (base_id) == NULL)
+    {
+      internal_error = IOD_EINVAL;
+      goto err;
+    }
+
+  cio = malloc (sizeof (struct ios_dev_cow));
+  if (!cio)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  cio->delta = ios_trans_new ();
+  if (!cio->delta)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  cio->base_id = base_id;
+  cio->flags = flags_mode ? flags : flags | IOS_F_READ | IOS_F_WRITE;
+
+  if (error)
+    *error = IOD_OK;
+  return cio;
+
+ err:
+  free (cio);
+  if (error)
+    *error = internal_error;
+  return NULL;
+}
+
+static int
+ios_dev_cow_close (void *iod)
+{
+  struct ios_dev_cow *cio = iod;
+
+  ios_trans_free (cio->delta);
+  free (cio);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_cow_get_flags (void *iod)
+{
+  struct ios_dev_cow *cio = iod;
+
+  return cio->flags;
+}
+
+/* Return the base space of CIO, or NULL if it has been closed.  */
+
+static ios
+ios_dev_cow_base (struct ios_dev_cow *cio)
+{
+  return ios_search_by_id (cio->base_id);
+}
+
+static ios_dev_off
+ios_dev_cow_size (void *iod)
+{
+  struct ios_dev_cow *cio = iod;
+  ios base = ios_dev_cow_base (cio);
+  ios_dev_off size = base ? ios_size (base) / 8 : 0;
+  ios_dev_off end = ios_trans_end (cio->delta);
+
+  return end > size ? end : size;
+}
+
+static int
+ios_dev_cow_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_cow *cio = iod;
+  ios base = ios_dev_cow_base (cio);
+  ios_dev_off size;
+  int ret;
+
+  if (!base)
+    return IOD_EOF;
+
+  /* Read what the base space has, and make sure that the rest of the
+     range has been written to the delta.  */
+  size = ios_size (base) / 8;
+  if (offset < size)
+    {
+      size_t n = size - offset < count ? size - offset : count;
+
+      if ((ret = ios_read_raw (base, buf, n, offset)) != IOD_OK)
+        return ret;
+    }
+
+  if (offset + count > size)
+    {
+      ios_dev_off begin = offset > size ? offset : size;
+
+      if (!ios_trans_covered_p (cio->delta, offset + count - begin, begin))
+        return IOD_EOF;
+    }
+
+  ios_trans_patch (cio->delta, buf, count, offset);
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_cow *cio = iod;
+
+  if (!(cio->flags & IOS_F_WRITE))
+    return IOD_EOF;
+
+  /* The device can be extended, but it can't have holes.  */
+  if (offset > ios_dev_cow_size (cio))
+    return IOD_EOF;
+
+  return ios_trans_pwrite (cio->delta, buf, count, offset);
+}
+
+static int
+ios_dev_cow_flush (void *iod, ios_dev_off offset)
+{
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_read_base (void *data, void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  return ios_read_raw ((ios) data, buf, count, offset);
+}
+
+static int
+ios_dev_cow_write_base (void *data, const void *buf, size_t count,
+                        ios_dev_off offset)
+{
+  return ios_write_raw ((ios) data, buf, count, offset);
+}
+
+static int
+ios_dev_cow_commit (void *iod)
+{
+  struct ios_dev_cow *cio = iod;
+  ios base = ios_dev_cow_base (cio);
+  struct ios_trans *delta;
+  int ret;
+
+  if (!base)
+    return IOD_ERROR;
+
+  delta = ios_trans_new ();
+  if (!delta)
+    return IOD_ENOMEM;
+
+  /* If writing to the base space fails the base space is restored
+     and the delta is kept, so the commit can be retried.  */
+  ret = ios_trans_commit (cio->delta, ios_dev_cow_read_base,
+                          ios_dev_cow_write_base, base);
+  if (ret != IOD_OK)
+    {
+      ios_trans_free (delta);
+      return ret;
+    }
+
+  ios_trans_free (cio->delta);
+  cio->delta = delta;
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_export_changes (void *iod,
+                            int (*write) (void *data, const void *buf,
+                                          size_t count, ios_dev_off offset),
+                            void *data)
+{
+  struct ios_dev_cow *cio = iod;
+
+  return ios_trans_commit (cio->delta, NULL, write, data);
+}
+
+static int
+ios_dev_cow_blocking_p (void *iod)
+{
+  ios base = ios_dev_cow_base (iod);
+
+  return base && ios_blocking_p (base);
+}
+
+struct ios_dev_if ios_dev_cow =
+  {
+   .get_if_name = ios_dev_cow_get_if_name,
+   .handler_normalize = ios_dev_cow_handler_normalize,
+   .open = ios_dev_cow_open,
+   .close = ios_dev_cow_close,
+   .pread = ios_dev_cow_pread,
+   .pwrite = ios_dev_cow_pwrite,
+   .get_flags = ios_dev_cow_get_flags,
+   .size = ios_dev_cow_size,
+   .flush = ios_dev_cow_flush,
+   .blocking_p = ios_dev_cow_blocking_p,
+   .commit = ios_dev_cow_commit,
+   .export_changes = ios_dev_cow_export_changes,
+  };
@@ -24,21 +24,69 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
+#if HAVE_LIBURING
+#  include <liburing.h>
+#endif
 
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with a file device.  */
+#if HAVE_LIBURING
+
+/* Number of entries of the io_uring of the file devices.  This is
+   also the maximum number of reads that are in flight at the same
+   time.  */
+
+#define IOS_DEV_FILE_RING_ENTRIES 64
+
+/* A read in flight in the io_uring of a file device.  RES is the
+   result of the read once DONE is set.  */
+
+struct ios_dev_file_aread
+{
+  void *buf;
+  size_t count;
+  ios_dev_off offset;
+  int res;
+  int done;
+};
+
+#endif /* HAVE_LIBURING */
+
+/* State associated with a file device.
+
+   The file is accessed through FD using positioned reads and writes,
+   so the device doesn't keep a file position and the descriptor can
+   be used concurrently to read from several threads.
+
+   SEQUENTIAL_P is set once the kernel has been told that the file is
+   being accessed sequentially, to avoid repeating the hint.
+
+   If RING_P is set, RING is an io_uring used to read scattered
+   ranges of the file with a single system call, and to read without
+   blocking.  ASYNC is the read started by pread_start, if
+   ASYNC_PENDING_P is set.  The ring is only used from the thread
+   operating the IO space, so it doesn't get in the way of
+   concurrent preads.  */
 
 struct ios_dev_file
 {
-  FILE *file;
+  int fd;
   char *filename;
   uint64_t flags;
+  int sequential_p;
+#if HAVE_LIBURING
+  int ring_p;
+  struct io_uring ring;
+  int async_pending_p;
+  struct ios_dev_file_aread async;
+#endif
 };
 
 static char *
@@ -67,44 +115,45 @@ static void *
 ios_dev_file_open (const char *handler, uint64_t flags, int *error)
 {
   struct ios_dev_file *fio = NULL;
-  FILE *f = NULL;
+  int fd = -1;
   int internal_error = IOD_ERROR;
-  const char *mode;
+  int oflags;
   uint8_t flags_mode = flags & IOS_FLAGS_MODE;
 
   if (flags_mode != 0)
     {
       /* Decide what mode to use to open the file.  */
       if (flags_mode == IOS_F_READ)
-        mode = "rb";
+        oflags = O_RDONLY;
       else if (flags_mode == (IOS_F_WRITE | IOS_F_CREATE | IOS_F_TRUNCATE))
-        mode = "wb";
+        oflags = O_WRONLY | O_CREAT | O_TRUNC;
       else if (flags_mode == (IOS_F_READ | IOS_F_WRITE))
-        mode = "r+b";
-      else if (flags_mode == (IOS_F_WRITE | IOS_F_CREATE | IOS_F_TRUNCATE))
-        mode = "w+b";
+        oflags = O_RDWR;
+      else if (flags_mode == (IOS_F_READ | IOS_F_WRITE
+                              | IOS_F_CREATE | IOS_F_TRUNCATE))
+        oflags = O_RDWR | O_CREAT | O_TRUNC;
       else
         {
           internal_error = IOD_EFLAGS;
           goto err;
         }
 
-      f = fopen (handler, mode);
+      fd = open (handler, oflags, 0666);
     }
   else
     {
       /* Try read-write initially.
          If that fails, then try read-only. */
-      f = fopen (handler, "r+b");
+      fd = open (handler, O_RDWR);
       flags |= (IOS_F_READ | IOS_F_WRITE);
-      if (!f)
+      if (fd == -1)
         {
-          f = fopen (handler, "rb");
+          fd = open (handler, O_RDONLY);
           flags &= ~IOS_F_WRITE;
         }
     }
 
-  if (!f)
+  if (fd == -1)
     goto err;
 
   fio = malloc (sizeof (struct ios_dev_file));
@@ -115,8 +164,16 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error)
   if (!fio->filename)
     goto err;
 
-  fio->file = f;
+  fio->fd = fd;
   fio->flags = flags;
+  fio->sequential_p = 0;
+#if HAVE_LIBURING
+  /* Fall back to plain reads if the kernel doesn't support
+     io_uring.  */
+  fio->ring_p = (io_uring_queue_init (IOS_DEV_FILE_RING_ENTRIES,
+                                      &fio->ring, 0) == 0);
+  fio->async_pending_p = 0;
+#endif
 
   if (error)
     *error = IOD_OK;
@@ -127,8 +184,8 @@ err:
     free (fio->filename);
   free (fio);
 
-  if (f)
-    fclose (f);
+  if (fd != -1)
+    close (fd);
 
   if (error)
     {
@@ -145,12 +202,29 @@ err:
   return NULL;
 }
 
+#if HAVE_LIBURING
+static int ios_dev_file_pread_finish (void *iod, int wait_p, int *done_p);
+#endif
+
 static int
 ios_dev_file_close (void *iod)
 {
   struct ios_dev_file *fio = iod;
 
-  if (fclose (fio->file) == 0)
+#if HAVE_LIBURING
+  if (fio->ring_p)
+    {
+      int done;
+
+      /* The kernel may still be writing to the buffer of a read in
+         flight.  */
+      if (fio->async_pending_p)
+        ios_dev_file_pread_finish (fio, 1, &done);
+      io_uring_queue_exit (&fio->ring);
+    }
+#endif
+
+  if (close (fio->fd) == 0)
     {
       free (fio->filename);
       free (fio);
@@ -173,24 +247,28 @@ ios_dev_file_get_flags (void *iod)
   return fio->flags;
 }
 
-
 static int
 ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET) == -1)
-    return IOD_EOF;
-  ret = fread (buf, 1, count, fio->file);
+  /* Retry on short reads, which are legitimate for some kinds of
+     files and for big buffers.  */
+  while (count > 0)
+    {
+      ssize_t ret = pread (fio->fd, buf, count, offset);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return IOD_EOF;
 
-  /* XXX As long as count <= 9 because the ios layer reads at most an
-     unaligned uint64_t, we are unlikely to hit short reads.  But if
-     future code adds in large buffer reads, we may want to retry on
-     short reads rather than giving up right away. */
-  return ret == count ? 0 : IOD_EOF;
+      buf = (uint8_t *) buf + ret;
+      offset += ret;
+      count -= ret;
+    }
+
+  return IOD_OK;
 }
 
 static int
@@ -198,25 +276,393 @@ ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET))
+  while (count > 0)
+    {
+      ssize_t ret = pwrite (fio->fd, buf, count, offset);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return IOD_EOF;
+
+      buf = (const uint8_t *) buf + ret;
+      offset += ret;
+      count -= ret;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_file_get_fd (void *iod)
+{
+  struct ios_dev_file *fio = iod;
+
+  return (fio->flags & IOS_F_READ) ? fio->fd : -1;
+}
+
+#if HAVE_COPY_FILE_RANGE
+
+/* Copy ranges of files without transferring their contents to user
+   space, and without copying them at all in file systems supporting
+   sharing extents between files.  */
+
+static int
+ios_dev_file_copy (void *iod, ios_dev_off to, int fd, ios_dev_off from,
+                   ios_dev_off count)
+{
+  struct ios_dev_file *fio = iod;
+  off_t from_off = from, to_off = to;
+  int copied_p = 0;
+
+  if (!(fio->flags & IOS_F_WRITE))
     return IOD_EOF;
-  ret = fwrite (buf, 1, count, fio->file);
 
-  return ret == count ? 0 : IOD_EOF;
+  while (count > 0)
+    {
+      size_t n = count > SSIZE_MAX ? SSIZE_MAX : count;
+      ssize_t ret = copy_file_range (fd, &from_off, fio->fd, &to_off,
+                                     n, 0);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret == -1 && !copied_p
+          && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+              || errno == EOPNOTSUPP))
+        return IOD_EINVAL;
+      if (ret <= 0)
+        return IOD_EOF;
+
+      copied_p = 1;
+      count -= ret;
+    }
+
+  return IOD_OK;
+}
+
+#endif /* HAVE_COPY_FILE_RANGE */
+
+#if HAVE_PREADV || HAVE_PWRITEV
+
+/* Skip the first DONE bytes of the IOVCNT buffers in *IOV, updating
+   *IOV and *IOVCNT.  The buffer descriptors in *IOV are modified, so
+   this shall operate on a copy of the vector passed by the caller.  */
+
+static void
+ios_dev_file_iov_advance (struct iovec **iov, int *iovcnt, size_t done)
+{
+  while (*iovcnt > 0 && done >= (*iov)->iov_len)
+    {
+      done -= (*iov)->iov_len;
+      (*iov)++;
+      (*iovcnt)--;
+    }
+
+  if (*iovcnt > 0)
+    {
+      (*iov)->iov_base = (uint8_t *) (*iov)->iov_base + done;
+      (*iov)->iov_len -= done;
+    }
+}
+
+#endif /* HAVE_PREADV || HAVE_PWRITEV */
+
+static int
+ios_dev_file_preadv (void *iod, const struct iovec *iov, int iovcnt,
+                     ios_dev_off offset)
+{
+  struct ios_dev_file *fio = iod;
+#if HAVE_PREADV
+  struct iovec v[IOD_IOV_MAX];
+  struct iovec *p = v;
+
+  if (iovcnt > IOD_IOV_MAX)
+    return IOD_EINVAL;
+  memcpy (v, iov, iovcnt * sizeof (struct iovec));
+
+  while (iovcnt > 0)
+    {
+      ssize_t ret = preadv (fio->fd, p, iovcnt, offset);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return IOD_EOF;
+
+      offset += ret;
+      ios_dev_file_iov_advance (&p, &iovcnt, ret);
+    }
+
+  return IOD_OK;
+#else
+  int i, ret;
+
+  for (i = 0; i < iovcnt; offset += iov[i].iov_len, ++i)
+    if ((ret = ios_dev_file_pread (fio, iov[i].iov_base, iov[i].iov_len,
+                                   offset)) != IOD_OK)
+      return ret;
+
+  return IOD_OK;
+#endif
+}
+
+static int
+ios_dev_file_pwritev (void *iod, const struct iovec *iov, int iovcnt,
+                      ios_dev_off offset)
+{
+  struct ios_dev_file *fio = iod;
+#if HAVE_PWRITEV
+  struct iovec v[IOD_IOV_MAX];
+  struct iovec *p = v;
+
+  if (iovcnt > IOD_IOV_MAX)
+    return IOD_EINVAL;
+  memcpy (v, iov, iovcnt * sizeof (struct iovec));
+
+  while (iovcnt > 0)
+    {
+      ssize_t ret = pwritev (fio->fd, p, iovcnt, offset);
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return IOD_EOF;
+
+      offset += ret;
+      ios_dev_file_iov_advance (&p, &iovcnt, ret);
+    }
+
+  return IOD_OK;
+#else
+  int i, ret;
+
+  for (i = 0; i < iovcnt; offset += iov[i].iov_len, ++i)
+    if ((ret = ios_dev_file_pwrite (fio, iov[i].iov_base, iov[i].iov_len,
+                                    offset)) != IOD_OK)
+      return ret;
+
+  return IOD_OK;
+#endif
+}
+
+#if HAVE_LIBURING
+
+/* Queue a read of the COUNT bytes at OFFSET described by AREAD in the
+   ring of FIO.  Return 1 on success, 0 if the submission queue is
+   full.  */
+
+static int
+ios_dev_file_ring_queue (struct ios_dev_file *fio,
+                         struct ios_dev_file_aread *aread)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe (&fio->ring);
+
+  if (!sqe)
+    return 0;
+
+  io_uring_prep_read (sqe, fio->fd, aread->buf, aread->count,
+                      aread->offset);
+  io_uring_sqe_set_data (sqe, aread);
+  aread->res = 0;
+  aread->done = 0;
+  return 1;
+}
+
+/* Stop using the ring of FIO, after failing to wait for the reads in
+   flight.  Closing the ring cancels them.  The reads that didn't
+   complete are left with a null result, so they are performed again
+   with plain reads.  */
+
+static void
+ios_dev_file_ring_abandon (struct ios_dev_file *fio)
+{
+  io_uring_queue_exit (&fio->ring);
+  fio->ring_p = 0;
+}
+
+/* Get a completed read from the ring of FIO, and mark it as done.
+   If WAIT_P is set, submit the queued reads and wait for one to
+   complete if none has.  Return the completed read, or NULL if there
+   is none.  */
+
+static struct ios_dev_file_aread *
+ios_dev_file_ring_reap (struct ios_dev_file *fio, int wait_p)
+{
+  struct io_uring_cqe *cqe;
+  struct ios_dev_file_aread *aread;
+  int ret;
+
+  /* Submitting again takes care of reads whose submission failed.  */
+  if (wait_p)
+    io_uring_submit (&fio->ring);
+
+  do
+    ret = (wait_p
+           ? io_uring_wait_cqe (&fio->ring, &cqe)
+           : io_uring_peek_cqe (&fio->ring, &cqe));
+  while (ret == -EINTR);
+
+  if (ret != 0)
+    return NULL;
+
+  aread = io_uring_cqe_get_data (cqe);
+  aread->res = cqe->res;
+  aread->done = 1;
+  io_uring_cqe_seen (&fio->ring, cqe);
+  return aread;
+}
+
+/* Return the result of the completed read AREAD, finishing it with
+   plain reads if it was short or if the ring couldn't perform it, as
+   happens with kernels not supporting reads in io_uring.  */
+
+static int
+ios_dev_file_aread_result (struct ios_dev_file *fio,
+                           struct ios_dev_file_aread *aread)
+{
+  size_t done = aread->res > 0 ? aread->res : 0;
+
+  if (done == aread->count)
+    return IOD_OK;
+
+  return ios_dev_file_pread (fio, (uint8_t *) aread->buf + done,
+                             aread->count - done, aread->offset + done);
+}
+
+static int
+ios_dev_file_pread_batch (void *iod, const struct ios_dev_read_req *reqs,
+                          int nreqs)
+{
+  struct ios_dev_file *fio = iod;
+  struct ios_dev_file_aread areads[IOS_DEV_FILE_RING_ENTRIES];
+  int i, ret = IOD_OK;
+
+  /* Keep as many reads in flight as the ring allows, and reap them
+     together.  */
+  if (fio->ring_p)
+    {
+      for (i = 0; i < nreqs && fio->ring_p;)
+        {
+          int j, n = 0, in_flight;
+
+          while (n < IOS_DEV_FILE_RING_ENTRIES - 1 && i + n < nreqs)
+            {
+              areads[n].buf = reqs[i + n].buf;
+              areads[n].count = reqs[i + n].count;
+              areads[n].offset = reqs[i + n].offset;
+              if (!ios_dev_file_ring_queue (fio, &areads[n]))
+                break;
+              n++;
+            }
+
+          if (n == 0)
+            break;
+
+          /* The completion of a read started by pread_start may be
+             interleaved with ours.  If waiting fails, the reads that
+             didn't complete are finished below.  */
+          for (in_flight = n; in_flight > 0;)
+            {
+              struct ios_dev_file_aread *aread
+                = ios_dev_file_ring_reap (fio, 1);
+
+              if (!aread)
+                {
+                  ios_dev_file_ring_abandon (fio);
+                  break;
+                }
+              if (aread != &fio->async)
+                in_flight--;
+            }
+
+          for (j = 0; j < n; ++j)
+            if (ios_dev_file_aread_result (fio, &areads[j]) != IOD_OK)
+              ret = IOD_EOF;
+
+          i += n;
+        }
+
+      if (i == nreqs)
+        return ret;
+      reqs += i;
+      nreqs -= i;
+    }
+
+  for (i = 0; i < nreqs; ++i)
+    if (ios_dev_file_pread (fio, reqs[i].buf, reqs[i].count,
+                            reqs[i].offset) != IOD_OK)
+      ret = IOD_EOF;
+
+  return ret;
+}
+
+static int
+ios_dev_file_pread_start (void *iod, void *buf, size_t count,
+                          ios_dev_off offset)
+{
+  struct ios_dev_file *fio = iod;
+
+  if (!fio->ring_p || fio->async_pending_p)
+    return IOD_ERROR;
+
+  fio->async.buf = buf;
+  fio->async.count = count;
+  fio->async.offset = offset;
+  if (!ios_dev_file_ring_queue (fio, &fio->async))
+    return IOD_ERROR;
+
+  /* If the submission fails it is retried while reaping.  */
+  io_uring_submit (&fio->ring);
+  fio->async_pending_p = 1;
+  return IOD_OK;
+}
+
+static int
+ios_dev_file_pread_finish (void *iod, int wait_p, int *done_p)
+{
+  struct ios_dev_file *fio = iod;
+
+  if (!fio->async_pending_p)
+    {
+      *done_p = 1;
+      return IOD_EOF;
+    }
+
+  while (!fio->async.done && fio->ring_p)
+    if (!ios_dev_file_ring_reap (fio, wait_p))
+      {
+        if (wait_p)
+          ios_dev_file_ring_abandon (fio);
+        break;
+      }
+
+  /* If the ring has been abandoned, the read is finished with plain
+     reads.  */
+  *done_p = fio->async.done || !fio->ring_p;
+  if (!*done_p)
+    return IOD_OK;
+
+  fio->async_pending_p = 0;
+  return ios_dev_file_aread_result (fio, &fio->async);
 }
 
+#endif /* HAVE_LIBURING */
+
 static ios_dev_off
 ios_dev_file_size (void *iod)
 {
   struct stat st;
   struct ios_dev_file *fio = iod;
+  off_t size;
+
+  if (fstat (fio->fd, &st) == 0 && S_ISREG (st.st_mode))
+    return st.st_size;
 
-  fstat (fileno (fio->file), &st);
-  return st.st_size;
+  /* fstat doesn't provide the size of block devices, but seeking to
+     their end does.  */
+  size = lseek (fio->fd, 0, SEEK_END);
+  return size == -1 ? 0 : size;
 }
 
 static int
@@ -225,6 +671,39 @@ ios_dev_file_flush (void *iod, ios_dev_off offset)
   return IOS_OK;
 }
 
+static int
+ios_dev_file_advise (void *iod, ios_dev_off offset, ios_dev_off count,
+                     int advice)
+{
+#if HAVE_POSIX_FADVISE
+  struct ios_dev_file *fio = iod;
+
+  switch (advice)
+    {
+    case IOD_ADVICE_NORMAL:
+      fio->sequential_p = 0;
+      posix_fadvise (fio->fd, 0, 0, POSIX_FADV_NORMAL);
+      break;
+    case IOD_ADVICE_SEQUENTIAL:
+      /* This applies to the whole file in most systems, so there is
+         no point in repeating it for every range.  */
+      if (!fio->sequential_p)
+        {
+          fio->sequential_p = 1;
+          posix_fadvise (fio->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+      break;
+    case IOD_ADVICE_WILLNEED:
+      posix_fadvise (fio->fd, offset, count, POSIX_FADV_WILLNEED);
+      break;
+    default:
+      return IOD_EINVAL;
+    }
+#endif
+
+  return IOD_OK;
+}
+
 struct ios_dev_if ios_dev_file =
   {
    .get_if_name = ios_dev_file_get_if_name,
@@ -233,7 +712,21 @@ struct ios_dev_if ios_dev_file =
    .close = ios_dev_file_close,
    .pread = ios_dev_file_pread,
    .pwrite = ios_dev_file_pwrite,
+   .preadv = ios_dev_file_preadv,
+   .pwritev = ios_dev_file_pwritev,
+#if HAVE_LIBURING
+   .pread_batch = ios_dev_file_pread_batch,
+   .pread_start = ios_dev_file_pread_start,
+   .pread_finish = ios_dev_file_pread_finish,
+#endif
    .get_flags = ios_dev_file_get_flags,
    .size = ios_dev_file_size,
-   .flush = ios_dev_file_flush
+   .flush = ios_dev_file_flush,
+   .advise = ios_dev_file_advise,
+   .get_fd = ios_dev_file_get_fd,
+#if HAVE_COPY_FILE_RANGE
+   .copy = ios_dev_file_copy,
+#endif
+   .cacheable_p = 1,
+   .thread_safe_p = 1,
   };
@@ -20,21 +20,41 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State asociated with a memory device.  */
+/* State asociated with a memory device.
+
+   SIZE is the size of the device, which grows in multiples of
+   MEM_STEP bytes as the buffer is written past its end.
+
+   Normally the contents of the device are kept in the buffer at
+   POINTER, which is CAPACITY bytes long.  The capacity is doubled
+   when it gets exhausted, so building a big buffer by writing at its
+   end takes linear time.
+
+   If the device is sparse, POINTER is not used.  Instead, PAGES is a
+   table of NUM_PAGES pointers to the pages of MEM_STEP bytes that
+   hold the contents of the device.  Pages are allocated when they
+   are first written to, and pages that are not allocated read as
+   zeros.  */
 
 struct ios_dev_mem
 {
   char *pointer;
+  size_t capacity;
+  char **pages;
+  size_t num_pages;
   size_t size;
   uint64_t flags;
 };
 
 #define MEM_STEP (512 * 8)
 
+#define MEM_SPARSE_P(mio) ((mio)->flags & IOS_F_MEM_SPARSE)
+
 static char *
 ios_dev_mem_get_if_name () {
   return "MEMORY";
@@ -55,11 +75,65 @@ ios_dev_mem_handler_normalize (const char *handler, uint64_t flags, int *error)
   return new_handler;
 }
 
+/* Make room in MIO for SIZE bytes, growing geometrically the buffer
+   or the page table.  The new room reads as zeros.  */
+
+static int
+ios_dev_mem_reserve (struct ios_dev_mem *mio, size_t size)
+{
+  if (MEM_SPARSE_P (mio))
+    {
+      size_t num_pages = (size + MEM_STEP - 1) / MEM_STEP;
+      size_t new_num_pages = mio->num_pages;
+      char **pages;
+
+      if (num_pages <= mio->num_pages)
+        return IOD_OK;
+
+      while (new_num_pages < num_pages)
+        new_num_pages = new_num_pages ? new_num_pages * 2 : 1;
+      if (new_num_pages > SIZE_MAX / sizeof (char *))
+        return IOD_ENOMEM;
+
+      pages = realloc (mio->pages, new_num_pages * sizeof (char *));
+      if (!pages)
+        return IOD_ENOMEM;
+
+      memset (pages + mio->num_pages, 0,
+              (new_num_pages - mio->num_pages) * sizeof (char *));
+      mio->pages = pages;
+      mio->num_pages = new_num_pages;
+    }
+  else
+    {
+      size_t new_capacity = mio->capacity;
+      char *pointer;
+
+      if (size <= mio->capacity)
+        return IOD_OK;
+
+      while (new_capacity < size)
+        new_capacity = (new_capacity > SIZE_MAX / 2
+                        ? size : (new_capacity ? new_capacity * 2 : size));
+
+      pointer = realloc (mio->pointer, new_capacity);
+      if (!pointer)
+        return IOD_ENOMEM;
+
+      memset (pointer + mio->capacity, 0, new_capacity - mio->capacity);
+      mio->pointer = pointer;
+      mio->capacity = new_capacity;
+    }
+
+  return IOD_OK;
+}
+
 static void *
 ios_dev_mem_open (const char *handler, uint64_t flags, int *error)
 {
   int internal_error = IOD_ERROR;
   struct ios_dev_mem *mio = malloc (sizeof (struct ios_dev_mem));
+  uint64_t steps = (flags & IOS_F_MEM_SIZE_MASK) >> IOS_F_MEM_SIZE_SHIFT;
 
   if (!mio)
     {
@@ -67,21 +141,42 @@ ios_dev_mem_open (const char *handler, uint64_t flags, int *error)
       goto err;
     }
 
-  mio->pointer = calloc (MEM_STEP, 1);
-  if (!mio->pointer)
+  mio->pointer = NULL;
+  mio->capacity = 0;
+  mio->pages = NULL;
+  mio->num_pages = 0;
+  /* Memory buffers can always be read and written.  Report it, so
+     spaces built on top of this one, like windows, can be written
+     to as well.  */
+  mio->flags = (flags & IOS_M_RDWR) ? flags : flags | IOS_M_RDWR;
+
+  /* The buffer is initially one step long, unless the caller asked
+     for some other size.  */
+  if (steps == 0)
+    steps = 1;
+  if (steps > SIZE_MAX / MEM_STEP)
     {
       internal_error = IOD_ENOMEM;
       goto err;
     }
+  mio->size = steps * MEM_STEP;
 
-  mio->size = MEM_STEP;
-  mio->flags = flags;
+  if (ios_dev_mem_reserve (mio, mio->size) != IOD_OK)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
 
   if (error)
     *error = IOD_OK;
   return mio;
 
 err:
+  if (mio)
+    {
+      free (mio->pointer);
+      free (mio->pages);
+    }
   free (mio);
   if (error)
     *error = internal_error;
@@ -92,7 +187,11 @@ static int
 ios_dev_mem_close (void *iod)
 {
   struct ios_dev_mem *mio = iod;
+  size_t i;
 
+  for (i = 0; i < mio->num_pages; ++i)
+    free (mio->pages[i]);
+  free (mio->pages);
   free (mio->pointer);
   free (mio);
 
@@ -111,11 +210,70 @@ static int
 ios_dev_mem_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_mem *mio = iod;
+  char *bytes = buf;
 
-  if (offset + count > mio->size)
+  if (offset > mio->size || count > mio->size - offset)
     return IOD_EOF;
 
-  memcpy (buf, &mio->pointer[offset], count);
+  if (!MEM_SPARSE_P (mio))
+    {
+      memcpy (buf, &mio->pointer[offset], count);
+      return 0;
+    }
+
+  while (count > 0)
+    {
+      char *page = mio->pages[offset / MEM_STEP];
+      size_t page_offset = offset % MEM_STEP;
+      size_t n = (MEM_STEP - page_offset < count
+                  ? MEM_STEP - page_offset : count);
+
+      if (page)
+        memcpy (bytes, page + page_offset, n);
+      else
+        memset (bytes, 0, n);
+
+      bytes += n;
+      offset += n;
+      count -= n;
+    }
+
+  return 0;
+}
+
+/* Write COUNT bytes from BYTES at OFFSET in the pages of the sparse
+   device MIO, allocating them as needed.  Zeros written to pages not
+   allocated yet don't need to be stored.  */
+
+static int
+ios_dev_mem_pwrite_sparse (struct ios_dev_mem *mio, const char *bytes,
+                           size_t count, ios_dev_off offset)
+{
+  while (count > 0)
+    {
+      char **page = &mio->pages[offset / MEM_STEP];
+      size_t page_offset = offset % MEM_STEP;
+      size_t n = (MEM_STEP - page_offset < count
+                  ? MEM_STEP - page_offset : count);
+
+      if (*page == NULL)
+        {
+          size_t i;
+
+          for (i = 0; i < n && bytes[i] == 0; ++i)
+            ;
+          if (i < n && (*page = calloc (MEM_STEP, 1)) == NULL)
+            return IOD_ERROR;
+        }
+
+      if (*page)
+        memcpy (*page + page_offset, bytes, n);
+
+      bytes += n;
+      offset += n;
+      count -= n;
+    }
+
   return 0;
 }
 
@@ -126,25 +284,26 @@ ios_dev_mem_pwrite (void *iod, const void *buf, size_t count,
 {
   struct ios_dev_mem *mio = iod;
 
-  if (offset + count > mio->size + MEM_STEP)
+  /* Writes can start at most one step past the end of the buffer.
+     The buffer grows as many steps as needed to hold the written
+     data.  */
+  if (offset > mio->size + MEM_STEP
+      || count > SIZE_MAX - MEM_STEP - offset)
     return IOD_EOF;
 
   if (offset + count > mio->size)
     {
-      void *pointer_bak = mio->pointer;
-
-      mio->pointer = realloc (mio->pointer, mio->size + MEM_STEP);
-      if (!mio->pointer)
-        {
-          /* Restore pointer after failed realloc and return error. */
-          mio->pointer = pointer_bak;
-          return IOD_ERROR;
-        }
+      size_t new_size
+        = (offset + count + MEM_STEP - 1) / MEM_STEP * MEM_STEP;
 
-      memset (&mio->pointer[mio->size], 0, MEM_STEP);
-      mio->size += MEM_STEP;
+      if (ios_dev_mem_reserve (mio, new_size) != IOD_OK)
+        return IOD_ERROR;
+      mio->size = new_size;
     }
 
+  if (MEM_SPARSE_P (mio))
+    return ios_dev_mem_pwrite_sparse (mio, buf, count, offset);
+
   memcpy (&mio->pointer[offset], buf, count);
   return 0;
 }
@@ -0,0 +1,421 @@
+/* ios-dev-mmap.c - Memory-mapped file IO devices.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This IO device operates on regular files by mapping them in
+   memory, so reading and writing amounts to copying bytes from and
+   to the mapping.  It is only used for files opened with the
+   IOS_F_FILE_MMAP flag.  Files that can't be mapped, like character
+   devices, pipes or empty files, are not recognized by this backend
+   and are handled by the file IO device instead.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* State associated with a mmap device.
+
+   FD is the file descriptor of the mapped file.  It is used to
+   extend the file when writing past its end.
+
+   ADDR is the address of the mapping, or NULL if the mapping failed.
+   In that case the device falls back to read and write the file
+   using FD.
+
+   SIZE is the size of the file, in bytes.
+
+   DIRTY_BEGIN and DIRTY_END delimit the range of the mapping that
+   has been written since the last flush.  The range is empty if
+   DIRTY_BEGIN is not less than DIRTY_END.  */
+
+struct ios_dev_mmap
+{
+  int fd;
+  char *filename;
+  uint8_t *addr;
+  ios_dev_off size;
+  ios_dev_off dirty_begin;
+  ios_dev_off dirty_end;
+  uint64_t flags;
+};
+
+static char *
+ios_dev_mmap_get_if_name () {
+  /* From the user's point of view these are plain files.  */
+  return "FILE";
+}
+
+static char *
+ios_dev_mmap_handler_normalize (const char *handler, uint64_t flags,
+                                int *error)
+{
+  char *new_handler = NULL;
+  struct stat st;
+
+  if (error)
+    *error = IOD_OK;
+
+  /* Files are only mapped on request.  Creating and truncating files
+     is left to the file IO device, as is operating on anything that
+     is not a non-empty regular file.  */
+  if (!(flags & IOS_F_FILE_MMAP)
+      || (flags & (IOS_F_CREATE | IOS_F_TRUNCATE)))
+    return NULL;
+
+  if (stat (handler, &st) != 0
+      || !S_ISREG (st.st_mode)
+      || st.st_size == 0
+      || (uintmax_t) st.st_size > SIZE_MAX)
+    return NULL;
+
+  IOS_FILE_HANDLER_NORMALIZE (handler, new_handler);
+  if (new_handler == NULL && error)
+    *error = IOD_ENOMEM;
+
+  return new_handler;
+}
+
+/* Write the modified pages of the mapping of MIO before the byte
+   offset END back to the file, and wait for the writes to
+   complete.  */
+
+static int
+ios_dev_mmap_sync (struct ios_dev_mmap *mio, ios_dev_off end)
+{
+  size_t pagesize = getpagesize ();
+  ios_dev_off begin;
+
+  if (end > mio->dirty_end)
+    end = mio->dirty_end;
+
+  if (mio->addr == NULL || mio->dirty_begin >= end)
+    return IOD_OK;
+
+  /* The address passed to msync shall be page-aligned.  */
+  begin = mio->dirty_begin - mio->dirty_begin % pagesize;
+  if (msync (mio->addr + begin, end - begin, MS_SYNC) != 0)
+    return IOD_ERROR;
+
+  if (end == mio->dirty_end)
+    {
+      mio->dirty_begin = 0;
+      mio->dirty_end = 0;
+    }
+  else
+    mio->dirty_begin = end;
+  return IOD_OK;
+}
+
+/* Map the first SIZE bytes of the file in MIO.  If the mapping fails
+   the device keeps working using plain reads and writes.  */
+
+static void
+ios_dev_mmap_map (struct ios_dev_mmap *mio, ios_dev_off size)
+{
+  int prot = PROT_READ | (mio->flags & IOS_F_WRITE ? PROT_WRITE : 0);
+  void *addr;
+
+  if (mio->addr)
+    {
+      ios_dev_mmap_sync (mio, mio->size);
+      munmap (mio->addr, mio->size);
+      mio->dirty_begin = 0;
+      mio->dirty_end = 0;
+    }
+
+  addr = (size > 0 && size <= SIZE_MAX
+          ? mmap (NULL, size, prot, MAP_SHARED, mio->fd, 0)
+          : MAP_FAILED);
+
+  mio->addr = addr == MAP_FAILED ? NULL : addr;
+  mio->size = size;
+}
+
+static void *
+ios_dev_mmap_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_mmap *mio = NULL;
+  int fd = -1;
+  int internal_error = IOD_ERROR;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  struct stat st;
+
+  if (flags_mode != 0)
+    {
+      if (flags_mode == IOS_F_READ)
+        fd = open (handler, O_RDONLY);
+      else if (flags_mode == (IOS_F_READ | IOS_F_WRITE))
+        fd = open (handler, O_RDWR);
+      else
+        {
+          internal_error = IOD_EFLAGS;
+          goto err;
+        }
+    }
+  else
+    {
+      /* Try read-write initially.
+         If that fails, then try read-only. */
+      fd = open (handler, O_RDWR);
+      flags |= (IOS_F_READ | IOS_F_WRITE);
+      if (fd == -1)
+        {
+          fd = open (handler, O_RDONLY);
+          flags &= ~IOS_F_WRITE;
+        }
+    }
+
+  if (fd == -1 || fstat (fd, &st) != 0)
+    goto err;
+
+  mio = malloc (sizeof (struct ios_dev_mmap));
+  if (!mio)
+    goto err;
+
+  mio->filename = strdup (handler);
+  if (!mio->filename)
+    goto err;
+
+  mio->fd = fd;
+  mio->flags = flags;
+  mio->addr = NULL;
+  mio->dirty_begin = 0;
+  mio->dirty_end = 0;
+  ios_dev_mmap_map (mio, st.st_size);
+
+  if (error)
+    *error = IOD_OK;
+  return mio;
+
+err:
+  if (mio)
+    free (mio->filename);
+  free (mio);
+
+  if (fd != -1)
+    close (fd);
+
+  if (error)
+    {
+      if (internal_error != IOD_ERROR)
+        *error = internal_error;
+      else if (errno == ENOMEM)
+        *error = IOD_ENOMEM;
+      else if (errno == EINVAL)
+        *error = IOD_EINVAL;
+      else
+        *error = IOD_ERROR;
+    }
+  return NULL;
+}
+
+static int
+ios_dev_mmap_close (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+  int ret = IOD_OK;
+
+  if (mio->addr)
+    {
+      if (ios_dev_mmap_sync (mio, mio->size) != IOD_OK)
+        ret = IOD_ERROR;
+      munmap (mio->addr, mio->size);
+    }
+
+  if (close (mio->fd) != 0)
+    {
+      perror (mio->filename);
+      ret = IOD_ERROR;
+    }
+
+  free (mio->filename);
+  free (mio);
+  return ret;
+}
+
+static uint64_t
+ios_dev_mmap_get_flags (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->flags;
+}
+
+static int
+ios_dev_mmap_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (offset > mio->size || count > mio->size - offset)
+    return IOD_EOF;
+
+  if (mio->addr)
+    {
+      memcpy (buf, mio->addr + offset, count);
+      return IOD_OK;
+    }
+
+  while (count > 0)
+    {
+      ssize_t ret = pread (mio->fd, buf, count, offset);
+
+      if (ret <= 0)
+        return IOD_EOF;
+      buf = (uint8_t *) buf + ret;
+      offset += ret;
+      count -= ret;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_mmap_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+  ios_dev_off end = offset + count;
+
+  if (!(mio->flags & IOS_F_WRITE))
+    return IOD_EOF;
+
+  if (mio->addr && end <= mio->size)
+    {
+      memcpy (mio->addr + offset, buf, count);
+
+      if (mio->dirty_begin >= mio->dirty_end)
+        {
+          mio->dirty_begin = offset;
+          mio->dirty_end = end;
+        }
+      else
+        {
+          if (offset < mio->dirty_begin)
+            mio->dirty_begin = offset;
+          if (end > mio->dirty_end)
+            mio->dirty_end = end;
+        }
+      return IOD_OK;
+    }
+
+  /* Either the file is not mapped, or the write extends it.  Write
+     to the file and remap it with the new size if needed.  */
+  while (count > 0)
+    {
+      ssize_t ret = pwrite (mio->fd, buf, count, offset);
+
+      if (ret <= 0)
+        return IOD_EOF;
+      buf = (const uint8_t *) buf + ret;
+      offset += ret;
+      count -= ret;
+    }
+
+  if (end > mio->size)
+    ios_dev_mmap_map (mio, end);
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_mmap_get_fd (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return (mio->flags & IOS_F_READ) ? mio->fd : -1;
+}
+
+static ios_dev_off
+ios_dev_mmap_size (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->size;
+}
+
+static int
+ios_dev_mmap_flush (void *iod, ios_dev_off offset)
+{
+  return ios_dev_mmap_sync (iod, offset);
+}
+
+static int
+ios_dev_mmap_advise (void *iod, ios_dev_off offset, ios_dev_off count,
+                     int advice)
+{
+#if HAVE_POSIX_MADVISE
+  struct ios_dev_mmap *mio = iod;
+  size_t pagesize = getpagesize ();
+  ios_dev_off begin;
+
+  if (mio->addr == NULL || offset >= mio->size)
+    return IOD_OK;
+
+  if (count == 0 || count > mio->size - offset)
+    count = mio->size - offset;
+
+  /* The address passed to posix_madvise shall be page-aligned.  */
+  begin = offset - offset % pagesize;
+  count += offset - begin;
+
+  switch (advice)
+    {
+    case IOD_ADVICE_NORMAL:
+      posix_madvise (mio->addr + begin, count, POSIX_MADV_NORMAL);
+      break;
+    case IOD_ADVICE_SEQUENTIAL:
+      posix_madvise (mio->addr + begin, count, POSIX_MADV_SEQUENTIAL);
+      break;
+    case IOD_ADVICE_WILLNEED:
+      posix_madvise (mio->addr + begin, count, POSIX_MADV_WILLNEED);
+      break;
+    default:
+      return IOD_EINVAL;
+    }
+#endif
+
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_mmap =
+  {
+   .get_if_name = ios_dev_mmap_get_if_name,
+   .handler_normalize = ios_dev_mmap_handler_normalize,
+   .open = ios_dev_mmap_open,
+   .close = ios_dev_mmap_close,
+   .pread = ios_dev_mmap_pread,
+   .pwrite = ios_dev_mmap_pwrite,
+   .get_flags = ios_dev_mmap_get_flags,
+   .size = ios_dev_mmap_size,
+   .flush = ios_dev_mmap_flush,
+   .advise = ios_dev_mmap_advise,
+   .get_fd = ios_dev_mmap_get_fd,
+  };
@@ -22,13 +22,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#if HAVE_IOS_ASYNC_READAHEAD
+# include <pthread.h>
+#endif
 
 #include <libnbd.h>
 
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with an NBD device.  */
+/* Reads and writes are sent to the server as asynchronous commands,
+   so that the ranges of a vectored or batched operation, and the
+   chunks of a big one, are all in flight at the same time instead of
+   paying a round trip each.  IOS_DEV_NBD_CHUNK is the maximum size of
+   a single command, well below the limit enforced by most servers,
+   and IOS_DEV_NBD_MAX_IN_FLIGHT is the maximum number of commands
+   waiting for a reply.  */
+
+#define IOS_DEV_NBD_CHUNK (1024 * 1024)
+#define IOS_DEV_NBD_MAX_IN_FLIGHT 16
+
+/* State associated with an NBD device.
+
+   NBD is the handle of the connection to the server.  It is closed
+   and set to NULL if the connection breaks while commands are in
+   flight, after which every access fails.
+
+   LOCK serializes the operations on the device.  The block cache may
+   read ahead from a helper thread, and the replies to the commands
+   issued by an operation shall be collected by the same thread that
+   issued them.  */
 
 struct ios_dev_nbd
 {
@@ -36,6 +60,18 @@ struct ios_dev_nbd
   char *uri;
   ios_dev_off size;
   uint64_t flags;
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_t lock;
+#endif
+};
+
+/* The commands in flight issued by an operation on an NBD device.
+   STATUS is the IOD_* code of the operation.  */
+
+struct ios_dev_nbd_cmds
+{
+  int in_flight;
+  int status;
 };
 
 static bool
@@ -122,6 +158,9 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error)
   nio->nbd = nbd;
   nio->size = size;
   nio->flags = flags;
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_init (&nio->lock, NULL);
+#endif
 
   if (error)
     *error = IOD_OK;
@@ -145,7 +184,11 @@ ios_dev_nbd_close (void *iod)
   struct ios_dev_nbd *nio = iod;
 
   /* Should this flush when possible?  */
-  nbd_close (nio->nbd);
+  if (nio->nbd)
+    nbd_close (nio->nbd);
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_destroy (&nio->lock);
+#endif
   free (nio->uri);
   free (nio);
 
@@ -160,12 +203,132 @@ ios_dev_nbd_get_flags (void *iod)
   return nio->flags;
 }
 
+static void
+ios_dev_nbd_lock (struct ios_dev_nbd *nio)
+{
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_lock (&nio->lock);
+#endif
+}
+
+static void
+ios_dev_nbd_unlock (struct ios_dev_nbd *nio)
+{
+#if HAVE_IOS_ASYNC_READAHEAD
+  pthread_mutex_unlock (&nio->lock);
+#endif
+}
+
+/* Completion callback of the commands issued by ios_dev_nbd_run.  */
+
+static int
+ios_dev_nbd_completed (void *user_data, int *error)
+{
+  struct ios_dev_nbd_cmds *cmds = user_data;
+
+  cmds->in_flight--;
+  if (*error)
+    cmds->status = IOD_EOF;
+
+  /* Retire the command.  */
+  return 1;
+}
+
+/* Read, or write if WRITE_P is set, the NREQS byte ranges described
+   by REQS, keeping up to IOS_DEV_NBD_MAX_IN_FLIGHT commands in flight.
+   Return IOD_OK if all the ranges were transferred, IOD_EOF
+   otherwise.  NIO shall be locked.  */
+
+static int
+ios_dev_nbd_run (struct ios_dev_nbd *nio,
+                 const struct ios_dev_read_req *reqs, int nreqs,
+                 int write_p)
+{
+  struct nbd_handle *nbd = nio->nbd;
+  struct ios_dev_nbd_cmds cmds = { 0, IOD_OK };
+  nbd_completion_callback completion = { .callback = ios_dev_nbd_completed,
+                                         .user_data = &cmds };
+  int i;
+
+  if (nbd == NULL)
+    return IOD_EOF;
+
+  for (i = 0; i < nreqs && cmds.status == IOD_OK; ++i)
+    {
+      uint8_t *buf = reqs[i].buf;
+      ios_dev_off offset = reqs[i].offset;
+      size_t count = reqs[i].count;
+
+      if (offset > nio->size || count > nio->size - offset)
+        {
+          cmds.status = IOD_EOF;
+          break;
+        }
+
+      while (count > 0 && cmds.status == IOD_OK)
+        {
+          size_t n = count > IOS_DEV_NBD_CHUNK ? IOS_DEV_NBD_CHUNK : count;
+          int64_t cookie;
+
+          while (cmds.in_flight >= IOS_DEV_NBD_MAX_IN_FLIGHT)
+            if (nbd_poll (nbd, -1) == -1)
+              goto dead;
+
+          /* The callback is not called if the command can't be
+             issued.  */
+          cmds.in_flight++;
+          cookie = (write_p
+                    ? nbd_aio_pwrite (nbd, buf, n, offset, completion, 0)
+                    : nbd_aio_pread (nbd, buf, n, offset, completion, 0));
+          if (cookie == -1)
+            {
+              cmds.in_flight--;
+              cmds.status = IOD_EOF;
+            }
+
+          buf += n;
+          offset += n;
+          count -= n;
+        }
+    }
+
+  /* The commands in flight refer to the buffers of the caller, so
+     wait for them even if something failed.  */
+  while (cmds.in_flight > 0)
+    if (nbd_poll (nbd, -1) == -1)
+      goto dead;
+
+  return cmds.status;
+
+ dead:
+  /* The commands in flight can't be waited for, but they refer to
+     CMDS and to the buffers of the caller.  Closing the handle
+     retires them, so they are forgotten before returning.  The
+     device can't be used anymore.  */
+  nbd_close (nbd);
+  nio->nbd = NULL;
+  return IOD_EOF;
+}
+
 static int
 ios_dev_nbd_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  int ret;
+
+  ios_dev_nbd_lock (nio);
+  if (nio->nbd == NULL)
+    ret = IOD_EOF;
+  else if (count <= IOS_DEV_NBD_CHUNK)
+    ret = nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  else
+    {
+      struct ios_dev_read_req req = { offset, buf, count };
+      ret = ios_dev_nbd_run (nio, &req, 1, 0);
+    }
+  ios_dev_nbd_unlock (nio);
 
-  return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  return ret;
 }
 
 static int
@@ -173,8 +336,77 @@ ios_dev_nbd_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  int ret;
+
+  ios_dev_nbd_lock (nio);
+  if (nio->nbd == NULL)
+    ret = IOD_EOF;
+  else if (count <= IOS_DEV_NBD_CHUNK)
+    ret = nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  else
+    {
+      /* The buffer is not modified.  */
+      struct ios_dev_read_req req = { offset, (void *) buf, count };
+      ret = ios_dev_nbd_run (nio, &req, 1, 1);
+    }
+  ios_dev_nbd_unlock (nio);
+
+  return ret;
+}
+
+/* Transfer the IOVCNT buffers described by IOV from or to the device
+   at the byte offset OFFSET, with one command per buffer.  */
+
+static int
+ios_dev_nbd_iov (struct ios_dev_nbd *nio, const struct iovec *iov,
+                 int iovcnt, ios_dev_off offset, int write_p)
+{
+  struct ios_dev_read_req reqs[IOD_IOV_MAX];
+  int i, ret;
+
+  if (iovcnt > IOD_IOV_MAX)
+    return IOD_EINVAL;
+
+  for (i = 0; i < iovcnt; offset += iov[i].iov_len, ++i)
+    {
+      reqs[i].offset = offset;
+      reqs[i].buf = iov[i].iov_base;
+      reqs[i].count = iov[i].iov_len;
+    }
+
+  ios_dev_nbd_lock (nio);
+  ret = ios_dev_nbd_run (nio, reqs, iovcnt, write_p);
+  ios_dev_nbd_unlock (nio);
+
+  return ret;
+}
+
+static int
+ios_dev_nbd_preadv (void *iod, const struct iovec *iov, int iovcnt,
+                    ios_dev_off offset)
+{
+  return ios_dev_nbd_iov (iod, iov, iovcnt, offset, 0);
+}
+
+static int
+ios_dev_nbd_pwritev (void *iod, const struct iovec *iov, int iovcnt,
+                     ios_dev_off offset)
+{
+  return ios_dev_nbd_iov (iod, iov, iovcnt, offset, 1);
+}
+
+static int
+ios_dev_nbd_pread_batch (void *iod, const struct ios_dev_read_req *reqs,
+                         int nreqs)
+{
+  struct ios_dev_nbd *nio = iod;
+  int ret;
+
+  ios_dev_nbd_lock (nio);
+  ret = ios_dev_nbd_run (nio, reqs, nreqs, 0);
+  ios_dev_nbd_unlock (nio);
 
-  return nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  return ret;
 }
 
 static ios_dev_off
@@ -199,7 +431,12 @@ struct ios_dev_if ios_dev_nbd =
    .close = ios_dev_nbd_close,
    .pread = ios_dev_nbd_pread,
    .pwrite = ios_dev_nbd_pwrite,
+   .preadv = ios_dev_nbd_preadv,
+   .pwritev = ios_dev_nbd_pwritev,
+   .pread_batch = ios_dev_nbd_pread_batch,
    .get_flags = ios_dev_nbd_get_flags,
    .size = ios_dev_nbd_size,
    .flush = ios_dev_nbd_flush,
+   .cacheable_p = 1,
+   .thread_safe_p = 1,
   };
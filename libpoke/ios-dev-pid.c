@@ -0,0 +1,477 @@
+/* ios-dev-pid.c - Process memory IO devices.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This IO device operates on the address space of a live process.
+   Its handlers have the form pid://N, N being the process id.
+
+   Offsets in the device are virtual addresses in the process.  The
+   memory is accessed using process_vm_readv and process_vm_writev,
+   which require the same permissions than attaching to the process
+   with ptrace.  The mappings of the process are read from
+   /proc/N/maps, so accesses to unmapped addresses fail without
+   issuing system calls.
+
+   The memory of the process may change at any time, so the cache of
+   the IO space is disabled unless a size is set for it.  When it is
+   enabled, the blocks loaded in advance are read with a single
+   system call.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define IOS_PID_HANDLER_PREFIX "pid://"
+
+/* Maximum number of buffers passed to process_vm_readv in a single
+   call.  This is the limit imposed by the kernel.  */
+
+#define IOS_DEV_PID_IOV_MAX 1024
+
+/* Minimum number of nanoseconds between two reads of the mappings of
+   a process caused by accesses to unmapped addresses.  Reading them
+   is much more expensive than a system call, so this keeps accesses
+   to holes fast even if they are repeated.  */
+
+#define IOS_DEV_PID_MAPS_TTL 50000000
+
+/* A range of mapped addresses, from BEGIN up to END, excluded.  */
+
+struct ios_dev_pid_map
+{
+  ios_dev_off begin;
+  ios_dev_off end;
+};
+
+/* State associated with a process device.
+
+   MAPS is an array of NUM_MAPS mapped ranges of addresses, sorted
+   and with the adjacent ranges merged.  It is read from /proc when
+   the device is opened, and read again when an access falls in a
+   hole, since the process may have mapped more memory since, unless
+   it was read less than IOS_DEV_PID_MAPS_TTL nanoseconds ago.
+   MAPS_TIME is the time at which it was read.  */
+
+struct ios_dev_pid
+{
+  pid_t pid;
+  uint64_t flags;
+  struct ios_dev_pid_map *maps;
+  size_t num_maps;
+  struct timespec maps_time;
+};
+
+static char *
+ios_dev_pid_get_if_name () {
+  return "PID";
+}
+
+static char *
+ios_dev_pid_handler_normalize (const char *handler, uint64_t flags,
+                               int *error)
+{
+  size_t prefix_len = strlen (IOS_PID_HANDLER_PREFIX);
+  char *new_handler = NULL;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (strncmp (handler, IOS_PID_HANDLER_PREFIX, prefix_len) == 0
+      && handler[prefix_len] != '\0'
+      && (strspn (handler + prefix_len, "0123456789")
+          == strlen (handler + prefix_len)))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+/* Read the mappings of the process in PIO from /proc.  Return IOD_OK
+   on success and an error code on failure, in which case the
+   previous mappings are kept.  */
+
+static int
+ios_dev_pid_read_maps (struct ios_dev_pid *pio)
+{
+  struct ios_dev_pid_map *maps = NULL;
+  size_t num_maps = 0, size = 0;
+  char path[64], line[512];
+  FILE *f;
+
+  sprintf (path, "/proc/%ld/maps", (long) pio->pid);
+  f = fopen (path, "r");
+  if (!f)
+    return IOD_ERROR;
+
+  while (fgets (line, sizeof (line), f))
+    {
+      unsigned long long begin, end;
+      size_t len = strlen (line);
+
+      /* Skip the rest of overlong lines.  */
+      if (len > 0 && line[len - 1] != '\n')
+        {
+          int c;
+
+          while ((c = getc (f)) != EOF && c != '\n')
+            ;
+        }
+
+      if (sscanf (line, "%llx-%llx", &begin, &end) != 2
+          || begin >= end)
+        continue;
+
+      /* Offsets in bits shall fit in 64 bits, which leaves out
+         mappings at the top of the address space, like the vsyscall
+         page in x86_64.  */
+      if (end > UINT64_MAX / 8)
+        continue;
+
+      if (num_maps > 0 && maps[num_maps - 1].end == begin)
+        {
+          maps[num_maps - 1].end = end;
+          continue;
+        }
+
+      if (num_maps == size)
+        {
+          struct ios_dev_pid_map *m;
+
+          size = size ? size * 2 : 64;
+          m = realloc (maps, size * sizeof (struct ios_dev_pid_map));
+          if (!m)
+            {
+              free (maps);
+              fclose (f);
+              return IOD_ENOMEM;
+            }
+          maps = m;
+        }
+
+      maps[num_maps].begin = begin;
+      maps[num_maps].end = end;
+      num_maps++;
+    }
+
+  fclose (f);
+
+  clock_gettime (CLOCK_MONOTONIC, &pio->maps_time);
+  free (pio->maps);
+  pio->maps = maps;
+  pio->num_maps = num_maps;
+  return IOD_OK;
+}
+
+/* Return 1 if the COUNT bytes at OFFSET are mapped in the process
+   according to the mappings in PIO, 0 otherwise.  */
+
+static int
+ios_dev_pid_mapped_p_1 (struct ios_dev_pid *pio, size_t count,
+                        ios_dev_off offset)
+{
+  size_t lo = 0, hi = pio->num_maps;
+
+  if (count == 0)
+    return 1;
+
+  /* Find the mapping containing OFFSET, which is the last one
+     starting at or before it.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (pio->maps[mid].begin <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Adjacent mappings are merged, so the range shall be contained in
+     a single one.  */
+  return (lo > 0
+          && offset < pio->maps[lo - 1].end
+          && count <= pio->maps[lo - 1].end - offset);
+}
+
+/* Likewise, but read the mappings again if the range is not mapped
+   according to the current ones and they are not too recent.  */
+
+static int
+ios_dev_pid_mapped_p (struct ios_dev_pid *pio, size_t count,
+                      ios_dev_off offset)
+{
+  struct timespec now;
+
+  if (ios_dev_pid_mapped_p_1 (pio, count, offset))
+    return 1;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  if ((now.tv_sec - pio->maps_time.tv_sec) * 1000000000LL
+      + (now.tv_nsec - pio->maps_time.tv_nsec) < IOS_DEV_PID_MAPS_TTL)
+    return 0;
+
+  return (ios_dev_pid_read_maps (pio) == IOD_OK
+          && ios_dev_pid_mapped_p_1 (pio, count, offset));
+}
+
+static void *
+ios_dev_pid_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_pid *pio = NULL;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  int internal_error = IOD_ERROR;
+  long pid;
+
+  if (flags_mode & (IOS_F_CREATE | IOS_F_TRUNCATE))
+    {
+      internal_error = IOD_EFLAGS;
+      goto err;
+    }
+
+  pid = strtol (handler + strlen (IOS_PID_HANDLER_PREFIX), NULL, 10);
+  if (pid <= 0 || pid != (pid_t) pid)
+    {
+      internal_error = IOD_EINVAL;
+      goto err;
+    }
+
+  pio = malloc (sizeof (struct ios_dev_pid));
+  if (!pio)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  pio->pid = pid;
+  pio->flags = flags_mode ? flags : flags | IOS_F_READ | IOS_F_WRITE;
+  pio->maps = NULL;
+  pio->num_maps = 0;
+
+  /* This fails if the process doesn't exist.  */
+  if ((internal_error = ios_dev_pid_read_maps (pio)) != IOD_OK)
+    goto err;
+
+  if (error)
+    *error = IOD_OK;
+  return pio;
+
+ err:
+  free (pio);
+  if (error)
+    *error = internal_error;
+  return NULL;
+}
+
+static int
+ios_dev_pid_close (void *iod)
+{
+  struct ios_dev_pid *pio = iod;
+
+  free (pio->maps);
+  free (pio);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_pid_get_flags (void *iod)
+{
+  struct ios_dev_pid *pio = iod;
+
+  return pio->flags;
+}
+
+static ios_dev_off
+ios_dev_pid_size (void *iod)
+{
+  struct ios_dev_pid *pio = iod;
+
+  /* The address space extends up to the end of the last mapping.  */
+  return pio->num_maps ? pio->maps[pio->num_maps - 1].end : 0;
+}
+
+/* Transfer the COUNT bytes at OFFSET in the process in PIO from or to
+   the IOVCNT buffers in IOV, depending on WRITE_P.  The range shall
+   be mapped.  Return IOD_OK on success and IOD_EOF on failure.  */
+
+static int
+ios_dev_pid_rw (struct ios_dev_pid *pio, const struct iovec *iov, int iovcnt,
+                size_t count, ios_dev_off offset, int write_p)
+{
+  struct iovec remote;
+  ssize_t ret;
+
+  remote.iov_base = (void *) (uintptr_t) offset;
+  remote.iov_len = count;
+
+  do
+    ret = (write_p
+           ? process_vm_writev (pio->pid, iov, iovcnt, &remote, 1, 0)
+           : process_vm_readv (pio->pid, iov, iovcnt, &remote, 1, 0));
+  while (ret == -1 && errno == EINTR);
+
+  /* Transfers within a single remote buffer are never partial unless
+     some page can't be accessed.  */
+  return ret == (ssize_t) count ? IOD_OK : IOD_EOF;
+}
+
+static int
+ios_dev_pid_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_pid *pio = iod;
+  struct iovec local;
+
+  if (!ios_dev_pid_mapped_p (pio, count, offset))
+    return IOD_EOF;
+
+  local.iov_base = buf;
+  local.iov_len = count;
+  return ios_dev_pid_rw (pio, &local, 1, count, offset, 0);
+}
+
+static int
+ios_dev_pid_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_pid *pio = iod;
+  struct iovec local;
+
+  if (!(pio->flags & IOS_F_WRITE)
+      || !ios_dev_pid_mapped_p (pio, count, offset))
+    return IOD_EOF;
+
+  local.iov_base = (void *) buf;
+  local.iov_len = count;
+  return ios_dev_pid_rw (pio, &local, 1, count, offset, 1);
+}
+
+/* Return the number of bytes in the IOVCNT buffers in IOV.  */
+
+static size_t
+ios_dev_pid_iov_count (const struct iovec *iov, int iovcnt)
+{
+  size_t count = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; ++i)
+    count += iov[i].iov_len;
+  return count;
+}
+
+static int
+ios_dev_pid_preadv (void *iod, const struct iovec *iov, int iovcnt,
+                    ios_dev_off offset)
+{
+  struct ios_dev_pid *pio = iod;
+  size_t count = ios_dev_pid_iov_count (iov, iovcnt);
+
+  if (!ios_dev_pid_mapped_p (pio, count, offset))
+    return IOD_EOF;
+
+  return ios_dev_pid_rw (pio, iov, iovcnt, count, offset, 0);
+}
+
+static int
+ios_dev_pid_pwritev (void *iod, const struct iovec *iov, int iovcnt,
+                     ios_dev_off offset)
+{
+  struct ios_dev_pid *pio = iod;
+  size_t count = ios_dev_pid_iov_count (iov, iovcnt);
+
+  if (!(pio->flags & IOS_F_WRITE)
+      || !ios_dev_pid_mapped_p (pio, count, offset))
+    return IOD_EOF;
+
+  return ios_dev_pid_rw (pio, iov, iovcnt, count, offset, 1);
+}
+
+static int
+ios_dev_pid_pread_batch (void *iod, const struct ios_dev_read_req *reqs,
+                         int nreqs)
+{
+  struct ios_dev_pid *pio = iod;
+  struct iovec local[IOS_DEV_PID_IOV_MAX];
+  struct iovec remote[IOS_DEV_PID_IOV_MAX];
+  int i, n;
+
+  for (i = 0; i < nreqs; ++i)
+    if (!ios_dev_pid_mapped_p (pio, reqs[i].count, reqs[i].offset))
+      return IOD_EOF;
+
+  /* Read the scattered ranges with as few system calls as
+     possible.  */
+  for (i = 0; i < nreqs; i += n)
+    {
+      size_t count = 0;
+      ssize_t ret;
+      int j;
+
+      n = (nreqs - i < IOS_DEV_PID_IOV_MAX
+           ? nreqs - i : IOS_DEV_PID_IOV_MAX);
+      for (j = 0; j < n; ++j)
+        {
+          local[j].iov_base = reqs[i + j].buf;
+          local[j].iov_len = reqs[i + j].count;
+          remote[j].iov_base = (void *) (uintptr_t) reqs[i + j].offset;
+          remote[j].iov_len = reqs[i + j].count;
+          count += reqs[i + j].count;
+        }
+
+      do
+        ret = process_vm_readv (pio->pid, local, n, remote, n, 0);
+      while (ret == -1 && errno == EINTR);
+
+      if (ret != (ssize_t) count)
+        return IOD_EOF;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_pid_flush (void *iod, ios_dev_off offset)
+{
+  return IOS_OK;
+}
+
+struct ios_dev_if ios_dev_pid =
+  {
+   .get_if_name = ios_dev_pid_get_if_name,
+   .handler_normalize = ios_dev_pid_handler_normalize,
+   .open = ios_dev_pid_open,
+   .close = ios_dev_pid_close,
+   .pread = ios_dev_pid_pread,
+   .pwrite = ios_dev_pid_pwrite,
+   .preadv = ios_dev_pid_preadv,
+   .pwritev = ios_dev_pid_pwritev,
+   .pread_batch = ios_dev_pid_pread_batch,
+   .get_flags = ios_dev_pid_get_flags,
+   .size = ios_dev_pid_size,
+   .flush = ios_dev_pid_flush,
+   .cacheable_p = 1,
+   .volatile_p = 1,
+  };
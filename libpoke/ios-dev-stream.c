@@ -172,7 +172,23 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
     return ios_buffer_pread (buffer, buf, count, offset);
 
   /* What was last read into the buffer may be before or after the
-     offset that this function is provided with.  */
+     offset that this function is provided with.  If it is before,
+     read the bytes in between into the buffer first.  */
+  while (ios_buffer_get_end_offset (buffer) < offset)
+    {
+      uint8_t gap[4096];
+      ios_dev_off end = ios_buffer_get_end_offset (buffer);
+      size_t gap_count = (offset - end > sizeof (gap)
+                          ? sizeof (gap) : offset - end);
+
+      read_count = fread (gap, 1, gap_count, sio->file);
+      if (read_count > 0
+          && ios_buffer_pwrite (buffer, gap, read_count, end) != IOD_OK)
+        return IOD_ERROR;
+      if (read_count < gap_count)
+        return IOD_EOF;
+    }
+
   if (ios_buffer_get_end_offset (buffer) > offset)
     {
       /* Read from the buffer what's already avaılable.  */
@@ -188,22 +204,21 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   do
     {
       read_count = fread (buf + total_read_count,
-                          count - total_read_count,
                           1,
+                          count - total_read_count,
                           sio->file);
       total_read_count += read_count;
     }
   while (total_read_count < count && read_count);
 
-  /* Write back to the buffer.  */
+  /* Write back to the buffer what was actually read.  */
   if (ios_buffer_pwrite (buffer,
                          buf + read_from_buffer_count,
-                         count - read_from_buffer_count,
-                         ios_buffer_get_end_offset (buffer))
-      || total_read_count < count)
+                         total_read_count - read_from_buffer_count,
+                         ios_buffer_get_end_offset (buffer)))
     return IOD_ERROR;
 
-  return IOD_OK;
+  return total_read_count < count ? IOD_EOF : IOD_OK;
 }
 
 static int
@@ -253,6 +268,14 @@ ios_dev_stream_flush (void *iod, ios_dev_off offset)
     return IOS_OK;
 }
 
+static int
+ios_dev_stream_blocking_p (void *iod)
+{
+  struct ios_dev_stream *sio = iod;
+
+  return (sio->flags & IOS_F_READ) != 0;
+}
+
 struct ios_dev_if ios_dev_stream =
   {
    .get_if_name = ios_dev_stream_get_dev_if_name,
@@ -263,5 +286,6 @@ struct ios_dev_if ios_dev_stream =
    .pwrite = ios_dev_stream_pwrite,
    .get_flags = ios_dev_stream_get_flags,
    .size = ios_dev_stream_size,
-   .flush = ios_dev_stream_flush
+   .flush = ios_dev_stream_flush,
+   .blocking_p = ios_dev_stream_blocking_p,
   };
@@ -0,0 +1,304 @@
+/* ios-dev-win.c - Window IO devices.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This IO device exposes a range of bytes of some other IO space,
+   the "parent" space, as a space on its own.  Its handlers have the
+   forms:
+
+     ios:N[BEGIN,END]
+     ios:N[BEGIN,+SIZE]
+
+   where N is the id of the parent space, and BEGIN, END and SIZE are
+   byte offsets or counts, in C notation.  The window starts at BEGIN
+   and extends up to END, excluded, or during SIZE bytes.
+
+   Nothing is copied: reads and writes are translated and forwarded
+   to the parent space, and they are served by its cache if it has
+   one.  Accesses beyond the end of the window fail like accesses
+   beyond the end of any other space do.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define IOS_WIN_HANDLER_PREFIX "ios:"
+
+/* State associated with a window device.
+
+   The parent space is looked up by PARENT_ID every time it is
+   accessed, so the device notices if it gets closed.  */
+
+struct ios_dev_win
+{
+  int parent_id;
+  ios_dev_off begin;
+  ios_dev_off size;
+  uint64_t flags;
+};
+
+/* Parse a window handler, storing its components in *PARENT_ID,
+   *BEGIN and *SIZE.  Return 1 if HANDLER is a valid window handler,
+   0 otherwise.  */
+
+static int
+ios_dev_win_parse_handler (const char *handler, int *parent_id,
+                           ios_dev_off *begin, ios_dev_off *size)
+{
+  size_t prefix_len = strlen (IOS_WIN_HANDLER_PREFIX);
+  unsigned long long n, b, e;
+  const char *p;
+  char *end;
+  int size_p;
+
+  if (strncmp (handler, IOS_WIN_HANDLER_PREFIX, prefix_len) != 0)
+    return 0;
+
+  p = handler + prefix_len;
+  if (*p < '0' || *p > '9')
+    return 0;
+  n = strtoull (p, &end, 10);
+  if (n > INT_MAX || *end != '[')
+    return 0;
+
+  p = end + 1;
+  if (*p < '0' || *p > '9')
+    return 0;
+  b = strtoull (p, &end, 0);
+  if (*end != ',')
+    return 0;
+
+  p = end + 1;
+  size_p = (*p == '+');
+  if (size_p)
+    p++;
+  if (*p < '0' || *p > '9')
+    return 0;
+  e = strtoull (p, &end, 0);
+  if (end[0] != ']' || end[1] != '\0')
+    return 0;
+
+  if (size_p)
+    {
+      if (e > UINT64_MAX - b)
+        return 0;
+    }
+  else
+    {
+      if (e < b)
+        return 0;
+      e -= b;
+    }
+
+  *parent_id = n;
+  *begin = b;
+  *size = e;
+  return 1;
+}
+
+static char *
+ios_dev_win_get_if_name () {
+  return "WINDOW";
+}
+
+static char *
+ios_dev_win_handler_normalize (const char *handler, uint64_t flags,
+                               int *error)
+{
+  char *new_handler = NULL;
+  ios_dev_off begin, size;
+  int parent_id;
+
+  if (error)
+    *error = IOD_OK;
+
+  if (ios_dev_win_parse_handler (handler, &parent_id, &begin, &size))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  return new_handler;
+}
+
+static void *
+ios_dev_win_open (const char *handler, uint64_t flags, int *error)
+{
+  struct ios_dev_win *wio = NULL;
+  uint8_t flags_mode = flags & IOS_FLAGS_MODE;
+  uint64_t parent_mode;
+  int internal_error = IOD_ERROR;
+  ios parent;
+
+  wio = malloc (sizeof (struct ios_dev_win));
+  if (!wio)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  if (!ios_dev_win_parse_handler (handler, &wio->parent_id,
+                                  &wio->begin, &wio->size))
+    {
+      internal_error = IOD_EINVAL;
+      goto err;
+    }
+
+  parent = ios_search_by_id (wio->parent_id);
+  if (parent == NULL)
+    {
+      internal_error = IOD_EINVAL;
+      goto err;
+    }
+
+  /* A window can't be created nor truncated, and it can only be
+     written to if its parent can.  */
+  parent_mode = ios_flags (parent) & (IOS_F_READ | IOS_F_WRITE);
+  if (flags_mode & (IOS_F_CREATE | IOS_F_TRUNCATE)
+      || (flags_mode & ~parent_mode) != 0)
+    {
+      internal_error = IOD_EFLAGS;
+      goto err;
+    }
+
+  wio->flags = flags_mode ? flags : flags | parent_mode;
+
+  if (error)
+    *error = IOD_OK;
+  return wio;
+
+ err:
+  free (wio);
+  if (error)
+    *error = internal_error;
+  return NULL;
+}
+
+static int
+ios_dev_win_close (void *iod)
+{
+  free (iod);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_win_get_flags (void *iod)
+{
+  struct ios_dev_win *wio = iod;
+
+  return wio->flags;
+}
+
+/* Return the parent space of WIO, or NULL if it has been closed.  */
+
+static ios
+ios_dev_win_parent (struct ios_dev_win *wio)
+{
+  return ios_search_by_id (wio->parent_id);
+}
+
+static ios_dev_off
+ios_dev_win_size (void *iod)
+{
+  struct ios_dev_win *wio = iod;
+  ios parent = ios_dev_win_parent (wio);
+  ios_dev_off parent_size;
+
+  if (!parent)
+    return 0;
+
+  /* The parent may be smaller than the window.  */
+  parent_size = ios_size (parent) / 8;
+  if (parent_size <= wio->begin)
+    return 0;
+  return (parent_size - wio->begin < wio->size
+          ? parent_size - wio->begin : wio->size);
+}
+
+static int
+ios_dev_win_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_win *wio = iod;
+  ios parent = ios_dev_win_parent (wio);
+
+  if (!parent
+      || offset > wio->size || count > wio->size - offset)
+    return IOD_EOF;
+
+  return ios_read_raw (parent, buf, count, wio->begin + offset);
+}
+
+static int
+ios_dev_win_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_win *wio = iod;
+  ios parent = ios_dev_win_parent (wio);
+
+  if (!(wio->flags & IOS_F_WRITE))
+    return IOD_EOF;
+
+  /* Unlike other spaces, windows never grow.  */
+  if (!parent
+      || offset > wio->size || count > wio->size - offset)
+    return IOD_EOF;
+
+  return ios_write_raw (parent, buf, count, wio->begin + offset);
+}
+
+static int
+ios_dev_win_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_win *wio = iod;
+  ios parent = ios_dev_win_parent (wio);
+
+  if (!parent)
+    return IOD_OK;
+
+  /* Flush the parent up to the corresponding offset, without going
+     beyond the end of the window.  */
+  if (offset > wio->size)
+    offset = wio->size;
+  return ios_flush (parent, (wio->begin + offset) * 8);
+}
+
+static int
+ios_dev_win_blocking_p (void *iod)
+{
+  ios parent = ios_dev_win_parent (iod);
+
+  return parent && ios_blocking_p (parent);
+}
+
+struct ios_dev_if ios_dev_win =
+  {
+   .get_if_name = ios_dev_win_get_if_name,
+   .handler_normalize = ios_dev_win_handler_normalize,
+   .open = ios_dev_win_open,
+   .close = ios_dev_win_close,
+   .pread = ios_dev_win_pread,
+   .pwrite = ios_dev_win_pwrite,
+   .get_flags = ios_dev_win_get_flags,
+   .size = ios_dev_win_size,
+   .flush = ios_dev_win_flush,
+   .blocking_p = ios_dev_win_blocking_p,
+  };
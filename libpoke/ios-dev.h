@@ -43,6 +43,31 @@ typedef uint64_t ios_dev_off;
 #define IOD_EOF    -5 /* End of file / input.  */
 #define IOD_EINVAL -6 /* Invalid argument.  */
 
+/* Maximum number of buffers accepted by the preadv and pwritev
+   functions in the interface below.  */
+
+#define IOD_IOV_MAX 16
+
+/* Hints about the way a device will be accessed, to be used in the
+   advise function in the interface below.  These have the same
+   values than the corresponding IOS_ADVICE_* hints.  */
+
+#define IOD_ADVICE_NORMAL     0 /* No particular pattern.  */
+#define IOD_ADVICE_SEQUENTIAL 1 /* Accessed from lower to higher offsets.  */
+#define IOD_ADVICE_WILLNEED   2 /* Accessed in the near future.  */
+
+struct iovec;
+
+/* A range of bytes to read from a device, to be used in the
+   pread_batch function in the interface below.  */
+
+struct ios_dev_read_req
+{
+  ios_dev_off offset;
+  void *buf;
+  size_t count;
+};
+
 /* Each IO backend should implement a device interface, by filling an
    instance of the struct defined below.  */
 
@@ -81,6 +106,50 @@ struct ios_dev_if
 
   int (*pwrite) (void *dev, const void *buf, size_t count, ios_dev_off offset);
 
+  /* Read from the given device at the given byte offset into the
+     IOVCNT buffers described by IOV, which shall be at most
+     IOD_IOV_MAX, filling each buffer before proceeding to the next.
+     Return 0 on success, or IOD_EOF on error, including on short
+     reads.  This is optional and can be NULL.  */
+
+  int (*preadv) (void *dev, const struct iovec *iov, int iovcnt,
+                 ios_dev_off offset);
+
+  /* Write the IOVCNT buffers described by IOV to the given device at
+     the given byte offset.  Return 0 on success, or IOD_EOF on error,
+     including short writes.  This is optional and can be NULL.  */
+
+  int (*pwritev) (void *dev, const struct iovec *iov, int iovcnt,
+                  ios_dev_off offset);
+
+  /* Read the NREQS byte ranges described by REQS, which may be
+     scattered over the device.  Devices with a high latency can have
+     all the reads in flight at the same time.  Return 0 on success,
+     or IOD_EOF if any of the reads fails.  This is optional and can
+     be NULL.  */
+
+  int (*pread_batch) (void *dev, const struct ios_dev_read_req *reqs,
+                      int nreqs);
+
+  /* Start reading COUNT bytes from the given device at the given
+     byte offset into BUF, without waiting for the read to complete.
+     Only one such read can be in progress at a time, and BUF shall
+     not be accessed until pread_finish reports its completion.
+     Return 0 if the read was started, or an error code otherwise, in
+     which case the caller shall read using other means.  This is
+     optional and can be NULL.  */
+
+  int (*pread_start) (void *dev, void *buf, size_t count,
+                      ios_dev_off offset);
+
+  /* Check whether the read started by pread_start has completed,
+     waiting for it if WAIT_P is set, and set *DONE_P accordingly.  If
+     it has completed, return 0 on success or IOD_EOF on error,
+     including on short reads.  This is optional, and shall be
+     provided if pread_start is.  */
+
+  int (*pread_finish) (void *dev, int wait_p, int *done_p);
+
   /* Return the flags of the device, as it was opened.  */
 
   uint64_t (*get_flags) (void *dev);
@@ -94,6 +163,77 @@ struct ios_dev_if
      OFFSET.  Otherwise, do not do anything.  Return IOS_OK ın success and
      an error code on failure.  */
   int (*flush) (void *dev, ios_dev_off offset);
+
+  /* Return non-zero if reading beyond the data available so far in
+     the device may block waiting for more input, like it happens in
+     streams.  Such devices shall not be read further than needed.
+     This is optional and can be NULL, meaning the device never
+     blocks.  */
+
+  int (*blocking_p) (void *dev);
+
+  /* Advise the device that the COUNT bytes starting at the given byte
+     offset will be accessed as described by ADVICE, which is one of
+     the IOD_ADVICE_* values.  A COUNT of zero means up to the end of
+     the device.  Devices are free to ignore the advice.  Return
+     IOD_OK on success and an error code on failure.  This is optional
+     and can be NULL.  */
+
+  int (*advise) (void *dev, ios_dev_off offset, ios_dev_off count,
+                 int advice);
+
+  /* Write the changes that the device keeps on top of the IO space
+     it operates on to that space, and forget them.  Return IOD_OK on
+     success and an error code on failure.  This is optional and can
+     be NULL.  */
+
+  int (*commit) (void *dev);
+
+  /* Call WRITE for each range of bytes changed by the device on top
+     of the IO space it operates on, in ascending order of offset,
+     passing DATA along with the bytes, their count and their byte
+     offset.  Stop at the first error and return it.  This is
+     optional and can be NULL.  */
+
+  int (*export_changes) (void *dev,
+                         int (*write) (void *data, const void *buf,
+                                       size_t count, ios_dev_off offset),
+                         void *data);
+
+  /* Return a file descriptor open for reading the file operated by
+     the device, or -1 if the device doesn't operate on a file.  The
+     descriptor is owned by the device.  This is optional and can be
+     NULL.  */
+
+  int (*get_fd) (void *dev);
+
+  /* Copy COUNT bytes starting at the byte offset FROM of the file
+     open in FD, as returned by get_fd, to the byte offset TO of the
+     device.  The ranges shall not overlap if FD refers to the file
+     operated by the device.  Return IOD_OK on success, IOD_EOF if
+     the source range is not within the file, IOD_EINVAL if nothing
+     was copied because the device can't copy from FD, and an error
+     code otherwise.  This is optional and can be NULL.  */
+
+  int (*copy) (void *dev, ios_dev_off to, int fd, ios_dev_off from,
+               ios_dev_off count);
+
+  /* If not zero, the IO spaces operating devices of this kind keep a
+     block cache in front of the device.  Devices that are cheap to
+     access, like memory buffers, or that are not random-access, like
+     streams, shall leave this unset.  */
+  int cacheable_p;
+
+  /* If not zero, the contents of the device may change behind the
+     back of poke, like the memory of a running process does.  The
+     cache of such devices is disabled until a size is set for it
+     with ios_set_cache_size.  */
+  int volatile_p;
+
+  /* If not zero, pread can be called from a helper thread while other
+     operations are performed on the device.  This allows the block
+     cache to read ahead asynchronously.  */
+  int thread_safe_p;
 };
 
 #define IOS_FILE_HANDLER_NORMALIZE(handler, new_handler)                \
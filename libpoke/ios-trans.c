@@ -0,0 +1,325 @@
+/* ios-trans.c - Transaction overlays for IO spaces.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-trans.h"
+
+/* An extent of bytes written during a transaction.
+
+   OFFSET is the byte offset of the first byte of the extent, and
+   SIZE the number of bytes in it.  BYTES is a buffer of CAPACITY
+   bytes holding the contents of the extent.  The buffer is grown
+   geometrically, since extents are usually built by many small
+   consecutive writes.
+
+   NEXT is the next extent in ascending order of offset.  There is
+   always a gap between an extent and the next one.  */
+
+struct ios_trans_extent
+{
+  ios_dev_off offset;
+  size_t size;
+  size_t capacity;
+  uint8_t *bytes;
+  struct ios_trans_extent *next;
+};
+
+/* EXTENTS is the sorted list of extents in the overlay.  */
+
+struct ios_trans
+{
+  struct ios_trans_extent *extents;
+};
+
+#define IOS_TRANS_EXTENT_END(extent) \
+  ((extent)->offset + (extent)->size)
+
+struct ios_trans *
+ios_trans_new (void)
+{
+  struct ios_trans *trans = malloc (sizeof (struct ios_trans));
+
+  if (trans)
+    trans->extents = NULL;
+  return trans;
+}
+
+static void
+ios_trans_extent_free (struct ios_trans_extent *extent)
+{
+  free (extent->bytes);
+  free (extent);
+}
+
+void
+ios_trans_free (struct ios_trans *trans)
+{
+  struct ios_trans_extent *extent, *next;
+
+  for (extent = trans->extents; extent; extent = next)
+    {
+      next = extent->next;
+      ios_trans_extent_free (extent);
+    }
+
+  free (trans);
+}
+
+/* Make sure EXTENT can hold SIZE bytes.  Return IOD_OK or
+   IOD_ENOMEM.  */
+
+static int
+ios_trans_extent_reserve (struct ios_trans_extent *extent, size_t size)
+{
+  size_t capacity;
+  uint8_t *bytes;
+
+  if (size <= extent->capacity)
+    return IOD_OK;
+
+  capacity = extent->capacity * 2;
+  if (capacity < size)
+    capacity = size;
+
+  bytes = realloc (extent->bytes, capacity);
+  if (!bytes)
+    return IOD_ENOMEM;
+
+  extent->bytes = bytes;
+  extent->capacity = capacity;
+  return IOD_OK;
+}
+
+int
+ios_trans_pwrite (struct ios_trans *trans, const void *buf,
+                  size_t count, ios_dev_off offset)
+{
+  struct ios_trans_extent **prev, *extent, *next;
+  ios_dev_off end = offset + count;
+
+  if (count == 0)
+    return IOD_OK;
+
+  /* Look for the first extent that either overlaps with the written
+     range or is adjacent to it.  */
+  for (prev = &trans->extents;
+       *prev && IOS_TRANS_EXTENT_END (*prev) < offset;
+       prev = &(*prev)->next)
+    ;
+  extent = *prev;
+
+  if (extent == NULL || extent->offset > end)
+    {
+      /* The written range is disjoint: create a new extent for it.  */
+      extent = malloc (sizeof (struct ios_trans_extent));
+      if (!extent)
+        return IOD_ENOMEM;
+
+      extent->bytes = malloc (count);
+      if (!extent->bytes)
+        {
+          free (extent);
+          return IOD_ENOMEM;
+        }
+
+      memcpy (extent->bytes, buf, count);
+      extent->offset = offset;
+      extent->size = extent->capacity = count;
+      extent->next = *prev;
+      *prev = extent;
+      return IOD_OK;
+    }
+
+  /* If the written range starts before the extent, move the contents
+     of the extent so it starts at OFFSET.  */
+  if (offset < extent->offset)
+    {
+      size_t shift = extent->offset - offset;
+      size_t size = extent->size + shift;
+      uint8_t *bytes = malloc (size);
+
+      if (!bytes)
+        return IOD_ENOMEM;
+
+      memcpy (bytes + shift, extent->bytes, extent->size);
+      free (extent->bytes);
+      extent->bytes = bytes;
+      extent->offset = offset;
+      extent->size = extent->capacity = size;
+    }
+
+  /* Absorb the extents that overlap with or are adjacent to the end
+     of the written range.  */
+  for (next = extent->next; next && next->offset <= end; next = extent->next)
+    {
+      size_t size = IOS_TRANS_EXTENT_END (next) - extent->offset;
+
+      if (ios_trans_extent_reserve (extent, size) != IOD_OK)
+        return IOD_ENOMEM;
+
+      /* Any gap between both extents is covered by the written
+         range, which is copied below.  */
+      memcpy (extent->bytes + (next->offset - extent->offset),
+              next->bytes, next->size);
+      extent->size = size;
+      extent->next = next->next;
+      ios_trans_extent_free (next);
+    }
+
+  /* Finally, copy the written bytes.  */
+  if (end > IOS_TRANS_EXTENT_END (extent))
+    {
+      size_t size = end - extent->offset;
+
+      if (ios_trans_extent_reserve (extent, size) != IOD_OK)
+        return IOD_ENOMEM;
+      extent->size = size;
+    }
+
+  memcpy (extent->bytes + (offset - extent->offset), buf, count);
+  return IOD_OK;
+}
+
+void
+ios_trans_patch (struct ios_trans *trans, void *buf, size_t count,
+                 ios_dev_off offset)
+{
+  struct ios_trans_extent *extent;
+  ios_dev_off end = offset + count;
+
+  for (extent = trans->extents;
+       extent && extent->offset < end;
+       extent = extent->next)
+    {
+      ios_dev_off begin = extent->offset;
+      ios_dev_off last = IOS_TRANS_EXTENT_END (extent);
+
+      if (last <= offset)
+        continue;
+
+      if (begin < offset)
+        begin = offset;
+      if (last > end)
+        last = end;
+
+      memcpy ((uint8_t *) buf + (begin - offset),
+              extent->bytes + (begin - extent->offset),
+              last - begin);
+    }
+}
+
+int
+ios_trans_covered_p (struct ios_trans *trans, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_trans_extent *extent;
+
+  /* Since extents never touch each other, a covered range shall be
+     contained in a single extent.  */
+  for (extent = trans->extents;
+       extent && extent->offset <= offset;
+       extent = extent->next)
+    if (offset + count <= IOS_TRANS_EXTENT_END (extent))
+      return 1;
+
+  return 0;
+}
+
+ios_dev_off
+ios_trans_end (struct ios_trans *trans)
+{
+  struct ios_trans_extent *extent = trans->extents;
+
+  if (extent == NULL)
+    return 0;
+
+  while (extent->next)
+    extent = extent->next;
+  return IOS_TRANS_EXTENT_END (extent);
+}
+
+int
+ios_trans_commit (struct ios_trans *trans,
+                  int (*pread) (void *data, void *buf,
+                                size_t count, ios_dev_off offset),
+                  int (*pwrite) (void *data, const void *buf,
+                                 size_t count, ios_dev_off offset),
+                  void *data)
+{
+  struct ios_trans_extent *extent, *failed;
+  uint8_t **backups;
+  size_t nextents = 0, i;
+  int ret = IOD_OK;
+
+  for (extent = trans->extents; extent; extent = extent->next)
+    nextents++;
+  if (nextents == 0)
+    return IOD_OK;
+
+  backups = calloc (nextents, sizeof (uint8_t *));
+  if (!backups)
+    return IOD_ENOMEM;
+
+  for (failed = trans->extents, i = 0; failed; failed = failed->next, ++i)
+    {
+      /* Save the contents of the extent right before overwriting
+         them, so they can be restored if this write or a later one
+         fails.  Nothing is read in advance, and the extents that
+         can't be read, usually because they are past the end of the
+         device, are not saved.  */
+      if (pread)
+        {
+          backups[i] = malloc (failed->size);
+          if (!backups[i])
+            {
+              ret = IOD_ENOMEM;
+              break;
+            }
+
+          if (pread (data, backups[i], failed->size,
+                     failed->offset) != IOD_OK)
+            {
+              free (backups[i]);
+              backups[i] = NULL;
+            }
+        }
+
+      if ((ret = pwrite (data, failed->bytes, failed->size,
+                         failed->offset)) != IOD_OK)
+        break;
+    }
+
+  /* Restore the extents written so far, including the one that
+     failed, which may have been partially written.  */
+  if (failed)
+    for (extent = trans->extents, i = 0;
+         extent != failed->next;
+         extent = extent->next, ++i)
+      if (backups[i])
+        pwrite (data, backups[i], extent->size, extent->offset);
+
+  for (i = 0; i < nextents; ++i)
+    free (backups[i]);
+  free (backups);
+  return ret;
+}
@@ -0,0 +1,84 @@
+/* ios-trans.h - Transaction overlays for IO spaces.  */
+
+/* Copyright (C) 2021 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A transaction overlay holds the bytes written to an IO space while
+   a transaction is in progress, so the underlying IO device is not
+   modified until the transaction is committed.
+
+   The written bytes are kept in a list of extents sorted by offset.
+   Overlapping and adjacent extents are always merged, so the list is
+   as short as possible and committing the transaction results in a
+   single write per contiguous modified range, in ascending order of
+   offset.
+
+   The functions below return IOD_* error codes.  */
+
+struct ios_trans;
+
+/* Create a new, empty, transaction overlay.  Return NULL if there is
+   not enough memory.  */
+
+struct ios_trans *ios_trans_new (void);
+
+/* Free all the resources used by TRANS, discarding the bytes written
+   to it.  */
+
+void ios_trans_free (struct ios_trans *trans);
+
+/* Record the write of COUNT bytes from BUF at byte offset OFFSET in
+   TRANS.  */
+
+int ios_trans_pwrite (struct ios_trans *trans, const void *buf,
+                      size_t count, ios_dev_off offset);
+
+/* Overwrite the bytes in the COUNT bytes of BUF, which have been read
+   from byte offset OFFSET, with the bytes written to TRANS in that
+   range.  */
+
+void ios_trans_patch (struct ios_trans *trans, void *buf, size_t count,
+                      ios_dev_off offset);
+
+/* Return 1 if the COUNT bytes starting at byte offset OFFSET have
+   all been written to TRANS.  Return 0 otherwise.  */
+
+int ios_trans_covered_p (struct ios_trans *trans, size_t count,
+                         ios_dev_off offset);
+
+/* Return the byte offset right after the last byte written to TRANS,
+   or 0 if nothing has been written to it.  */
+
+ios_dev_off ios_trans_end (struct ios_trans *trans);
+
+/* Write the contents of TRANS using the PWRITE function, which gets
+   DATA as its first argument.  Contiguous ranges are written in a
+   single call, in ascending order of offset.
+
+   Unless PREAD is NULL, the previous contents of each range are read
+   using it right before the range is written, and it also gets DATA
+   as its first argument.
+   If a write fails, the ranges written so far are restored to their
+   previous contents and the error is returned.  Ranges that couldn't
+   be read, like those past the end of the device, can't be
+   restored.  */
+
+int ios_trans_commit (struct ios_trans *trans,
+                      int (*pread) (void *data, void *buf,
+                                    size_t count, ios_dev_off offset),
+                      int (*pwrite) (void *data, const void *buf,
+                                     size_t count, ios_dev_off offset),
+                      void *data);
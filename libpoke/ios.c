@@ -23,30 +23,26 @@
 #include <stdio.h>
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
 #define _(str) gettext (str)
 #include <streq.h>
 
+/* The bytes of arrays of integers are reversed using SSSE3 or AVX2
+   instructions if the host supports them, which is checked at run
+   time.  */
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+# define IOS_BSWAP_SIMD 1
+# include <immintrin.h>
+#endif
+
 #include "byteswap.h"
+#include "timespec.h"
 
 #include "pk-utils.h"
 #include "ios.h"
 #include "ios-dev.h"
-
-#define IOS_GET_C_ERR_CHCK(c, io, off)                                \
-  {                                                                \
-    uint8_t ch;                                                        \
-    int ret = (io)->dev_if->pread ((io)->dev, &ch, 1, off);         \
-    if (ret == IOD_EOF)                                                \
-      return IOS_EIOFF;                                                \
-    (c) = ch;                                                        \
-  }
-
-#define IOS_PUT_C_ERR_CHCK(c, io, len, off)                \
-  {                                                        \
-    if ((io)->dev_if->pwrite ((io)->dev, c, len, off)      \
-        == IOD_EOF)                                        \
-      return IOS_EIOFF;                                    \
-  }
+#include "ios-cache.h"
+#include "ios-trans.h"
 
 /* The following struct implements an instance of an IO space.
 
@@ -57,6 +53,12 @@
    DEV is the device operated by the IO space.
    DEV_IF is the interface to use when operating the device.
 
+   CACHE is the block cache sitting in front of the device, or NULL
+   if the device is not cached.
+
+   TRANS is the overlay holding the bytes written during the current
+   transaction, or NULL if no transaction is in progress.
+
    NEXT is a pointer to the next open IO space, or NULL.
 
    XXX: add status, saved or not saved.
@@ -68,7 +70,10 @@ struct ios
   char *handler;
   void *dev;
   struct ios_dev_if *dev_if;
+  struct ios_cache *cache;
+  struct ios_trans *trans;
   ios_off bias;
+  struct ios_stats stats;
 
   struct ios *next;
 };
@@ -82,22 +87,76 @@ static int ios_next_id = 0;
 static struct ios *io_list;
 static struct ios *cur_io;
 
+/* Table of IO spaces indexed by id, so they can be looked up in
+   constant time.  Since ids are never reused, the entries of closed
+   IO spaces are NULL.  IOS_TABLE_SIZE is the number of allocated
+   entries.  */
+
+static struct ios **ios_table;
+static int ios_table_size;
+
+/* Make sure there is an entry for the IO space with id ID in the
+   table of IO spaces.  Return IOS_OK or IOS_ENOMEM.  */
+
+static int
+ios_table_reserve (int id)
+{
+  struct ios **table;
+  int i, size;
+
+  if (id < ios_table_size)
+    return IOS_OK;
+
+  size = ios_table_size ? ios_table_size * 2 : 16;
+  while (size <= id)
+    size *= 2;
+
+  table = realloc (ios_table, size * sizeof (struct ios *));
+  if (!table)
+    return IOS_ENOMEM;
+
+  for (i = ios_table_size; i < size; ++i)
+    table[i] = NULL;
+
+  ios_table = table;
+  ios_table_size = size;
+  return IOS_OK;
+}
+
 /* The available backends are implemented in their own files, and
    provide the following interfaces.  */
 
 extern struct ios_dev_if ios_dev_mem; /* ios-dev-mem.c */
 extern struct ios_dev_if ios_dev_file; /* ios-dev-file.c */
 extern struct ios_dev_if ios_dev_stream; /* ios-dev-stream.c */
+extern struct ios_dev_if ios_dev_cow; /* ios-dev-cow.c */
+extern struct ios_dev_if ios_dev_win; /* ios-dev-win.c */
 #ifdef HAVE_LIBNBD
 extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 #endif
+#ifdef HAVE_IOS_DEV_MMAP
+extern struct ios_dev_if ios_dev_mmap; /* ios-dev-mmap.c */
+#endif
+#ifdef HAVE_IOS_DEV_PID
+extern struct ios_dev_if ios_dev_pid; /* ios-dev-pid.c */
+#endif
 
 static struct ios_dev_if *ios_dev_ifs[] =
   {
    &ios_dev_mem,
    &ios_dev_stream,
+   &ios_dev_cow,
+   &ios_dev_win,
 #ifdef HAVE_LIBNBD
    &ios_dev_nbd,
+#endif
+#ifdef HAVE_IOS_DEV_PID
+   &ios_dev_pid,
+#endif
+#ifdef HAVE_IOS_DEV_MMAP
+   /* Mmap must precede file, which handles the files not opened
+      with IOS_F_FILE_MMAP and whatever mmap can't.  */
+   &ios_dev_mmap,
 #endif
    /* File must be last */
    &ios_dev_file,
@@ -116,6 +175,10 @@ ios_shutdown (void)
   /* Close and free all open IO spaces.  */
   while (io_list)
     ios_close (io_list);
+
+  free (ios_table);
+  ios_table = NULL;
+  ios_table_size = 0;
 }
 
 int
@@ -131,7 +194,10 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
     return IOS_ENOMEM;
 
   io->next = NULL;
+  io->cache = NULL;
+  io->trans = NULL;
   io->bias = 0;
+  memset (&io->stats, 0, sizeof (struct ios_stats));
 
   /* Look for a device interface suitable to operate on the given
      handler.  */
@@ -157,11 +223,33 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
         goto error;
       }
 
+  /* Make room for the new space in the table.  */
+  if ((error = ios_table_reserve (ios_next_id)) != IOS_OK)
+    goto error;
+  error = IOS_ERROR;
+
   /* Open the device using the interface found above.  */
   io->dev = io->dev_if->open (handler, flags, &iod_error);
   if (iod_error || io->dev == NULL)
     goto error;
 
+  /* Put a cache in front of the device, if it benefits from it and
+     the space is readable.  */
+  if (io->dev_if->cacheable_p
+      && (io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    {
+      io->cache = ios_cache_new (io->dev, io->dev_if,
+                                 (io->dev_if->volatile_p
+                                  ? 0 : IOS_CACHE_DEFAULT_SIZE),
+                                 &io->stats);
+      if (!io->cache)
+        {
+          io->dev_if->close (io->dev);
+          error = IOS_ENOMEM;
+          goto error;
+        }
+    }
+
   /* Increment the id counter after all possible errors are avoided.  */
   io->id = ios_next_id++;
 
@@ -169,6 +257,7 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
      space.  */
   io->next = io_list;
   io_list = io;
+  ios_table[io->id] = io;
 
   if (!cur_io || set_cur == 1)
     cur_io = io;
@@ -194,12 +283,30 @@ ios_close (ios io)
 
   /* XXX: if not saved, ask before closing.  */
 
+  /* Uncommitted transactions are discarded.  */
+  if (io->trans)
+    ios_trans_free (io->trans);
+
+  /* Write back any pending modification in the cache.  */
+  if (io->cache)
+    {
+      ret = ios_cache_writeback (io->cache);
+      ios_cache_free (io->cache);
+    }
+  else
+    ret = IOD_OK;
+
   /* Close the device operated by the IO space.
      XXX: Errors may be received from fclose.  What do we do in that case?  */
-  ret = io->dev_if->close (io->dev);
+  if (ret == IOD_OK)
+    ret = io->dev_if->close (io->dev);
+  else
+    io->dev_if->close (io->dev);
 
-  /* Unlink the IOS from the list.  */
+  /* Unlink the IOS from the list and the table.  Lookups by id of
+     this space will fail from now on.  */
   assert (io_list != NULL); /* The list contains at least this IO space.  */
+  ios_table[io->id] = NULL;
   if (io_list == io)
     io_list = io_list->next;
   else
@@ -257,13 +364,10 @@ ios_search (const char *handler)
 ios
 ios_search_by_id (int id)
 {
-  ios io;
-
-  for (io = io_list; io; io = io->next)
-    if (io->id == id)
-      break;
+  if (id < 0 || id >= ios_table_size)
+    return NULL;
 
-  return io;
+  return ios_table[id];
 }
 
 int
@@ -317,501 +421,277 @@ ios_map (ios_map_fn cb, void *data)
     (*cb) (io, data);
 }
 
-/* Set all except the lowest SIGNIFICANT_BITS of VALUE to zero.  */
-#define IOS_CHAR_GET_LSB(value, significant_bits)                \
-  (*(value) &= 0xFFU >> (CHAR_BIT - (significant_bits)))
+size_t
+ios_get_cache_size (ios io)
+{
+  return io->cache ? ios_cache_get_size (io->cache) : 0;
+}
 
-/* Set all except the highest SIGNIFICANT_BITS of the lowest
-   significant byte of VALUE to zero.  */
-#define IOS_CHAR_GET_MSB(value, significant_bits)                \
-  (*(value) &= 0xFFU << (CHAR_BIT - (significant_bits)))
+int
+ios_set_cache_size (ios io, size_t size)
+{
+  if (!io->cache)
+    return IOS_EINVAL;
 
-static inline int
-ios_read_int_common (ios io, ios_off offset, int flags,
-                     int bits,
-                     enum ios_endian endian,
-                     uint64_t *value)
+  return IOD_ERROR_TO_IOS_ERROR (ios_cache_set_size (io->cache, size));
+}
+
+void
+ios_get_stats (ios io, struct ios_stats *stats)
 {
-  /* 64 bits might span at most 9 bytes.  */
-  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  *stats = io->stats;
+  stats->dirty = io->cache ? ios_cache_get_dirty (io->cache) : 0;
+}
 
-  /* Number of signifcant bits in the first byte.  */
-  int firstbyte_bits = 8 - (offset % 8);
+void
+ios_reset_stats (ios io)
+{
+  memset (&io->stats, 0, sizeof (struct ios_stats));
+}
 
-  /* (Total number of bytes that need to be read) - 1.  */
-  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
+/* Whether the time spent in the requests to the IO devices is
+   measured.  */
 
-  /* Number of significant bits in the last byte.  */
-  int lastbyte_bits = (bits + (offset % 8)) % 8;
-  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+int ios_stats_timing = 0;
 
-  /* Read the bytes and clear the unused bits.  */
-  if (io->dev_if->pread (io->dev, c, bytes_minus1 + 1, offset / 8) == IOD_EOF)
-    return IOS_EIOFF;
-  IOS_CHAR_GET_LSB(&c[0], firstbyte_bits);
+int
+ios_get_stats_timing (void)
+{
+  return ios_stats_timing;
+}
 
-  switch (bytes_minus1)
-  {
-  case 0:
-    *value = c[0] >> (8 - lastbyte_bits);
-    return IOS_OK;
+void
+ios_set_stats_timing (int timing_p)
+{
+  ios_stats_timing = timing_p;
+}
 
-  case 1:
-    IOS_CHAR_GET_MSB(&c[1], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if (bits <= 8)
-          /* We need to shift to align the least significant bit.  */
-          *value = (c[0] << lastbyte_bits) | (c[1] >> (8 - lastbyte_bits));
-        else if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[1] << lastbyte_bits) | c[0];
-        else
-          {
-            /* Consider the order of bits in a little endian number:
-            7-6-5-4-3-2-1-0-15-14-13-12-11-10-9-8- ... If such an
-            encoding is not byte-aligned, we have to first shift to fill the
-            least significant byte to get the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = (c[0] << (8 + offset % 8)) | (c[1] << offset % 8);
-            *value = ((reg & 0xff) << (bits % 8)) | (reg >> 8);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << lastbyte_bits) | (c[1] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+uint64_t
+ios_stats_clock (void)
+{
+  struct timespec ts = current_timespec ();
 
-  case 2:
-    IOS_CHAR_GET_MSB(&c[2], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[2] << (8 + lastbyte_bits)) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 16)
-              reg = ((reg & 0x00ff000000000000LL) >> (16 - bits))
-                    | (reg & 0xff00ffffffffffffLL);
-            else
-              reg = ((reg & 0x0000ff0000000000LL) >> (24 - bits))
-                    | (reg & 0xffff00ffffffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << (8 + lastbyte_bits)) | (c[1] << lastbyte_bits)
-                 | (c[2] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-  case 3:
-    IOS_CHAR_GET_MSB(&c[3], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[3] << (16 + lastbyte_bits)) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 24)
-              reg = ((reg & 0x0000ff0000000000LL) >> (24 - bits))
-                    | (reg & 0xffff00ffffffffffLL);
-            else
-              reg = ((reg & 0x000000ff00000000LL) >> (32 - bits))
-                    | (reg & 0xffffff00ffffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << (16 + lastbyte_bits)) | (c[1] << (8 + lastbyte_bits))
-                 | (c[2] << lastbyte_bits) | (c[3] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+/* Read COUNT bytes at the byte offset OFFSET of the device operated
+   by IO, ignoring any transaction in progress.  The read is served by
+   the IOS cache unless FLAGS contains IOS_F_BYPASS_CACHE.  */
 
-  case 4:
-    IOS_CHAR_GET_MSB(&c[4], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[4] << (24 + lastbyte_bits))
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                   | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 32)
-              reg = ((reg & 0x000000ff00000000LL) >> (32 - bits))
-                    | (reg & 0xffffff00ffffffffLL);
-            else
-              reg = ((reg & 0x00000000ff000000LL) >> (40 - bits))
-                    | (reg & 0xffffffff00ffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (16 + lastbyte_bits))
-                 | (c[2] << (8 + lastbyte_bits)) | (c[3] << lastbyte_bits)
-                 | (c[4] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+static inline int
+ios_dev_pread_1 (ios io, int flags, void *buf, size_t count,
+                 ios_dev_off offset)
+{
+  uint64_t start;
+  int ret;
 
-  case 5:
-    IOS_CHAR_GET_MSB(&c[5], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[5] << (32 + lastbyte_bits))
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 40)
-              reg = ((reg & 0x00000000ff000000LL) >> (40 - bits))
-                    | (reg & 0xffffffff00ffffffLL);
-            else
-              reg = ((reg & 0x0000000000ff0000LL) >> (48 - bits))
-                    | (reg & 0xffffffffff00ffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (16 + lastbyte_bits))
-                 | (c[3] << (8 + lastbyte_bits))
-                 | (c[4] << lastbyte_bits) | (c[5] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+  if (io->cache)
+    {
+      if (!(flags & IOS_F_BYPASS_CACHE))
+        return ios_cache_pread (io->cache, buf, count, offset);
 
-  case 6:
-    IOS_CHAR_GET_MSB(&c[6], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[6] << (40 + lastbyte_bits))
-                   | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8))
-                  | (c[6] << (8 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 48)
-              reg = ((reg & 0x0000000000ff0000LL) >> (48 - bits))
-                    | (reg & 0xffffffffff00ffffLL);
-            else
-              reg = ((reg & 0x000000000000ff00LL) >> (56 - bits))
-                    | (reg & 0xffffffffffff00ffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (16 + lastbyte_bits))
-                 | (c[4] << (8 + lastbyte_bits)) | (c[5] << lastbyte_bits)
-                 | (c[6] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+      if ((ret = ios_cache_sync (io->cache, offset, count)) != IOD_OK)
+        return ret;
+    }
 
-  case 7:
-    IOS_CHAR_GET_MSB(&c[7], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[7] << (48 + lastbyte_bits))
-                   | ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8))
-                  | (c[6] << (8 + offset % 8)) | (c[7] << offset % 8);
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 56)
-              reg = ((reg & 0x000000000000ff00LL) >> (56 - bits))
-                    | (reg & 0xffffffffffff00ffLL);
-            else
-              reg = ((reg & 0x00000000000000ffLL) >> (64 - bits))
-                    | (reg & 0xffffffffffffff00LL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (48 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[4] << (16 + lastbyte_bits))
-                 | (c[5] << (8 + lastbyte_bits))
-                 | (c[6] << lastbyte_bits) | (c[7] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+  start = ios_stats_start ();
+  ret = io->dev_if->pread (io->dev, buf, count, offset);
+  ios_stats_read (&io->stats, count, start);
+  return ret;
+}
 
-  case 8:
-    IOS_CHAR_GET_MSB(&c[8], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        /* We have to shift to fill the least significant byte to get
-           the right bits in the same bytes.  */
-        uint64_t reg;
-        reg = ((uint64_t) c[0] << (56 + offset % 8))
-              | ((uint64_t) c[1] << (48 + offset % 8))
-              | ((uint64_t) c[2] << (40 + offset % 8))
-              | ((uint64_t) c[3] << (32 + offset % 8))
-              | ((uint64_t) c[4] << (24 + offset % 8))
-              | (c[5] << (16 + offset % 8))
-              | (c[6] << (8 + offset % 8)) | (c[7] << offset % 8)
-              | (c[8] >> firstbyte_bits);
-        /* The bits in the most-significant-byte-to-be is aligned to left,
-           shift it towards right! */
-        reg = ((reg & 0x00000000000000ffLL) >> (64 - bits))
-              | (reg & 0xffffffffffffff00LL);
-        /* Now we can place the bytes correctly.  */
-        *value = bswap_64(reg);
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (56 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (48 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[4] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[5] << (16 + lastbyte_bits))
-                 | (c[6] << (8 + lastbyte_bits)) | (c[7] << lastbyte_bits)
-                 | (c[8] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+/* Likewise, but for writing.  Writes bypassing the cache go straight
+   to the device.  */
 
-  default:
-    assert (0);
-  }
+static inline int
+ios_dev_pwrite_1 (ios io, int flags, const void *buf, size_t count,
+                  ios_dev_off offset)
+{
+  uint64_t start;
+  int ret;
+
+  if (io->cache)
+    {
+      if (!(flags & IOS_F_BYPASS_CACHE))
+        return ios_cache_pwrite (io->cache, buf, count, offset);
+
+      if ((ret = ios_cache_sync (io->cache, offset, count)) != IOD_OK)
+        return ret;
+    }
+
+  start = ios_stats_start ();
+  ret = io->dev_if->pwrite (io->dev, buf, count, offset);
+  ios_stats_write (&io->stats, count, start);
+  return ret;
 }
 
-int
-ios_read_int (ios io, ios_off offset, int flags,
-              int bits,
-              enum ios_endian endian,
-              enum ios_nenc nenc,
-              int64_t *value)
+/* Read COUNT bytes at the byte offset OFFSET of the device operated
+   by IO, as modified by the transaction in progress.  */
+
+static int
+ios_dev_pread_trans (ios io, int flags, void *buf, size_t count,
+                     ios_dev_off offset)
 {
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
+  int ret = ios_dev_pread_1 (io, flags, buf, count, offset);
 
-  /* Fast track for byte-aligned 8x bits  */
-  if (offset % 8 == 0 && bits % 8 == 0)
+  if (ret == IOD_EOF)
     {
-      uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-        return IOS_EIOFF;
+      /* The range may extend past the end of the device, into bytes
+         written during the transaction.  */
+      ios_dev_off size = io->dev_if->size (io->dev);
+      ios_dev_off begin = offset > size ? offset : size;
+
+      if (!ios_trans_covered_p (io->trans, offset + count - begin, begin))
+        return IOD_EOF;
+
+      if (offset < size
+          && (ret = ios_dev_pread_1 (io, flags, buf, size - offset,
+                                     offset)) != IOD_OK)
+        return ret;
+    }
+  else if (ret != IOD_OK)
+    return ret;
 
-      switch (bits) {
-      case 8:
-        {
-          *value = (int8_t) c[0];
-          return IOS_OK;
-        }
+  ios_trans_patch (io->trans, buf, count, offset);
+  return IOD_OK;
+}
 
-      case 16:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (int16_t) (c[1] << 8) | c[0];
-          else
-            *value = (int16_t) (c[0] << 8) | c[1];
-          return IOS_OK;
-        }
+/* Read COUNT bytes at the byte offset OFFSET of IO.  If a transaction
+   is in progress, the bytes written during it are seen.  */
 
-      case 24:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = (c[0] << 16) | (c[1] << 8) | c[2];
-          *value <<= 40;
-          *value >>= 40;
-          return IOS_OK;
-        }
+static inline int
+ios_dev_pread (ios io, int flags, void *buf, size_t count,
+               ios_dev_off offset)
+{
+  if (io->trans)
+    return ios_dev_pread_trans (io, flags, buf, count, offset);
+  else
+    return ios_dev_pread_1 (io, flags, buf, count, offset);
+}
 
-      case 32:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (int32_t) (c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = (int32_t) (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
-          return IOS_OK;
-        }
+/* Write COUNT bytes at the byte offset OFFSET of IO.  If a
+   transaction is in progress, the bytes are recorded in its overlay
+   instead of being written to the device.  */
 
-      case 40:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                     | (c[2] << 16) | (c[3] << 8) | c[4];
-          *value <<= 24;
-          *value >>= 24;
-          return IOS_OK;
-        }
+static inline int
+ios_dev_pwrite (ios io, int flags, const void *buf, size_t count,
+                ios_dev_off offset)
+{
+  if (io->trans)
+    return ios_trans_pwrite (io->trans, buf, count, offset);
+  else
+    return ios_dev_pwrite_1 (io, flags, buf, count, offset);
+}
 
-      case 48:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                     | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                     | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                     | (c[4] << 8) | c[5];
-          *value <<= 16;
-          *value >>= 16;
-          return IOS_OK;
-        }
+/* Integers are read and written through a 64-bit window holding the
+   bytes that cover them, the first byte being the most significant
+   one.  An integer starting at bit SHIFT of its first byte occupies
+   the bits [SHIFT, SHIFT + BITS) of the window, counting from the
+   most significant bit.  A 64-bit integer which is not byte-aligned
+   spans nine bytes: its last bits are in the ninth one.  */
 
-      case 56:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                     | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                     | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[4] << 16) | (c[5] << 8) | c[6];
-          *value <<= 8;
-          *value >>= 8;
-          return IOS_OK;
-        }
+static inline uint64_t
+ios_load_be64 (const uint8_t *c)
+{
+  uint64_t w;
 
-      case 64:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                     | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                     | c[0];
-          else
-            *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                     | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                     | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                     | c[7];
-          return IOS_OK;
-        }
-      }
-    }
+  memcpy (&w, c, 8);
+#ifndef WORDS_BIGENDIAN
+  w = bswap_64 (w);
+#endif
+  return w;
+}
+
+static inline void
+ios_store_be64 (uint8_t *c, uint64_t w)
+{
+#ifndef WORDS_BIGENDIAN
+  w = bswap_64 (w);
+#endif
+  memcpy (c, &w, 8);
+}
+
+/* Little-endian integers whose width is not a multiple of 8 store
+   their BITS / 8 least significant bytes first, starting with the
+   least significant one, followed by their remaining BITS % 8 most
+   significant bits.  For example, the bits of a 12-bit integer are
+   stored in the order 7-6-5-4-3-2-1-0-11-10-9-8.
+
+   The following functions convert between such an encoding, read as
+   a big-endian BITS-bit integer, and the value of the integer.  */
+
+static inline uint64_t
+ios_lsb_decode (uint64_t enc, int bits)
+{
+  int nbytes = bits / 8;
+  int rest = bits % 8;
+
+  if (bits <= 8)
+    return enc;
+  if (rest == 0)
+    return bswap_64 (enc) >> (64 - bits);
+  return ((bswap_64 (enc >> rest) >> (64 - 8 * nbytes))
+          | (enc & ((1U << rest) - 1)) << (8 * nbytes));
+}
+
+static inline uint64_t
+ios_lsb_encode (uint64_t value, int bits)
+{
+  int nbytes = bits / 8;
+  int rest = bits % 8;
+
+  if (bits <= 8)
+    return value;
+  if (rest == 0)
+    return bswap_64 (value) >> (64 - bits);
+  return ((bswap_64 (value) >> (64 - 8 * nbytes)) << rest
+          | value >> (8 * nbytes));
+}
+
+static inline int
+ios_read_int_common (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     uint64_t *value)
+{
+  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  int shift = offset % 8;
+  uint64_t w;
 
-  /* Fall into the case for the unaligned and the sizes other than 8x.  */
-  int ret_val = ios_read_int_common (io, offset, flags, bits, endian,
-                                     (uint64_t *) value);
-  if (ret_val == IOS_OK)
+  if (ios_dev_pread (io, flags, c, (shift + bits + 7) / 8,
+                     offset / 8) == IOD_EOF)
+    return IOS_EIOFF;
+
+  /* Drop the bits preceding the integer, bringing in the bits of the
+     ninth byte, and then the bits following it.  */
+  w = ios_load_be64 (c) << shift | (uint64_t) c[8] >> (8 - shift);
+  w >>= 64 - bits;
+
+  *value = endian == IOS_ENDIAN_LSB ? ios_lsb_decode (w, bits) : w;
+  return IOS_OK;
+}
+
+int
+ios_read_int (ios io, ios_off offset, int flags,
+              int bits,
+              enum ios_endian endian,
+              enum ios_nenc nenc,
+              int64_t *value)
+{
+  int ret;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  ret = ios_read_int_common (io, offset, flags, bits, endian,
+                             (uint64_t *) value);
+  if (ret == IOS_OK)
     {
-      *value <<= 64 - bits;
-      *value >>= 64 - bits;
+      /* Sign-extend the value.  */
+      *value = (int64_t) ((uint64_t) *value << (64 - bits)) >> (64 - bits);
       return IOS_OK;
     }
-  return ret_val;
+  return ret;
 }
 
 int
@@ -823,86 +703,6 @@ ios_read_uint (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
-  /* Fast track for byte-aligned 8x bits  */
-  if (offset % 8 == 0 && bits % 8 == 0)
-    {
-      uint8_t c[8];
-      if (io->dev_if->pread (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-        return IOS_EIOFF;
-
-      switch (bits) {
-      case 8:
-        *value = c[0];
-        return IOS_OK;
-
-      case 16:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 8) | c[1];
-        return IOS_OK;
-
-      case 24:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 16) | (c[1] << 8) | c[2];
-        return IOS_OK;
-
-      case 32:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
-        return IOS_OK;
-
-      case 40:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                   | (c[2] << 16) | (c[3] << 8) | c[4];
-        return IOS_OK;
-
-      case 48:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                   | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                   | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                   | (c[4] << 8) | c[5];
-        return IOS_OK;
-
-      case 56:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                   | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[4] << 16) | (c[5] << 8) | c[6];
-        return IOS_OK;
-
-      case 64:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                   | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                   | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                   | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                   | c[7];
-        return IOS_OK;
-      }
-    }
-
-  /* Fall into the case for the unaligned and the sizes other than 8x.  */
   return ios_read_int_common (io, offset, flags, bits, endian, value);
 }
 
@@ -917,68 +717,93 @@ static int realloc_string (char **str, size_t newsize)
   return IOS_OK;
 }
 
+/* Strings are read from the IOD in chunks, which start small and
+   grow geometrically up to a maximum size.  */
+
+#define IOS_STRING_CHUNK_MIN 128
+#define IOS_STRING_CHUNK_MAX (64 * 1024)
+
+/* Maximum length of the strings read by ios_read_string.  Zero means
+   no limit.  */
+
+static uint64_t ios_string_max = 0;
+
+uint64_t
+ios_get_string_max (void)
+{
+  return ios_string_max;
+}
+
+void
+ios_set_string_max (uint64_t max)
+{
+  ios_string_max = max;
+}
+
 int
 ios_read_string (ios io, ios_off offset, int flags, char **value)
 {
   char *str = NULL;
+  char *nul;
   size_t i = 0;
+  size_t chunk = IOS_STRING_CHUNK_MIN;
+  int eof_p = 0;
   int ret;
 
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
+  /* Reading past the terminating NULL character in some devices,
+     like streams, may block waiting for input that is not part of
+     the string, so read these byte by byte.  */
+  if (ios_blocking_p (io))
+    {
+      chunk = 1;
+      eof_p = 1;
+    }
 
-  if (offset % 8 == 0)
+  while (1)
     {
-      /* This is the fast case: the string is aligned to a byte
-         boundary.  We just read bytes from the IOD until either EOF
-         or a NULL byte.  */
+      size_t count = chunk;
 
-      do
+      /* Don't read more than the maximum length of a string plus its
+         terminator.  */
+      if (ios_string_max > 0 && i + count > ios_string_max + 1)
+        count = ios_string_max + 1 - i;
+
+      if ((ret = realloc_string (&str, i + count)) < 0)
+        goto error;
+
+      ret = ios_read_bytes (io, offset + i * 8, flags, str + i, count);
+      if (ret == IOS_EIOFF && chunk > 1)
         {
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
-
-          if (io->dev_if->pread (io->dev, &str[i], 1,
-                                 offset / 8 + i) == IOD_EOF)
-            {
-              ret = IOS_EIOFF;
-              goto error;
-            }
+          /* The chunk goes past the end of the IO space.  Retry with
+             smaller chunks, since the string may end before.  */
+          chunk /= 2;
+          eof_p = 1;
+          continue;
         }
-      while (str[i++] != '\0');
-    }
-  else
-    {
-      /* The string is not aligned to a byte boundary.  Instead of
-         reading bytes from the IOD, we use the IOS to read 8-byte
-         unsigned integers.  */
+      if (ret != IOS_OK)
+        goto error;
 
-      do
+      nul = memchr (str + i, '\0', count);
+      if (nul)
         {
-          uint64_t abyte;
-
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
-
-          ret = ios_read_uint (io, offset, flags, 8,
-                               IOS_ENDIAN_MSB, /* Arbitrary.  */
-                               &abyte);
-          if (ret == IOS_EIOFF)
-            goto error;
+          i = nul - str;
+          break;
+        }
 
-          str[i] = (char) abyte;
-          offset += 8;
+      i += count;
+      if (ios_string_max > 0 && i > ios_string_max)
+        {
+          ret = IOS_ETOOLONG;
+          goto error;
         }
-      while (str[i++] != '\0');
+
+      if (!eof_p && chunk < IOS_STRING_CHUNK_MAX)
+        chunk *= 2;
     }
 
-  *value = str;
+  /* Give back the unused part of the last chunk.  */
+  nul = realloc (str, i + 1);
+  *value = nul ? nul : str;
   return IOS_OK;
 
 error:
@@ -986,464 +811,205 @@ error:
   return ret;
 }
 
-static inline int
-ios_write_int_fast (ios io, ios_off offset, int flags,
-                    int bits,
-                    enum ios_endian endian,
-                    uint64_t value)
+int
+ios_read_bytes (ios io, ios_off offset, int flags,
+                void *buf, size_t count)
 {
-  uint8_t c[8];
-
-  switch (bits)
-    {
-    case 8:
-      c[0] = value;
-      break;
+  uint8_t *bytes = buf;
+  int shift;
+  size_t i;
+  uint8_t last;
 
-    case 16:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-        }
-      else
-        {
-          c[0] = value >> 8;
-          c[1] = value;
-        }
-      break;
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
 
-    case 24:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-        }
-      else
-        {
-          c[0] = value >> 16;
-          c[1] = value >> 8;
-          c[2] = value;
-        }
-      break;
+  if (count == 0)
+    return IOS_OK;
 
-    case 32:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-        }
-      else
-        {
-          c[0] = value >> 24;
-          c[1] = value >> 16;
-          c[2] = value >> 8;
-          c[3] = value;
-        }
-      break;
+  /* This is the fast case: the range is aligned to a byte boundary
+     and we can read it from the IOD in one go.  */
+  if (offset % 8 == 0)
+    return (ios_dev_pread (io, flags, buf, count, offset / 8) == IOD_EOF
+            ? IOS_EIOFF : IOS_OK);
+
+  /* The range is not aligned to a byte boundary, so it spans COUNT + 1
+     bytes in the IOD.  Read them and shift them in place.  */
+  shift = offset % 8;
+  if (ios_dev_pread (io, flags, bytes, count, offset / 8) == IOD_EOF
+      || ios_dev_pread (io, flags, &last, 1, offset / 8 + count) == IOD_EOF)
+    return IOS_EIOFF;
 
-    case 40:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-        }
-      else
-        {
-          c[0] = value >> 32;
-          c[1] = value >> 24;
-          c[2] = value >> 16;
-          c[3] = value >> 8;
-          c[4] = value;
-        }
-      break;
+  for (i = 0; i < count; ++i)
+    {
+      uint8_t next = i + 1 < count ? bytes[i + 1] : last;
+      bytes[i] = (bytes[i] << shift) | (next >> (8 - shift));
+    }
 
-    case 48:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-        }
-      else
-        {
-          c[0] = value >> 40;
-          c[1] = value >> 32;
-          c[2] = value >> 24;
-          c[3] = value >> 16;
-          c[4] = value >> 8;
-          c[5] = value;
-        }
-      break;
+  return IOS_OK;
+}
 
-    case 56:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-          c[6] = value >> 48;
-        }
-      else
-        {
-          c[0] = value >> 48;
-          c[1] = value >> 40;
-          c[2] = value >> 32;
-          c[3] = value >> 24;
-          c[4] = value >> 16;
-          c[5] = value >> 8;
-          c[6] = value;
-        }
-      break;
+#if IOS_BSWAP_SIMD
 
-    case 64:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-          c[6] = value >> 48;
-          c[7] = value >> 56;
-        }
-      else
-        {
-          c[0] = value >> 56;
-          c[1] = value >> 48;
-          c[2] = value >> 40;
-          c[3] = value >> 32;
-          c[4] = value >> 24;
-          c[5] = value >> 16;
-          c[6] = value >> 8;
-          c[7] = value;
-        }
-      break;
+/* Return the byte shuffling mask that reverses the bytes of each of
+   the BITS-bit integers in a 128-bit vector.  */
 
+__attribute__ ((target ("ssse3")))
+static inline __m128i
+ios_bswap_mask (int bits)
+{
+  switch (bits)
+    {
+    case 16:
+      return _mm_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6,
+                            9, 8, 11, 10, 13, 12, 15, 14);
+    case 32:
+      return _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4,
+                            11, 10, 9, 8, 15, 14, 13, 12);
     default:
-      assert (0);
-      break;
+      return _mm_setr_epi8 (7, 6, 5, 4, 3, 2, 1, 0,
+                            15, 14, 13, 12, 11, 10, 9, 8);
     }
-
-  if (io->dev_if->pwrite (io->dev, c, bits / 8, offset / 8) == IOD_EOF)
-    return IOS_EIOFF;
-  return IOS_OK;
 }
 
-static inline int
-ios_write_int_common (ios io, ios_off offset, int flags,
-                      int bits,
-                      enum ios_endian endian,
-                      uint64_t value)
-{
-  /* 64 bits might span at most 9 bytes.  */
-  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-  /* Number of signifcant bits in the first byte.  */
-  int firstbyte_bits = 8 - (offset % 8);
+/* Reverse the bytes of each of the BITS-bit integers in the first
+   NBYTES bytes at P, 16 bytes at a time, and return the number of
+   bytes processed.  */
 
-  /* (Total number of bytes that need to be read) - 1.  */
-  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
-
-  /* Number of significant bits in the last byte.  */
-  int lastbyte_bits = (bits + (offset % 8)) % 8;
-  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+__attribute__ ((target ("ssse3")))
+static size_t
+ios_bswap_array_ssse3 (uint8_t *p, int bits, size_t nbytes)
+{
+  __m128i mask = ios_bswap_mask (bits);
+  size_t i;
 
-  switch (bytes_minus1)
-  {
-  case 0:
+  for (i = 0; i + 16 <= nbytes; i += 16)
     {
-      /* We are altering only a single byte.  */
-      uint64_t head, tail;
-      IOS_GET_C_ERR_CHCK(head, io, offset / 8);
-      tail = head;
-      IOS_CHAR_GET_MSB(&head, offset % 8);
-      IOS_CHAR_GET_LSB(&tail, 8 - lastbyte_bits);
-
-      /* Write the byte back without changing the surrounding bits.  */
-      c[0] = head | tail | (value << (8 - lastbyte_bits));
-      IOS_PUT_C_ERR_CHCK(c, io, 1, offset / 8);
-      return IOS_OK;
+      __m128i v = _mm_loadu_si128 ((__m128i *) (p + i));
+      _mm_storeu_si128 ((__m128i *) (p + i), _mm_shuffle_epi8 (v, mask));
     }
 
-  case 1:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + 1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+  return i;
+}
 
-    if (endian == IOS_ENDIAN_LSB && bits > 8)
-      {
-        /* Convert to the little endian format. For example a 12-bit-long
-           number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-           with leading 0s.  */
-        value = ((value & 0xff) << (bits % 8))
-                | (value & 0xff00) >> 8;
-      }
-    c[0] |= value >> lastbyte_bits;
-    c[1] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 2, offset / 8);
-    return IOS_OK;
+/* Likewise, but 32 bytes at a time.  */
 
-  case 2:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+__attribute__ ((target ("avx2")))
+static size_t
+ios_bswap_array_avx2 (uint8_t *p, int bits, size_t nbytes)
+{
+  __m256i mask = _mm256_broadcastsi128_si256 (ios_bswap_mask (bits));
+  size_t i;
 
-    if (endian == IOS_ENDIAN_LSB)
+  for (i = 0; i + 32 <= nbytes; i += 32)
     {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 16)
-        value = ((value & 0xff) << (bits % 8))
-                | (value & 0xff00) >> 8;
-      else
-        value = ((value & 0xff) << (8 + bits % 8))
-                | (value & 0xff00) >> (8 - bits % 8)
-                | (value & 0xff0000) >> 16;
+      __m256i v = _mm256_loadu_si256 ((__m256i *) (p + i));
+      _mm256_storeu_si256 ((__m256i *) (p + i),
+                           _mm256_shuffle_epi8 (v, mask));
     }
-    c[0] |= value >> (8 + lastbyte_bits);
-    c[1] = (value >> lastbyte_bits) & 0xff;
-    c[2] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 3, offset / 8);
-    return IOS_OK;
 
-  case 3:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+  return i + ios_bswap_array_ssse3 (p + i, bits, nbytes - i);
+}
 
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 24)
-        value = ((value & 0xff) << (8 + bits % 8))
-                | (value & 0xff00) >> (8 - bits % 8)
-                | (value & 0xff0000) >> 16;
-      else
-        value = ((value & 0xff) << (16 + bits % 8))
-                | (value & 0xff00) << (bits % 8)
-                | (value & 0xff0000) >> (16 - bits % 8)
-                | (value & 0xff000000) >> 24;
-    }
-    c[0] |= value >> (16 + lastbyte_bits);
-    c[1] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> lastbyte_bits) & 0xff;
-    c[3] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 4, offset / 8);
-    return IOS_OK;
+#endif
 
-  case 4:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+/* Reverse the bytes of each of the COUNT integers of BITS bits in
+   VALUES.  This is done 32 or 16 bytes at a time if the host has
+   AVX2 or SSSE3, and the remaining integers one by one.  */
 
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 32)
-        value = ((value & 0xff) << (16 + bits % 8))
-                | (value & 0xff00) << (bits % 8)
-                | (value & 0xff0000) >> (16 - bits % 8)
-                | (value & 0xff000000) >> 24;
-      else
-        value = ((value & 0xff) << (24 + bits % 8))
-                | (value & 0xff00) << (8 + bits % 8)
-                | (value & 0xff0000) >> (8 - bits % 8)
-                | (value & 0xff000000) >> (24 - bits % 8)
-                | (value & 0xff00000000) >> 32;
-    }
-    c[0] |= value >> (24 + lastbyte_bits);
-    c[1] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> lastbyte_bits) & 0xff;
-    c[4] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 5, offset / 8);
-    return IOS_OK;
+static void
+ios_bswap_array (void *values, int bits, size_t count)
+{
+  size_t i = 0;
 
-  case 5:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+  if (bits == 8)
+    return;
+
+#if IOS_BSWAP_SIMD
+  if (__builtin_cpu_supports ("avx2"))
+    i = ios_bswap_array_avx2 (values, bits, count * (bits / 8));
+  else if (__builtin_cpu_supports ("ssse3"))
+    i = ios_bswap_array_ssse3 (values, bits, count * (bits / 8));
+#endif
 
-    if (endian == IOS_ENDIAN_LSB)
+  switch (bits)
     {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 40)
-        value = ((value & 0xff) << (24 + bits % 8))
-                | (value & 0xff00) << (8 + bits % 8)
-                | (value & 0xff0000) >> (8 - bits % 8)
-                | (value & 0xff000000) >> (24 - bits % 8)
-                | (value & 0xff00000000) >> 32;
-      else
-        value = ((value & 0xff) << (32 + bits % 8))
-                | (value & 0xff00) << (16 + bits % 8)
-                | (value & 0xff0000) << (bits % 8)
-                | (value & 0xff000000) >> (16 - bits % 8)
-                | (value & 0xff00000000) >> (32 - bits % 8)
-                | (value & 0xff0000000000) >> 40;
+    case 16:
+      for (i /= 2; i < count; ++i)
+        ((uint16_t *) values)[i] = bswap_16 (((uint16_t *) values)[i]);
+      break;
+    case 32:
+      for (i /= 4; i < count; ++i)
+        ((uint32_t *) values)[i] = bswap_32 (((uint32_t *) values)[i]);
+      break;
+    case 64:
+      for (i /= 8; i < count; ++i)
+        ((uint64_t *) values)[i] = bswap_64 (((uint64_t *) values)[i]);
+      break;
+    default:
+      assert (0);
     }
-    c[0] |= value >> (32 + lastbyte_bits);
-    c[1] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> lastbyte_bits) & 0xff;
-    c[5] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 6, offset / 8);
-    return IOS_OK;
+}
 
-  case 6:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+int
+ios_read_uint_array (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     void *values, size_t count)
+{
+  int ret;
 
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 48)
-        value = ((value & 0xff) << (32 + bits % 8))
-                | (value & 0xff00) << (16 + bits % 8)
-                | (value & 0xff0000) << (bits % 8)
-                | (value & 0xff000000) >> (16 - bits % 8)
-                | (value & 0xff00000000) >> (32 - bits % 8)
-                | (value & 0xff0000000000) >> 40;
-      else
-        value = ((value & 0xff) << (40 + bits % 8))
-                | (value & 0xff00) << (24 + bits % 8)
-                | (value & 0xff0000) << (8 + bits % 8)
-                | (value & 0xff000000) >> (8 - bits % 8)
-                | (value & 0xff00000000) >> (24 - bits % 8)
-                | (value & 0xff0000000000) >> (40 - bits % 8)
-                | (value & 0xff000000000000) >> 48;
-    }
-    c[0] |= value >> (40 + lastbyte_bits);
-    c[1] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> lastbyte_bits) & 0xff;
-    c[6] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 7, offset / 8);
-    return IOS_OK;
+  assert (bits == 8 || bits == 16 || bits == 32 || bits == 64);
 
-  case 7:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+  /* Read all the integers in one go, and then convert them to the
+     endianness of the host if needed.  */
+  ret = ios_read_bytes (io, offset, flags, values, count * (bits / 8));
+  if (ret != IOS_OK)
+    return ret;
 
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 56)
-        value = ((value & 0xff) << (40 + bits % 8))
-                | (value & 0xff00) << (24 + bits % 8)
-                | (value & 0xff0000) << (8 + bits % 8)
-                | (value & 0xff000000) >> (8 - bits % 8)
-                | (value & 0xff00000000) >> (24 - bits % 8)
-                | (value & 0xff0000000000) >> (40 - bits % 8)
-                | (value & 0xff000000000000) >> 48;
-      else
-        value = ((value & 0xff) << (48 + bits % 8))
-                | (value & 0xff00) << (32 + bits % 8)
-                | (value & 0xff0000) << (16 + bits % 8)
-                | (value & 0xff000000) << (bits % 8)
-                | (value & 0xff00000000) >> (16 - bits % 8)
-                | (value & 0xff0000000000) >> (32 - bits % 8)
-                | (value & 0xff000000000000) >> (48 - bits % 8)
-                | (value & 0xff00000000000000) >> 56;
-    }
-    c[0] |= value >> (48 + lastbyte_bits);
-    c[1] = (value >> (40 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[6] = (value >> lastbyte_bits) & 0xff;
-    c[7] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 8, offset / 8);
-    return IOS_OK;
+#ifdef WORDS_BIGENDIAN
+  if (endian == IOS_ENDIAN_LSB)
+#else
+  if (endian == IOS_ENDIAN_MSB)
+#endif
+    ios_bswap_array (values, bits, count);
 
-  case 8:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
+  return IOS_OK;
+}
 
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      value = ((value & 0xff) << (48 + bits % 8))
-              | (value & 0xff00) << (32 + bits % 8)
-              | (value & 0xff0000) << (16 + bits % 8)
-              | (value & 0xff000000) << (bits % 8)
-              | (value & 0xff00000000) >> (16 - bits % 8)
-              | (value & 0xff0000000000) >> (32 - bits % 8)
-              | (value & 0xff000000000000) >> (48 - bits % 8)
-              | (value & 0xff00000000000000) >> 56;
-    }
-    c[0] |= value >> (56 + lastbyte_bits);
-    c[1] = (value >> (48 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (40 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[6] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[7] = (value >> lastbyte_bits) & 0xff;
-    c[8] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 9, offset / 8);
-    return IOS_OK;
+static inline int
+ios_write_int_common (ios io, ios_off offset, int flags,
+                      int bits,
+                      enum ios_endian endian,
+                      uint64_t value)
+{
+  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  int shift = offset % 8;
+  int nbytes = (shift + bits + 7) / 8;
+  uint64_t w, mask;
+
+  value &= ~UINT64_C (0) >> (64 - bits);
+  if (endian == IOS_ENDIAN_LSB)
+    value = ios_lsb_encode (value, bits);
+
+  /* Align the integer, and the mask covering it, to the most
+     significant bit.  They get shifted into the window below, the
+     bits falling out of it going to the ninth byte.  */
+  w = value << (64 - bits);
+  mask = ~UINT64_C (0) << (64 - bits);
+
+  /* The bits surrounding the integer in its first and last bytes are
+     preserved, so the covering bytes are read first.  */
+  if ((shift != 0 || bits % 8 != 0)
+      && ios_dev_pread (io, flags, c, nbytes, offset / 8) == IOD_EOF)
+    return IOS_EIOFF;
+
+  ios_store_be64 (c, (ios_load_be64 (c) & ~(mask >> shift)) | w >> shift);
+  c[8] = ((c[8] & ~(uint8_t) (mask << (8 - shift)))
+          | (uint8_t) (w << (8 - shift)));
 
-  default:
-    assert (0);
-  }
+  if (ios_dev_pwrite (io, flags, c, nbytes, offset / 8) == IOD_EOF)
+    return IOS_EIOFF;
+  return IOS_OK;
 }
 
 int
@@ -1456,16 +1022,8 @@ ios_write_int (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
-  /* Fast track for byte-aligned 8x bits  */
-  if (offset % 8 == 0 && bits % 8 == 0)
-    return ios_write_int_fast (io, offset, flags, bits, endian, value);
-
-  /* Shift the sign bit right.  */
-  int unused_bits = 64 - bits;
-  uint64_t uvalue = ((uint64_t) (value << unused_bits)) >> unused_bits;
-
-  /* Fall into the case for the unaligned and the sizes other than 8x.  */
-  return ios_write_int_common (io, offset, flags, bits, endian, uvalue);
+  return ios_write_int_common (io, offset, flags, bits, endian,
+                               (uint64_t) value);
 }
 
 int
@@ -1477,11 +1035,6 @@ ios_write_uint (ios io, ios_off offset, int flags,
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
 
-  /* Fast track for byte-aligned 8x bits  */
-  if (offset % 8 == 0 && bits % 8 == 0)
-    return ios_write_int_fast (io, offset, flags, bits, endian, value);
-
-  /* Fall into the case for the unaligned and the sizes other than 8x.  */
   return ios_write_int_common (io, offset, flags, bits, endian, value);
 }
 
@@ -1502,8 +1055,8 @@ ios_write_string (ios io, ios_off offset, int flags,
       p = value;
       do
         {
-          if (io->dev_if->pwrite (io->dev, p, 1,
-                                  offset / 8 + p - value) == IOD_EOF)
+          if (ios_dev_pwrite (io, flags, p, 1,
+                              offset / 8 + p - value) == IOD_EOF)
             return IOS_EIOFF;
         }
       while (*(p++) != '\0');
@@ -1532,14 +1085,312 @@ ios_write_string (ios io, ios_off offset, int flags,
   return IOS_OK;
 }
 
+int
+ios_write_bytes (ios io, ios_off offset, int flags,
+                 const void *buf, size_t count)
+{
+  const uint8_t *bytes = buf;
+  uint8_t *c;
+  uint8_t first, last;
+  int shift, ret;
+  size_t i;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  if (count == 0)
+    return IOS_OK;
+
+  /* This is the fast case: the range is aligned to a byte boundary
+     and we can write it to the IOD in one go.  */
+  if (offset % 8 == 0)
+    return (ios_dev_pwrite (io, flags, buf, count, offset / 8) == IOD_EOF
+            ? IOS_EIOFF : IOS_OK);
+
+  /* The range is not aligned to a byte boundary, so it spans COUNT + 1
+     bytes in the IOD.  The leading bits of the first byte and the
+     trailing bits of the last byte must be preserved.  */
+  shift = offset % 8;
+  if (ios_dev_pread (io, flags, &first, 1, offset / 8) == IOD_EOF
+      || ios_dev_pread (io, flags, &last, 1, offset / 8 + count) == IOD_EOF)
+    return IOS_EIOFF;
+
+  c = malloc (count + 1);
+  if (!c)
+    return IOS_ENOMEM;
+
+  c[0] = (first & (0xff << (8 - shift))) | (bytes[0] >> shift);
+  for (i = 1; i < count; ++i)
+    c[i] = (bytes[i - 1] << (8 - shift)) | (bytes[i] >> shift);
+  c[count] = (bytes[count - 1] << (8 - shift)) | (last & (0xff >> shift));
+
+  ret = (ios_dev_pwrite (io, flags, c, count + 1, offset / 8) == IOD_EOF
+         ? IOS_EIOFF : IOS_OK);
+  free (c);
+  return ret;
+}
+
+/* Size of the buffer used by ios_copy to copy ranges between IO
+   spaces whose devices can't copy them by themselves.  */
+
+#define IOS_COPY_BUFSIZ (1024 * 1024)
+
+/* Have the device of TO_IO copy the range from the file operated by
+   the device of FROM_IO.  The offsets are byte offsets in the
+   devices.  Return IOS_EINVAL if the devices can't do that.  */
+
+static int
+ios_copy_dev (ios from_io, ios_dev_off from, ios to_io, ios_dev_off to,
+              uint64_t count)
+{
+  uint64_t start;
+  int fd, ret;
+
+  if (from_io->dev_if->get_fd == NULL
+      || to_io->dev_if->copy == NULL
+      || from_io->trans || to_io->trans
+      || (fd = from_io->dev_if->get_fd (from_io->dev)) == -1)
+    return IOS_EINVAL;
+
+  /* The devices must see the data modified through the caches, and
+     the destination range must not be cached anymore.  */
+  if (from_io->cache
+      && (ret = ios_cache_writeback (from_io->cache)) != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+  if (to_io->cache
+      && (ret = ios_cache_sync (to_io->cache, to, count)) != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+
+  start = ios_stats_start ();
+  ret = to_io->dev_if->copy (to_io->dev, to, fd, from, count);
+  ios_stats_read (&from_io->stats, count, 0);
+  ios_stats_write (&to_io->stats, count, start);
+
+  switch (ret)
+    {
+    case IOD_OK: return IOS_OK;
+    case IOD_EINVAL: return IOS_EINVAL;
+    case IOD_EOF: return IOS_EIOFF;
+    default:
+      return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+}
+
+int
+ios_copy (ios from_io, ios_off from, ios to_io, ios_off to, uint64_t count)
+{
+  ios_off from_dev = from + ios_get_bias (from_io);
+  ios_off to_dev = to + ios_get_bias (to_io);
+  int overlap_p = (from_io == to_io
+                   && from_dev < to_dev + count * 8
+                   && to_dev < from_dev + count * 8);
+  uint8_t *buf;
+  uint64_t done;
+  int ret = IOS_OK;
+
+  if (count == 0 || (from_io == to_io && from_dev == to_dev))
+    return IOS_OK;
+
+  if (from_dev % 8 == 0 && to_dev % 8 == 0 && !overlap_p)
+    {
+      ret = ios_copy_dev (from_io, from_dev / 8, to_io, to_dev / 8, count);
+      if (ret != IOS_EINVAL)
+        return ret;
+    }
+
+  buf = malloc (count < IOS_COPY_BUFSIZ ? count : IOS_COPY_BUFSIZ);
+  if (!buf)
+    return IOS_ENOMEM;
+
+  /* Copy the range in chunks.  If the destination overlaps the end of
+     the source, start by the end, so no byte is overwritten before
+     being copied.  */
+  for (done = 0; done < count; done += IOS_COPY_BUFSIZ)
+    {
+      uint64_t n = (count - done < IOS_COPY_BUFSIZ
+                    ? count - done : IOS_COPY_BUFSIZ);
+      uint64_t skip = (overlap_p && to_dev > from_dev
+                       ? count - done - n : done);
+
+      if ((ret = ios_read_bytes (from_io, from + skip * 8, 0 /* flags */,
+                                 buf, n)) != IOS_OK
+          || (ret = ios_write_bytes (to_io, to + skip * 8, 0 /* flags */,
+                                     buf, n)) != IOS_OK)
+        break;
+    }
+
+  free (buf);
+  return ret;
+}
+
 uint64_t
 ios_size (ios io)
 {
-  return io->dev_if->size (io->dev) * 8;
+  ios_dev_off size = io->dev_if->size (io->dev);
+
+  /* Writes done during a transaction may have extended the space.  */
+  if (io->trans)
+    {
+      ios_dev_off end = ios_trans_end (io->trans);
+
+      if (end > size)
+        size = end;
+    }
+
+  return size * 8;
 }
 
 int
 ios_flush (ios io, ios_off offset)
 {
+  if (io->cache)
+    {
+      int ret = ios_cache_writeback (io->cache);
+
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
   return io->dev_if->flush (io->dev, offset / 8);
 }
+
+int
+ios_advise (ios io, ios_off offset, ios_off size, int advice)
+{
+  ios_dev_off begin, count;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+  if (offset < 0)
+    return IOS_EINVAL;
+
+  begin = offset / 8;
+  count = size == 0 ? 0 : (offset + size + 7) / 8 - begin;
+
+  /* Load the needed data in the cache right away.  Devices
+     supporting batched reads get all the blocks requested at
+     once.  */
+  if (advice == IOS_ADVICE_WILLNEED && io->cache && count > 0)
+    {
+      struct ios_dev_read_req req;
+
+      req.offset = begin;
+      req.buf = NULL;
+      req.count = count;
+      ios_cache_prefetch (io->cache, &req, 1);
+    }
+
+  if (io->dev_if->advise == NULL)
+    return IOS_OK;
+
+  return IOD_ERROR_TO_IOS_ERROR (io->dev_if->advise (io->dev, begin,
+                                                     count, advice));
+}
+
+int
+ios_transaction_begin (ios io)
+{
+  if (io->trans)
+    return IOS_EINVAL;
+
+  /* Otherwise the writes would only fail when committing.  Note
+     that some devices are writable despite not reporting any
+     mode.  */
+  if ((ios_flags (io) & IOS_M_RDWR) == IOS_M_RDONLY)
+    return IOS_EFLAGS;
+
+  io->trans = ios_trans_new ();
+  return io->trans ? IOS_OK : IOS_ENOMEM;
+}
+
+static int
+ios_transaction_pread (void *data, void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  return ios_dev_pread_1 ((ios) data, 0 /* flags */, buf, count, offset);
+}
+
+static int
+ios_transaction_pwrite (void *data, const void *buf, size_t count,
+                        ios_dev_off offset)
+{
+  return ios_dev_pwrite_1 ((ios) data, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_transaction_commit (ios io)
+{
+  struct ios_trans *trans = io->trans;
+  int ret;
+
+  if (trans == NULL)
+    return IOS_EINVAL;
+
+  io->trans = NULL;
+  ret = ios_trans_commit (trans, ios_transaction_pread,
+                          ios_transaction_pwrite, io);
+  ios_trans_free (trans);
+
+  return ret == IOD_EOF ? IOS_EIOFF : IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+int
+ios_transaction_rollback (ios io)
+{
+  if (io->trans == NULL)
+    return IOS_EINVAL;
+
+  ios_trans_free (io->trans);
+  io->trans = NULL;
+  return IOS_OK;
+}
+
+int
+ios_transaction_p (ios io)
+{
+  return io->trans != NULL;
+}
+
+int
+ios_read_raw (ios io, void *buf, size_t count, uint64_t offset)
+{
+  return ios_dev_pread (io, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_write_raw (ios io, const void *buf, size_t count, uint64_t offset)
+{
+  return ios_dev_pwrite (io, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_blocking_p (ios io)
+{
+  return (io->dev_if->blocking_p
+          && io->dev_if->blocking_p (io->dev));
+}
+
+int
+ios_commit_changes (ios io)
+{
+  int ret;
+
+  if (io->dev_if->commit == NULL)
+    return IOS_EINVAL;
+
+  ret = io->dev_if->commit (io->dev);
+  return ret == IOD_EOF ? IOS_EIOFF : IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+int
+ios_export_changes (ios io,
+                    int (*write) (void *data, const void *buf,
+                                  size_t count, uint64_t offset),
+                    void *data)
+{
+  if (io->dev_if->export_changes == NULL)
+    return IOS_EINVAL;
+
+  return IOD_ERROR_TO_IOS_ERROR (io->dev_if->export_changes (io->dev,
+                                                             write, data));
+}
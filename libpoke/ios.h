@@ -20,6 +20,7 @@
 #define IOS_H
 
 #include <config.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -100,6 +101,8 @@ typedef int64_t ios_off;
 
 #define IOS_EOPEN  -7  /* IO space is already open.  */
 
+#define IOS_ETOOLONG -8 /* String exceeds the maximum length.  */
+
 #define IOD_ERROR_TO_IOS_ERROR(error_no) (error_no)
 
 /* **************** IOS flags ******************************
@@ -126,6 +129,28 @@ typedef int64_t ios_off;
 #define IOS_M_WRONLY (IOS_F_WRITE)
 #define IOS_M_RDWR (IOS_F_READ | IOS_F_WRITE)
 
+/* IOD-specific flags for memory buffers.
+
+   IOS_F_MEM_SPARSE makes the buffer sparse: its contents are stored
+   in pages that are allocated when first written to, and the pages
+   that were never written read as zeros.
+
+   The size of a new buffer, in units of 4096 bytes, can be stored in
+   the bits selected by IOS_F_MEM_SIZE_MASK.  If it is zero, the
+   buffer is 4096 bytes long.  */
+
+#define IOS_F_MEM_SPARSE ((uint64_t) 1 << 32)
+#define IOS_F_MEM_SIZE_SHIFT 40
+#define IOS_F_MEM_SIZE_MASK ((uint64_t) 0xffffff << IOS_F_MEM_SIZE_SHIFT)
+
+/* IOD-specific flags for files.
+
+   IOS_F_FILE_MMAP asks for the file to be mapped in memory, if it
+   can be.  Otherwise the file is accessed with plain reads and
+   writes.  */
+
+#define IOS_F_FILE_MMAP ((uint64_t) 1 << 33)
+
 /* **************** IO space collection API ****************
 
    The collection of open IO spaces are organized in a global list.
@@ -236,6 +261,130 @@ ios_off ios_get_bias (ios io);
 
 void ios_set_bias (ios io, ios_off bias);
 
+/* **************** IOS cache ****************************
+
+   IO spaces operating on devices that benefit from it keep a cache
+   of fixed-size blocks of the device.  Blocks are read from the
+   device on demand, and evicted in least-recently-used order when
+   the budget of the cache is exhausted.  Modifications to cached
+   blocks are written back to the device when the blocks are
+   evicted, and when the IO space is flushed or closed.
+
+   The contents of some devices, like the memory of processes, may
+   change behind the back of poke.  The cache of the IO spaces
+   operating on them is disabled until a size is set for it.
+
+   The following functions get and set the budget of the cache of a
+   given IO space, in bytes.  ios_get_cache_size returns 0 if the IO
+   space doesn't have a cache.  ios_set_cache_size writes back and
+   drops all the cached blocks, and returns IOS_EINVAL if the IO
+   space doesn't have a cache.  Setting a size of zero disables the
+   cache.  */
+
+size_t ios_get_cache_size (ios io);
+
+int ios_set_cache_size (ios io, size_t size);
+
+/* Statistics about the accesses to an IO space.
+
+   READS and WRITES are the number of read and write requests that
+   were performed on the underlying IO device, and BYTES_READ and
+   BYTES_WRITTEN the number of bytes transferred by them.  Requests
+   served by the cache of the IO space are not counted there:
+   CACHE_HITS and CACHE_MISSES are the number of block lookups in the
+   cache that were served from it and that required to read from the
+   device, CACHE_WRITES is the number of writes absorbed by the cache
+   and DIRTY the number of modified bytes in the cache that are
+   pending to be written back.  NSECS is the time spent in the device
+   requests, in nanoseconds, which is only measured while timing is
+   enabled with ios_set_stats_timing.  */
+
+struct ios_stats
+{
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_writes;
+  uint64_t dirty;
+  uint64_t nsecs;
+};
+
+/* Get the statistics of the given IO space in *STATS.  */
+
+void ios_get_stats (ios io, struct ios_stats *stats);
+
+/* Reset the statistics of the given IO space, including the ones
+   of its cache.  */
+
+void ios_reset_stats (ios io);
+
+/* Get and set whether the time spent in the requests to the IO
+   devices is measured.  This is disabled by default, since it
+   requires reading the clock around every device request.  */
+
+int ios_get_stats_timing (void);
+
+void ios_set_stats_timing (int timing_p);
+
+/* The IO spaces and their caches account the requests to the IO
+   devices with the following.  ios_stats_start returns the time at
+   which a request starts, or zero if timing is disabled.
+   ios_stats_read and ios_stats_write account in STATS a request of
+   COUNT bytes that started at START.  */
+
+extern int ios_stats_timing;
+
+uint64_t ios_stats_clock (void);
+
+static inline uint64_t
+ios_stats_start (void)
+{
+  return ios_stats_timing ? ios_stats_clock () : 0;
+}
+
+static inline void
+ios_stats_read (struct ios_stats *stats, uint64_t count, uint64_t start)
+{
+  stats->reads++;
+  stats->bytes_read += count;
+  if (start)
+    stats->nsecs += ios_stats_clock () - start;
+}
+
+static inline void
+ios_stats_write (struct ios_stats *stats, uint64_t count, uint64_t start)
+{
+  stats->writes++;
+  stats->bytes_written += count;
+  if (start)
+    stats->nsecs += ios_stats_clock () - start;
+}
+
+/* **************** IOS access hints ********************
+
+   IO spaces can be told in advance about the way some range of
+   them is going to be accessed, so the underlying IO device can
+   prepare for it.  The hints are one of the following values.  */
+
+#define IOS_ADVICE_NORMAL     0 /* No particular access pattern.  */
+#define IOS_ADVICE_SEQUENTIAL 1 /* Accessed from lower to higher
+                                   offsets.  */
+#define IOS_ADVICE_WILLNEED   2 /* Accessed in the near future.  */
+
+/* Advise the given IO space that the SIZE bits starting at OFFSET
+   are going to be accessed as described by ADVICE.  A SIZE of zero
+   means up to the end of the IO space.  The advice may be ignored
+   by the IO space.
+
+   If the range is going to be needed and the IO space is cached, as
+   much of it as fits in half the cache is read into the cache right
+   away, with a single batched read if the IO device supports it.  */
+
+int ios_advise (ios io, ios_off offset, ios_off size, int advice);
+
 /* **************** Object read/write API ****************  */
 
 /* An integer with flags is passed to the read/write operations,
@@ -244,7 +393,8 @@ void ios_set_bias (ios io, ios_off bias);
 #define IOS_F_BYPASS_CACHE  1  /* Bypass the IO space cache.  This
                                   makes this write operation to
                                   immediately write to the underlying
-                                  IO device.  */
+                                  IO device, and this read operation
+                                  to get fresh data from it.  */
 
 #define IOS_F_BYPASS_UPDATE 2  /* Do not call update hooks that would
                                   be triggered by this write
@@ -307,10 +457,42 @@ int ios_read_uint (ios io, ios_off offset, int flags,
 
 /* Read a NULL-terminated string of bytes located at the given OFFSET,
    and put its value in VALUE.  It is up to the caller to free the
-   memory occupied by the returned string, when no longer needed.  */
+   memory occupied by the returned string, when no longer needed.
+
+   If the string is longer than the maximum length set by
+   ios_set_string_max, return IOS_ETOOLONG.  */
 
 int ios_read_string (ios io, ios_off offset, int flags, char **value);
 
+/* Get and set the maximum length, in bytes and not including the
+   terminating NULL character, of the strings read by ios_read_string.
+   Zero means there is no limit, which is the default.  */
+
+uint64_t ios_get_string_max (void);
+
+void ios_set_string_max (uint64_t max);
+
+/* Read COUNT bytes located at the given OFFSET and put them in BUF.
+   OFFSET doesn't need to be aligned to a byte boundary, but aligned
+   ranges are read from the IO device in a single operation.  */
+
+int ios_read_bytes (ios io, ios_off offset, int flags,
+                    void *buf, size_t count);
+
+/* Read COUNT unsigned integers of size BITS, stored one after the
+   other starting at the given OFFSET, from the space IO into VALUES.
+   Use the byte endianness ENDIAN when reading the values.
+
+   BITS shall be 8, 16, 32 or 64, and VALUES point to an array of
+   COUNT uint8_t, uint16_t, uint32_t or uint64_t respectively.  The
+   integers are read from the IO device in a single operation if
+   OFFSET is aligned to a byte boundary.  */
+
+int ios_read_uint_array (ios io, ios_off offset, int flags,
+                         int bits,
+                         enum ios_endian endian,
+                         void *values, size_t count);
+
 /* Write the signed integer of size BITS in VALUE to the space IO, at
    the given OFFSET.  Use the byte endianness ENDIAN and encoding NENC
    when writing the value.  */
@@ -335,6 +517,26 @@ int ios_write_uint (ios io, ios_off offset, int flags,
 
 int ios_write_string (ios io, ios_off offset, int flags, const char *value);
 
+/* Copy COUNT bytes starting at the offset FROM of the space FROM_IO
+   to the offset TO of the space TO_IO.  If both ranges are in the
+   same space and overlap, the bytes are copied as if they were first
+   copied to a temporary buffer.
+
+   If both spaces are operated by devices that can copy ranges
+   between them, and the offsets are aligned to a byte boundary, the
+   bytes don't go through the IO spaces.  Otherwise they are read
+   and written in big chunks.  */
+
+int ios_copy (ios from_io, ios_off from, ios to_io, ios_off to,
+              uint64_t count);
+
+/* Write the COUNT bytes in BUF to the space IO, at the given OFFSET.
+   OFFSET doesn't need to be aligned to a byte boundary, but aligned
+   ranges are written to the IO device in a single operation.  */
+
+int ios_write_bytes (ios io, ios_off offset, int flags,
+                     const void *buf, size_t count);
+
 /* If the current IOD is a write stream, write out the data in the buffer
    till OFFSET.  If the current IOD is a stream IOD, free (if allowed by the
    embedded buffering strategy) bytes up to OFFSET.  This function has no
@@ -351,6 +553,81 @@ int ios_flush (ios io, ios_off offset);
 
 /* **************** Transaction API **************** */
 
-/* XXX: writeme.  */
+/* While a transaction is in progress in an IO space, the writes to
+   the space are recorded in an overlay in memory instead of being
+   performed on the underlying IO device.  Reads see the modified
+   contents.
+
+   Committing the transaction writes the overlay to the device, a
+   single write per contiguous modified range in ascending order of
+   offset, whereas rolling it back discards the overlay and leaves
+   the device untouched.  Closing an IO space rolls back its
+   transaction, if any.
+
+   Transactions don't nest.  */
+
+/* Begin a transaction in IO.  Return IOS_EINVAL if a transaction is
+   already in progress, and IOS_EFLAGS if IO is not writable.  */
+
+int ios_transaction_begin (ios io);
+
+/* Commit the transaction in progress in IO.  Return IOS_EINVAL if
+   there is no transaction in progress.  If writing to the device
+   fails, restore the previous contents of the ranges already
+   written, as far as the device allows, and return an error code.
+   Note that in that case the transaction is terminated anyway.  */
+
+int ios_transaction_commit (ios io);
+
+/* Roll back the transaction in progress in IO.  Return IOS_EINVAL if
+   there is no transaction in progress.  */
+
+int ios_transaction_rollback (ios io);
+
+/* Return 1 if a transaction is in progress in IO, 0 otherwise.  */
+
+int ios_transaction_p (ios io);
+
+/* **************** Stacking API **************** */
+
+/* Some IO devices operate on top of other IO spaces.  For example,
+   the copy-on-write devices, whose handlers have the form cow:N,
+   keep the changes to the IO space with id N in memory, until they
+   are committed.  */
+
+/* Read COUNT bytes at the byte offset OFFSET of IO into BUF, or
+   write COUNT bytes from BUF at that offset.  The accesses go
+   through the cache and the transaction of IO, but ignore its bias.
+   These functions return IOD_* error codes, and are meant to be used
+   by IO devices operating on top of IO.  */
+
+int ios_read_raw (ios io, void *buf, size_t count, uint64_t offset);
+
+int ios_write_raw (ios io, const void *buf, size_t count,
+                   uint64_t offset);
+
+/* Return 1 if reading beyond the data available so far in IO may
+   block waiting for more input, 0 otherwise.  Devices operating on
+   top of IO shall report the same.  */
+
+int ios_blocking_p (ios io);
+
+/* Write the changes kept by the device of IO to the IO space it
+   operates on, and forget them.  Return IOS_EINVAL if the device
+   doesn't keep changes.  If writing fails, return an error code and
+   keep the changes.  */
+
+int ios_commit_changes (ios io);
+
+/* Call WRITE for each range of bytes changed by the device of IO, in
+   ascending order of offset, passing DATA along with the bytes,
+   their count and their byte offset.  Return IOS_EINVAL if the
+   device doesn't keep changes, or the first error returned by WRITE,
+   which shall return IOS_OK on success.  */
+
+int ios_export_changes (ios io,
+                        int (*write) (void *data, const void *buf,
+                                      size_t count, uint64_t offset),
+                        void *data);
 
 #endif /* ! IOS_H */
@@ -524,6 +524,132 @@ pk_ios_size (pk_ios io)
   return ios_size ((ios) io);
 }
 
+uint64_t
+pk_ios_cache_size (pk_ios io)
+{
+  return ios_get_cache_size ((ios) io);
+}
+
+int
+pk_ios_set_cache_size (pk_ios io, uint64_t size)
+{
+  switch (ios_set_cache_size ((ios) io, size))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    case IOS_ENOMEM: return PK_ENOMEM;
+    default:
+      return PK_ERROR;
+    }
+}
+
+void
+pk_ios_get_stats (pk_ios io, struct pk_ios_stats *stats)
+{
+  struct ios_stats s;
+
+  ios_get_stats ((ios) io, &s);
+  stats->reads = s.reads;
+  stats->writes = s.writes;
+  stats->bytes_read = s.bytes_read;
+  stats->bytes_written = s.bytes_written;
+  stats->cache_hits = s.cache_hits;
+  stats->cache_misses = s.cache_misses;
+  stats->cache_writes = s.cache_writes;
+  stats->dirty = s.dirty;
+  stats->nsecs = s.nsecs;
+}
+
+void
+pk_ios_reset_stats (pk_ios io)
+{
+  ios_reset_stats ((ios) io);
+}
+
+int
+pk_ios_transaction_begin (pk_ios io)
+{
+  switch (ios_transaction_begin ((ios) io))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    case IOS_EFLAGS: return PK_EINVAL;
+    case IOS_ENOMEM: return PK_ENOMEM;
+    default:
+      return PK_ERROR;
+    }
+}
+
+int
+pk_ios_transaction_commit (pk_ios io)
+{
+  switch (ios_transaction_commit ((ios) io))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    default:
+      return PK_ERROR;
+    }
+}
+
+int
+pk_ios_transaction_rollback (pk_ios io)
+{
+  switch (ios_transaction_rollback ((ios) io))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    default:
+      return PK_ERROR;
+    }
+}
+
+int
+pk_ios_commit_changes (pk_ios io)
+{
+  switch (ios_commit_changes ((ios) io))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    default:
+      return PK_ERROR;
+    }
+}
+
+struct ios_export_payload
+{
+  int (*write) (void *data, const void *buf, size_t count, uint64_t offset);
+  void *data;
+};
+
+static int
+my_ios_export_fn (void *data, const void *buf, size_t count,
+                  uint64_t offset)
+{
+  struct ios_export_payload *payload = data;
+
+  if (payload->write (payload->data, buf, count, offset) != PK_OK)
+    return IOS_ERROR;
+  return IOS_OK;
+}
+
+int
+pk_ios_export_changes (pk_ios io,
+                       int (*write) (void *data, const void *buf,
+                                     size_t count, uint64_t offset),
+                       void *data)
+{
+  struct ios_export_payload payload = { write, data };
+
+  switch (ios_export_changes ((ios) io, my_ios_export_fn, &payload))
+    {
+    case IOS_OK: return PK_OK;
+    case IOS_EINVAL: return PK_EINVAL;
+    default:
+      return PK_ERROR;
+    }
+}
+
 struct ios_map_fn_payload
 {
   pk_ios_map_fn cb;
@@ -915,9 +1041,53 @@ pk_set_pretty_print (pk_compiler pkc, int pretty_print_p)
   pkc->status = PK_OK;
 }
 
+uint64_t
+pk_string_max (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return ios_get_string_max ();
+}
+
+void
+pk_set_string_max (pk_compiler pkc, uint64_t max)
+{
+  ios_set_string_max (max);
+  pkc->status = PK_OK;
+}
+
+int
+pk_lazy_maps (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_lazy_maps (pkc->vm);
+}
+
+void
+pk_set_lazy_maps (pk_compiler pkc, int lazy_maps_p)
+{
+  pvm_set_lazy_maps (pkc->vm, lazy_maps_p);
+  pkc->status = PK_OK;
+}
+
+int
+pk_ios_timing (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return ios_get_stats_timing ();
+}
+
+void
+pk_set_ios_timing (pk_compiler pkc, int timing_p)
+{
+  ios_set_stats_timing (timing_p);
+  pkc->status = PK_OK;
+}
+
 void
 pk_print_val (pk_compiler pkc, pk_val val)
 {
+  /* Elements of lazily mapped arrays are mapped as they are
+     printed.  */
   pvm_print_val (pkc->vm, val);
   pkc->status = PK_OK;
 }
@@ -314,6 +314,59 @@ char *pk_ios_get_dev_if_name (pk_ios ios) LIBPOKE_API;
 
 uint64_t pk_ios_size (pk_ios ios) LIBPOKE_API;
 
+/* Return the size of the block cache of the given IO space, in
+   bytes.  Return 0 if the IO space doesn't have a cache.  */
+
+uint64_t pk_ios_cache_size (pk_ios ios) LIBPOKE_API;
+
+/* Set the size of the block cache of the given IO space, in bytes.
+   All the cached blocks are written back to the underlying device
+   and dropped.  A size of zero disables the cache.  The cache of IO
+   spaces whose contents may change behind the back of poke, like
+   the memory of processes, is disabled until a size is set for it.
+
+   Return PK_EINVAL if the IO space doesn't have a cache, PK_ENOMEM
+   if there is not enough memory, PK_ERROR if the cached blocks
+   couldn't be written back and PK_OK otherwise.  */
+
+int pk_ios_set_cache_size (pk_ios ios, uint64_t size) LIBPOKE_API;
+
+/* Statistics about the accesses to an IO space, since it was opened
+   or since the statistics were last reset.
+
+   READS and WRITES are the number of read and write requests that
+   were performed on the underlying device, and BYTES_READ and
+   BYTES_WRITTEN the number of bytes transferred by them.  CACHE_HITS
+   and CACHE_MISSES are the number of lookups in the block cache of
+   the IO space that were served from the cache and that required to
+   read from the device.  CACHE_WRITES is the number of writes
+   absorbed by the cache and DIRTY the number of modified bytes not
+   written back yet.  NSECS is the time spent in the requests to the
+   device, in nanoseconds, which is only measured while
+   pk_set_ios_timing is enabled.  */
+
+struct pk_ios_stats
+{
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_writes;
+  uint64_t dirty;
+  uint64_t nsecs;
+};
+
+/* Get the statistics of the given IO space in *STATS.  */
+
+void pk_ios_get_stats (pk_ios ios,
+                       struct pk_ios_stats *stats) LIBPOKE_API;
+
+/* Reset the statistics of the given IO space.  */
+
+void pk_ios_reset_stats (pk_ios ios) LIBPOKE_API;
+
 /* Return the flags which are active in a given IOS.  */
 
 #define PK_IOS_F_READ     1
@@ -346,6 +399,60 @@ int pk_ios_open (pk_compiler pkc,
 
 void pk_ios_close (pk_compiler pkc, pk_ios ios) LIBPOKE_API;
 
+/* Begin a transaction in the given IO space.  While the transaction
+   is in progress, writes to the space are kept in memory instead of
+   being performed on the underlying device.
+
+   Return PK_EINVAL if a transaction is already in progress in the
+   space or the space is not writable, PK_ENOMEM if there is not
+   enough memory and PK_OK otherwise.  */
+
+int pk_ios_transaction_begin (pk_ios ios) LIBPOKE_API;
+
+/* Commit the transaction in progress in the given IO space, writing
+   the modified data to the underlying device in as few operations
+   as possible.
+
+   If writing to the device fails, the ranges already written are
+   restored to their previous contents, as far as the device allows.
+
+   Return PK_EINVAL if there is no transaction in progress in the
+   space, PK_ERROR if writing to the device failed and PK_OK
+   otherwise.  */
+
+int pk_ios_transaction_commit (pk_ios ios) LIBPOKE_API;
+
+/* Roll back the transaction in progress in the given IO space,
+   discarding the data written during it.
+
+   Return PK_EINVAL if there is no transaction in progress in the
+   space and PK_OK otherwise.  */
+
+int pk_ios_transaction_rollback (pk_ios ios) LIBPOKE_API;
+
+/* Write the changes kept by the given IO space to the IO space it
+   operates on, and forget them.  Only copy-on-write overlays, opened
+   with handlers like cow:N, keep changes.
+
+   Return PK_EINVAL if the space doesn't keep changes, PK_ERROR if
+   writing failed, in which case the changes are kept, and PK_OK
+   otherwise.  */
+
+int pk_ios_commit_changes (pk_ios ios) LIBPOKE_API;
+
+/* Call WRITE for each range of bytes changed in the given IO space,
+   in ascending order of offset, passing DATA along with the bytes,
+   their count and their byte offset.  WRITE shall return PK_OK on
+   success.
+
+   Return PK_EINVAL if the space doesn't keep changes, PK_ERROR if
+   WRITE failed and PK_OK otherwise.  */
+
+int pk_ios_export_changes (pk_ios ios,
+                           int (*write) (void *data, const void *buf,
+                                         size_t count, uint64_t offset),
+                           void *data) LIBPOKE_API;
+
 /* Map over all the IO spaces in a given incremental compiler,
    executing a handler.  */
 
@@ -473,6 +580,25 @@ void pk_set_nenc (pk_compiler pkc, enum pk_nenc nenc) LIBPOKE_API;
 int pk_pretty_print (pk_compiler pkc) LIBPOKE_API;
 void pk_set_pretty_print (pk_compiler pkc, int pretty_print_p) LIBPOKE_API;
 
+/* Maximum length of the strings mapped from IO spaces, in bytes.
+   Zero means no limit.  */
+
+uint64_t pk_string_max (pk_compiler pkc) LIBPOKE_API;
+void pk_set_string_max (pk_compiler pkc, uint64_t max) LIBPOKE_API;
+
+/* Whether to map the elements of arrays lazily, i.e. the first time
+   they are referenced.  Only arrays of structs or arrays whose size
+   is known at compile-time are mapped lazily.  */
+
+int pk_lazy_maps (pk_compiler pkc) LIBPOKE_API;
+void pk_set_lazy_maps (pk_compiler pkc, int lazy_maps_p) LIBPOKE_API;
+
+/* Whether to measure the time spent in the requests to the devices
+   of the IO spaces, which is reported by pk_ios_get_stats.  */
+
+int pk_ios_timing (pk_compiler pkc) LIBPOKE_API;
+void pk_set_ios_timing (pk_compiler pkc, int timing_p) LIBPOKE_API;
+
 /*** API for manipulating Poke values.  ***/
 
 /* PK_NULL is an invalid pk_val.
@@ -676,7 +802,11 @@ pk_val pk_array_nelem (pk_val array) LIBPOKE_API;
    ARRAY is the array value.
    IDX is the index of the element in the array.
 
-   If IDX is invalid, PK_NULL is returned. */
+   Elements of lazily mapped arrays that have not been mapped yet are
+   mapped first.
+
+   If IDX is invalid, or if the element cannot be mapped, PK_NULL is
+   returned.  */
 
 pk_val pk_array_elem_val (pk_val array, uint64_t idx) LIBPOKE_API;
 
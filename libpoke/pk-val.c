@@ -235,7 +235,7 @@ pk_val pk_struct_field_name (pk_val sct, uint64_t idx)
 void pk_struct_set_field_name (pk_val sct, uint64_t idx, pk_val name)
 {
   if (idx < pk_uint_value (pk_struct_nfields (sct)))
-    PVM_VAL_SCT_FIELD_NAME (sct, idx) = name;
+    pvm_set_struct_field_name (sct, idx, name);
 }
 
 pk_val pk_struct_field_value (pk_val sct, uint64_t idx)
@@ -401,8 +401,9 @@ pk_array_nelem (pk_val array)
 pk_val
 pk_array_elem_val (pk_val array, uint64_t idx)
 {
+  /* Elements of lazily mapped arrays are mapped on access.  */
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_VALUE (array, idx);
+    return pvm_array_elem_value_mapped (array, idx);
   else
     return PK_NULL;
 }
@@ -423,7 +424,7 @@ pk_val
 pk_array_elem_boffset (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_OFFSET (array, idx);
+    return pvm_array_elem_offset (array, idx);
   else
     return PK_NULL;
 }
@@ -432,5 +433,5 @@ void
 pk_array_set_elem_boffset (pk_val array, uint64_t idx, pk_val boffset)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    PVM_VAL_ARR_ELEM_OFFSET (array, idx) = boffset;
+    pvm_array_set_elem_offset (array, idx, boffset);
 }
@@ -435,6 +435,52 @@ pkl_asm_insn_peekd (pkl_asm pasm, pkl_ast_node type)
     assert (0);
 }
 
+/* Macro-instruction: PEEKA type, endian
+   ( ARR IOS BOFF NELEM -- ARR )
+
+   Generate code for peeking NELEM elements of TYPE, which should be
+   an integral type, and appending them to ARR.  */
+
+static void
+pkl_asm_insn_peeka (pkl_asm pasm, pkl_ast_node type,
+                    unsigned int endian)
+{
+  int type_code = PKL_AST_TYPE_CODE (type);
+
+  if (type_code == PKL_TYPE_INTEGRAL)
+    {
+      size_t size = PKL_AST_TYPE_I_SIZE (type);
+      int sign = PKL_AST_TYPE_I_SIGNED_P (type);
+
+      pkl_asm_insn (pasm, sign ? PKL_INSN_PEEKAI : PKL_INSN_PEEKAIU,
+                    endian, (unsigned int) size);
+    }
+  else
+    assert (0);
+}
+
+/* Macro-instruction: PEEKDA type
+   ( ARR IOS BOFF NELEM -- ARR )
+
+   Like PEEKA, but use the current endianness.  */
+
+static void
+pkl_asm_insn_peekda (pkl_asm pasm, pkl_ast_node type)
+{
+  int type_code = PKL_AST_TYPE_CODE (type);
+
+  if (type_code == PKL_TYPE_INTEGRAL)
+    {
+      size_t size = PKL_AST_TYPE_I_SIZE (type);
+      int sign = PKL_AST_TYPE_I_SIGNED_P (type);
+
+      pkl_asm_insn (pasm, sign ? PKL_INSN_PEEKDAI : PKL_INSN_PEEKDAIU,
+                    (unsigned int) size);
+    }
+  else
+    assert (0);
+}
+
 /* Macro-instruction: PRINT type
    ( OBASE VAL -- )
 */
@@ -945,6 +991,31 @@ pkl_asm_insn_afill (pkl_asm pasm)
   RAS_MACRO_AFILL;
 }
 
+/* Macro-instruction: AREF
+   ( ARR ULONG -- ARR ULONG VAL )
+
+   Given an array and an index, push the element of the array
+   occupying that position, mapping it first if the array is mapped
+   lazily and the element has not been mapped yet.  */
+
+static void
+pkl_asm_insn_aref (pkl_asm pasm)
+{
+  RAS_MACRO_AREF;
+}
+
+/* Macro-instruction: AMAP
+   ( VAL -- VAL )
+
+   Given a PVM value on the TOS, map all the pending elements of the
+   lazily mapped arrays contained in it.  */
+
+static void
+pkl_asm_insn_amap (pkl_asm pasm)
+{
+  RAS_MACRO_AMAP;
+}
+
 /* Macro-instruction: ATRIM array_type
    ( ARR ULONG ULONG -- ARR ULONG ULONG ARR )
 
@@ -1390,6 +1461,30 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
               pkl_asm_insn_poked (pasm, integral_type);
             break;
           }
+        case PKL_INSN_PEEKA:
+          {
+            pkl_ast_node type;
+            unsigned int endian;
+
+            va_start (valist, insn);
+            type = va_arg (valist, pkl_ast_node);
+            endian = va_arg (valist, unsigned int);
+            va_end (valist);
+
+            pkl_asm_insn_peeka (pasm, type, endian);
+            break;
+          }
+        case PKL_INSN_PEEKDA:
+          {
+            pkl_ast_node type;
+
+            va_start (valist, insn);
+            type = va_arg (valist, pkl_ast_node);
+            va_end (valist);
+
+            pkl_asm_insn_peekda (pasm, type);
+            break;
+          }
         case PKL_INSN_BZ:
           {
             pkl_ast_node type;
@@ -1556,6 +1651,12 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
         case PKL_INSN_AFILL:
           pkl_asm_insn_afill (pasm);
           break;
+        case PKL_INSN_AREF:
+          pkl_asm_insn_aref (pasm);
+          break;
+        case PKL_INSN_AMAP:
+          pkl_asm_insn_amap (pasm);
+          break;
         case PKL_INSN_SSETI:
           {
             pkl_ast_node struct_type;
@@ -1037,6 +1037,87 @@ pkl_ast_sizeof_type (pkl_ast ast, pkl_ast_node type)
   return res;
 }
 
+/* Return the size in bits of the values of type TYPE, if it is known
+   at compile-time and it is the same for all the values of the type.
+   Return 0 otherwise.
+
+   Unlike pkl_ast_sizeof_type, this function doesn't require TYPE to
+   be complete, and it takes into account that the fields of pinned
+   structs and unions are not consecutive in IO.  */
+
+uint64_t
+pkl_ast_type_static_size (pkl_ast_node type)
+{
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      return PKL_AST_TYPE_I_SIZE (type);
+    case PKL_TYPE_OFFSET:
+      return pkl_ast_type_static_size (PKL_AST_TYPE_O_BASE_TYPE (type));
+    case PKL_TYPE_ARRAY:
+      {
+        pkl_ast_node bound = PKL_AST_TYPE_A_BOUND (type);
+        uint64_t esize, nelem;
+
+        if (!bound
+            || PKL_AST_CODE (bound) != PKL_AST_INTEGER
+            || PKL_AST_TYPE_CODE (PKL_AST_TYPE (bound)) != PKL_TYPE_INTEGRAL)
+          return 0;
+
+        esize = pkl_ast_type_static_size (PKL_AST_TYPE_A_ETYPE (type));
+        nelem = PKL_AST_INTEGER_VALUE (bound);
+        if (esize == 0 || nelem > UINT64_MAX / esize)
+          return 0;
+
+        return esize * nelem;
+      }
+    case PKL_TYPE_STRUCT:
+      {
+        pkl_ast_node elem;
+        uint64_t size = 0;
+        int first = 1;
+
+        if (PKL_AST_TYPE_COMPLETE (type) != PKL_AST_TYPE_COMPLETE_YES)
+          return 0;
+
+        for (elem = PKL_AST_TYPE_S_ELEMS (type);
+             elem;
+             elem = PKL_AST_CHAIN (elem))
+          {
+            uint64_t field_size;
+
+            if (PKL_AST_CODE (elem) != PKL_AST_STRUCT_TYPE_FIELD)
+              continue;
+
+            field_size
+              = pkl_ast_type_static_size (PKL_AST_STRUCT_TYPE_FIELD_TYPE (elem));
+            if (field_size == 0)
+              return 0;
+
+            if (PKL_AST_TYPE_S_UNION_P (type))
+              {
+                /* All the alternatives shall have the same size.  */
+                if (!first && field_size != size)
+                  return 0;
+                size = field_size;
+              }
+            else if (PKL_AST_TYPE_S_PINNED_P (type))
+              size = field_size > size ? field_size : size;
+            else if (field_size > UINT64_MAX - size)
+              return 0;
+            else
+              size += field_size;
+
+            first = 0;
+          }
+
+        return size;
+      }
+    default:
+      return 0;
+    }
+}
+
 /* Return 1 if the given TYPE can be mapped in IO.  0 otherwise.  */
 
 int
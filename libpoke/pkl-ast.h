@@ -1022,6 +1022,8 @@ int pkl_ast_type_promoteable_p (pkl_ast_node ft, pkl_ast_node tt,
 
 pkl_ast_node pkl_ast_sizeof_type (pkl_ast ast, pkl_ast_node type);
 
+uint64_t pkl_ast_type_static_size (pkl_ast_node type);
+
 int pkl_ast_type_is_complete (pkl_ast_node type);
 
 void pkl_ast_array_type_remove_bounders (pkl_ast_node type);
@@ -1433,6 +1435,12 @@ pkl_ast_node pkl_ast_make_incrdecr (pkl_ast ast,
 #define PKL_AST_BUILTIN_TERM_END_CLASS 20
 #define PKL_AST_BUILTIN_TERM_BEGIN_HYPERLINK 21
 #define PKL_AST_BUILTIN_TERM_END_HYPERLINK 22
+#define PKL_AST_BUILTIN_IOREAD 23
+#define PKL_AST_BUILTIN_IOWRITE 24
+#define PKL_AST_BUILTIN_IOBEGIN 25
+#define PKL_AST_BUILTIN_IOCOMMIT 26
+#define PKL_AST_BUILTIN_IOROLLBACK 27
+#define PKL_AST_BUILTIN_IOCOPY 28
 
 struct pkl_ast_comp_stmt
 {
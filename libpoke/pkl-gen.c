@@ -665,6 +665,51 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_comp_stmt)
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_FLUSH);
           break;
+        case PKL_AST_BUILTIN_IOREAD:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEEKBYTES);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
+          break;
+        case PKL_AST_BUILTIN_IOWRITE:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_POKEBYTES);
+          break;
+        case PKL_AST_BUILTIN_IOBEGIN:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOBEGIN);
+          break;
+        case PKL_AST_BUILTIN_IOCOMMIT:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOCOMMIT);
+          break;
+        case PKL_AST_BUILTIN_IOROLLBACK:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOROLLBACK);
+          break;
+        case PKL_AST_BUILTIN_IOCOPY:
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 0);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 1);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 2);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSHVAR, 0, 4);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_OGETM);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_IOCOPY);
+          break;
         case PKL_AST_BUILTIN_GET_TIME:
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_TIME);
           pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_RETURN);
@@ -2498,9 +2543,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_struct_ref)
       pkl_ast_node struct_ref_struct_type = PKL_AST_TYPE (struct_ref_struct);
       pkl_ast_node elem;
       int is_field_p = 0;
+      unsigned int field_index = 0;
 
       /* Determine whether the referred struct element is a field or a
-         declaration.  */
+         declaration, and the index of the field in the struct.  */
       for (elem = PKL_AST_TYPE_S_ELEMS (struct_ref_struct_type);
            elem;
            elem = PKL_AST_CHAIN (elem))
@@ -2517,10 +2563,19 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_struct_ref)
                   is_field_p = 1;
                   break;
                 }
+
+              field_index++;
             }
         }
 
-      pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);
+      /* Struct values contain all the fields of their type, absent
+         or not, in order, so the index of the field can be used to
+         access it directly.  This doesn't hold for unions, which
+         only contain the alternative that matched.  */
+      if (is_field_p && !PKL_AST_TYPE_S_UNION_P (struct_ref_struct_type))
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREFH, field_index);
+      else
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SREF);
       /* If the parent is a funcall and the referred field is a struct
          method, then leave both the struct and the closure.  */
       if (PKL_GEN_IN_CTX_P (PKL_GEN_CTX_IN_FUNCALL)
@@ -4044,6 +4099,9 @@ PKL_PHASE_END_HANDLER
 
 PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_op_unmap)
 {
+  /* The elements of lazily mapped arrays that have not been mapped
+     yet have to be mapped before the value gets detached from IO.  */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_AMAP);
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_UNMAP);
 }
 PKL_PHASE_END_HANDLER
@@ -423,6 +423,9 @@ token <integer> UNION    _("keyword `union'")
 %token BUILTIN_TERM_GET_BGCOLOR BUILTIN_TERM_SET_BGCOLOR
 %token BUILTIN_TERM_BEGIN_CLASS BUILTIN_TERM_END_CLASS
 %token BUILTIN_TERM_BEGIN_HYPERLINK BUILTIN_TERM_END_HYPERLINK
+%token BUILTIN_IOREAD BUILTIN_IOWRITE
+%token BUILTIN_IOBEGIN BUILTIN_IOCOMMIT BUILTIN_IOROLLBACK
+%token BUILTIN_IOCOPY
 
 /* Compiler builtins.  */
 
@@ -2022,6 +2025,12 @@ builtin:
         | BUILTIN_IOSIZE        { $$ = PKL_AST_BUILTIN_IOSIZE; }
         | BUILTIN_GETENV        { $$ = PKL_AST_BUILTIN_GETENV; }
         | BUILTIN_FORGET        { $$ = PKL_AST_BUILTIN_FORGET; }
+        | BUILTIN_IOREAD        { $$ = PKL_AST_BUILTIN_IOREAD; }
+        | BUILTIN_IOWRITE       { $$ = PKL_AST_BUILTIN_IOWRITE; }
+        | BUILTIN_IOBEGIN       { $$ = PKL_AST_BUILTIN_IOBEGIN; }
+        | BUILTIN_IOCOMMIT      { $$ = PKL_AST_BUILTIN_IOCOMMIT; }
+        | BUILTIN_IOROLLBACK    { $$ = PKL_AST_BUILTIN_IOROLLBACK; }
+        | BUILTIN_IOCOPY        { $$ = PKL_AST_BUILTIN_IOCOPY; }
         | BUILTIN_GET_TIME      { $$ = PKL_AST_BUILTIN_GET_TIME; }
         | BUILTIN_STRACE        { $$ = PKL_AST_BUILTIN_STRACE; }
         | BUILTIN_TERM_GET_COLOR { $$ = PKL_AST_BUILTIN_TERM_GET_COLOR; }
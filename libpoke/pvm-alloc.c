@@ -21,6 +21,7 @@
 
 #include "pvm.h"
 #include "pvm-val.h"
+#include "pvm-alloc.h"
 
 void *
 pvm_alloc (size_t size)
@@ -28,6 +29,18 @@ pvm_alloc (size_t size)
   return GC_MALLOC (size);
 }
 
+void *
+pvm_alloc_atomic (size_t size)
+{
+  return GC_MALLOC_ATOMIC (size);
+}
+
+void *
+pvm_alloc_aligned (size_t align, size_t size)
+{
+  return GC_memalign (align, size);
+}
+
 void *
 pvm_realloc (void *ptr, size_t size)
 {
@@ -40,6 +53,29 @@ pvm_alloc_strdup (const char *string)
   return GC_strdup (string);
 }
 
+void
+pvm_alloc_set_weak_ref (pvm_weak_ref *ref, void *pointer)
+{
+  *ref = GC_HIDE_POINTER (pointer);
+  GC_general_register_disappearing_link ((void **) ref, pointer);
+}
+
+static void *
+pvm_alloc_reveal_weak_ref (void *data)
+{
+  pvm_weak_ref ref = *(pvm_weak_ref *) data;
+
+  return ref ? GC_REVEAL_POINTER (ref) : NULL;
+}
+
+void *
+pvm_alloc_get_weak_ref (pvm_weak_ref *ref)
+{
+  /* The collector clears the reference when it reclaims the memory,
+     so read it with the allocation lock held.  */
+  return GC_call_with_alloc_lock (pvm_alloc_reveal_weak_ref, ref);
+}
+
 static void
 pvm_alloc_finalize_closure (void *object, void *client_data)
 {
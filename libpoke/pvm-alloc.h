@@ -46,6 +46,23 @@ void *pvm_alloc (size_t size)
   __attribute__ ((malloc))
   __attribute__ ((alloc_size (1)));
 
+/* Allocate SIZE bytes for data not containing pointers, such as
+   buffers of integers, and return a pointer to the allocated memory.
+   The garbage collector doesn't scan this memory.  On error, return
+   NULL.  */
+
+void *pvm_alloc_atomic (size_t size)
+  __attribute__ ((malloc))
+  __attribute__ ((alloc_size (1)));
+
+/* Allocate SIZE bytes aligned to ALIGN bytes, which shall be a power
+   of two, and return a pointer to the allocated memory.  On error,
+   return NULL.  */
+
+void *pvm_alloc_aligned (size_t align, size_t size)
+  __attribute__ ((malloc))
+  __attribute__ ((alloc_size (2)));
+
 /* Reallocate the given pointer to occupy SIZE bytes and return a
    pointer to the allocated memory.  SIZE has the same semantics as in
    realloc(3).  On error, return NULL.  */
@@ -67,6 +84,21 @@ void *pvm_alloc_cls (void)
 char *pvm_alloc_strdup (const char *string)
   __attribute__ ((malloc));
 
+/* Weak references to memory allocated by the pvm_alloc* services.
+   Unlike a pointer, a weak reference doesn't prevent the garbage
+   collector from reclaiming the memory it refers to, and it reads as
+   NULL once the memory has been reclaimed.  Weak references shall be
+   stored in memory allocated by pvm_alloc.
+
+   pvm_alloc_set_weak_ref makes REF refer to POINTER, and
+   pvm_alloc_get_weak_ref returns the pointer referred to by REF, or
+   NULL.  */
+
+typedef GC_hidden_pointer pvm_weak_ref;
+
+void pvm_alloc_set_weak_ref (pvm_weak_ref *ref, void *pointer);
+void *pvm_alloc_get_weak_ref (pvm_weak_ref *ref);
+
 /* Forced collection.  */
 
 void pvm_alloc_gc (void);
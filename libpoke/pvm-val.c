@@ -40,6 +40,35 @@ static pvm_val string_type;
 static pvm_val void_type;
 static pvm_val any_type;
 
+/* Integral types of every size, unsigned and signed, as returned by
+   pvm_typeof.  Reusing them saves an allocation for the base type of
+   every offset.  */
+
+#define PVM_MAX_INTEGRAL_SIZE 64
+
+static pvm_val integral_types[2][PVM_MAX_INTEGRAL_SIZE + 1];
+
+/* Table of shared struct layouts, indexed by their hash.  See
+   pvm_make_struct_layout.
+
+   The table holds weak references to the layouts, so that layouts no
+   longer used by any struct are reclaimed by the garbage collector.
+   The entries whose layout is gone are dropped as they are found.
+   STRUCT_LAYOUTS_COUNT is the number of entries in the table.  */
+
+#define PVM_STRUCT_LAYOUTS_INITIAL_SIZE 256
+
+struct pvm_struct_layout_ref
+{
+  pvm_weak_ref layout;
+  uint64_t hash;
+  struct pvm_struct_layout_ref *next;
+};
+
+static struct pvm_struct_layout_ref **struct_layouts;
+static size_t struct_layouts_size;
+static size_t struct_layouts_count;
+
 pvm_val
 pvm_make_int (int32_t value, int size)
 {
@@ -67,7 +96,7 @@ pvm_make_ulong (uint64_t value, int size)
 static pvm_val_box
 pvm_make_box (uint8_t tag)
 {
-  pvm_val_box box = pvm_alloc (sizeof (struct pvm_val_box));
+  pvm_val_box box = pvm_alloc_aligned (16, sizeof (struct pvm_val_box));
 
   PVM_VAL_BOX_TAG (box) = tag;
   return box;
@@ -82,14 +111,162 @@ pvm_make_string (const char *str)
   return PVM_BOX (box);
 }
 
+/* Return the number of bytes used to store every element of a packed
+   array whose elements are BITS bits long.  */
+
+static inline size_t
+pvm_array_packed_width (uint64_t bits)
+{
+  return bits <= 8 ? 1 : bits <= 16 ? 2 : bits <= 32 ? 4 : 8;
+}
+
+/* Get and set the bits of the element occupying the position IDX in
+   the packed array ARR.  Only the ESIZE low bits of the element are
+   stored, so that equal elements are stored equal regardless of how
+   their values were sign-extended.  */
+
+static inline uint64_t
+pvm_array_packed_get (pvm_val arr, uint64_t idx)
+{
+  void *packed = PVM_VAL_ARR_PACKED (arr);
+
+  switch (pvm_array_packed_width (PVM_VAL_ARR_ESIZE (arr)))
+    {
+    case 1: return ((uint8_t *) packed)[idx];
+    case 2: return ((uint16_t *) packed)[idx];
+    case 4: return ((uint32_t *) packed)[idx];
+    default: return ((uint64_t *) packed)[idx];
+    }
+}
+
+static inline void
+pvm_array_packed_set (pvm_val arr, uint64_t idx, uint64_t bits)
+{
+  void *packed = PVM_VAL_ARR_PACKED (arr);
+  int esize = PVM_VAL_ARR_ESIZE (arr);
+
+  if (esize < 64)
+    bits &= ((uint64_t) 1 << esize) - 1;
+
+  switch (pvm_array_packed_width (esize))
+    {
+    case 1: ((uint8_t *) packed)[idx] = bits; break;
+    case 2: ((uint16_t *) packed)[idx] = bits; break;
+    case 4: ((uint32_t *) packed)[idx] = bits; break;
+    default: ((uint64_t *) packed)[idx] = bits; break;
+    }
+}
+
+/* Return the integer value of the element occupying the position IDX
+   in the packed array ARR.  */
+
+static pvm_val
+pvm_array_packed_value (pvm_val arr, uint64_t idx)
+{
+  int bits = PVM_VAL_ARR_ESIZE (arr);
+  uint64_t value = pvm_array_packed_get (arr, idx);
+
+  if (PVM_VAL_ARR_PACKED_SIGNED_P (arr))
+    {
+      /* Sign-extend the value.  */
+      int64_t svalue = (int64_t) (value << (64 - bits)) >> (64 - bits);
+
+      return (bits <= 32
+              ? pvm_make_int (svalue, bits)
+              : pvm_make_long (svalue, bits));
+    }
+  else
+    return (bits <= 32
+            ? pvm_make_uint (value, bits)
+            : pvm_make_ulong (value, bits));
+}
+
+/* Return whether the value VAL can be stored in the packed array ARR,
+   i.e. whether it is an integer having the same size and signedness
+   than the elements of the array.  */
+
+static int
+pvm_array_packable_p (pvm_val arr, pvm_val val)
+{
+  int bits = PVM_VAL_ARR_ESIZE (arr);
+
+  if (PVM_VAL_ARR_PACKED_SIGNED_P (arr))
+    return ((PVM_IS_INT (val) && PVM_VAL_INT_SIZE (val) == bits)
+            || (PVM_IS_LONG (val) && PVM_VAL_LONG_SIZE (val) == bits));
+  else
+    return ((PVM_IS_UINT (val) && PVM_VAL_UINT_SIZE (val) == bits)
+            || (PVM_IS_ULONG (val) && PVM_VAL_ULONG_SIZE (val) == bits));
+}
+
+/* Make sure the packed array ARR has room for at least NALLOCATED
+   elements.  */
+
+static void
+pvm_array_packed_reserve (pvm_val arr, uint64_t nallocated)
+{
+  if (PVM_VAL_ARR_NALLOCATED (arr) < nallocated)
+    {
+      PVM_VAL_ARR_NALLOCATED (arr) = nallocated;
+      PVM_VAL_ARR_PACKED (arr)
+        = pvm_realloc (PVM_VAL_ARR_PACKED (arr),
+                       nallocated
+                       * pvm_array_packed_width (PVM_VAL_ARR_ESIZE (arr)));
+    }
+}
+
+/* Turn the packed array ARR into a regular array, having its elements
+   stored in ELEMS.  This is needed to store values that are not
+   integers of the type of the elements, and to set bit-offsets other
+   than the implicit ones.  */
+
+static void
+pvm_array_unpack (pvm_val arr)
+{
+  uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t nallocated = PVM_VAL_ARR_NALLOCATED (arr);
+  uint64_t esize = PVM_VAL_ARR_ESIZE (arr);
+  pvm_val offset = PVM_VAL_ARR_OFFSET (arr);
+  pvm_val offset_back = PVM_MAPINFO_OFFSET (PVM_VAL_ARR_MAPINFO_BACK (arr));
+  struct pvm_array_elem *elems;
+  uint64_t i;
+
+  elems = pvm_alloc (nallocated * sizeof (struct pvm_array_elem));
+  for (i = 0; i < nallocated; ++i)
+    {
+      if (i < nelem)
+        {
+          elems[i].value = pvm_array_packed_value (arr, i);
+          elems[i].offset
+            = (offset == PVM_NULL
+               ? PVM_NULL
+               : pvm_make_ulong (PVM_VAL_ULONG (offset) + i * esize, 64));
+          elems[i].offset_back
+            = (offset_back == PVM_NULL
+               ? PVM_NULL
+               : pvm_make_ulong (PVM_VAL_ULONG (offset_back) + i * esize,
+                                 64));
+        }
+      else
+        {
+          elems[i].value = PVM_NULL;
+          elems[i].offset = PVM_NULL;
+          elems[i].offset_back = PVM_NULL;
+        }
+    }
+
+  PVM_VAL_ARR_ELEMS (arr) = elems;
+  PVM_VAL_ARR_PACKED (arr) = NULL;
+  PVM_VAL_ARR_ESIZE (arr) = 0;
+}
+
 pvm_val
 pvm_make_array (pvm_val nelem, pvm_val type)
 {
   pvm_val_box box = pvm_make_box (PVM_VAL_TAG_ARR);
   pvm_array arr = pvm_alloc (sizeof (struct pvm_array));
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (type);
   size_t num_elems = PVM_VAL_ULONG (nelem);
   size_t num_allocated = num_elems > 0 ? num_elems : 16;
-  size_t nbytes = (sizeof (struct pvm_array_elem) * num_allocated);
   size_t i;
 
   PVM_MAPINFO_MAPPED_P (arr->mapinfo) = 0;
@@ -108,18 +285,279 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   arr->nelem = pvm_make_ulong (0, 64);
   arr->nallocated = num_allocated;
   arr->type = type;
-
-  arr->elems = pvm_alloc (nbytes);
-  for (i = 0; i < num_allocated; ++i)
+  arr->emapper = PVM_NULL;
+  arr->vm = NULL;
+  arr->esize = 0;
+  arr->elems = NULL;
+  arr->packed = NULL;
+  arr->packed_signed_p = 0;
+
+  /* Arrays of integers are packed.  */
+  if (PVM_VAL_TYP_CODE (etype) == PVM_TYPE_INTEGRAL)
+    {
+      arr->esize = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+      arr->packed_signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (etype));
+      arr->packed = pvm_alloc_atomic (num_allocated
+                                      * pvm_array_packed_width (arr->esize));
+    }
+  else
     {
-      arr->elems[i].offset = PVM_NULL;
-      arr->elems[i].value = PVM_NULL;
+      arr->elems = pvm_alloc (sizeof (struct pvm_array_elem)
+                              * num_allocated);
+      for (i = 0; i < num_allocated; ++i)
+        {
+          arr->elems[i].offset = PVM_NULL;
+          arr->elems[i].value = PVM_NULL;
+        }
     }
 
   PVM_VAL_BOX_ARR (box) = arr;
   return PVM_BOX (box);
 }
 
+pvm_val
+pvm_make_byte_array (const uint8_t *bytes, size_t count)
+{
+  pvm_val type
+    = pvm_make_array_type (pvm_make_integral_type (pvm_make_ulong (8, 64),
+                                                   PVM_MAKE_INT (0, 32)),
+                           PVM_NULL);
+  pvm_val arr = pvm_make_array (pvm_make_ulong (count, 64), type);
+
+  memcpy (PVM_VAL_ARR_PACKED (arr), bytes, count);
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (count, 64);
+
+  return arr;
+}
+
+/* Integers are peeked by pvm_array_peek_integral in chunks of this
+   many elements, unless they are peeked directly in the storage of a
+   packed array.  */
+
+#define PVM_ARRAY_PEEK_CHUNK 1024
+
+int
+pvm_array_peek_integral (pvm_val arr, ios io, ios_off boffset,
+                         uint64_t nelem, int bits, int signed_p,
+                         enum ios_endian endian)
+{
+  union
+  {
+    uint8_t u8[PVM_ARRAY_PEEK_CHUNK];
+    uint16_t u16[PVM_ARRAY_PEEK_CHUNK];
+    uint32_t u32[PVM_ARRAY_PEEK_CHUNK];
+    uint64_t u64[PVM_ARRAY_PEEK_CHUNK];
+  } chunk;
+  uint64_t base = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  int native_p = (bits == 8 || bits == 16 || bits == 32 || bits == 64);
+  int packed_p = (PVM_VAL_ARR_PACKED_P (arr)
+                  && PVM_VAL_ARR_ESIZE (arr) == bits
+                  && PVM_VAL_ARR_PACKED_SIGNED_P (arr) == signed_p);
+  uint64_t i;
+  size_t j, count;
+  int ret;
+
+  /* Make sure all the elements are in the IO space before making room
+     for them, by reading the last bit of the last one.  */
+  if (nelem > 0)
+    {
+      uint64_t last_bit;
+
+      if (nelem > (UINT64_MAX - boffset) / bits)
+        return IOS_EIOFF;
+
+      ret = ios_read_uint (io, boffset + nelem * bits - 1, 0 /* flags */,
+                           1, IOS_ENDIAN_MSB, &last_bit);
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  /* Make room for the new elements.  */
+  if (packed_p)
+    pvm_array_packed_reserve (arr, base + nelem);
+  else
+    {
+      if (PVM_VAL_ARR_PACKED_P (arr))
+        pvm_array_unpack (arr);
+
+      if (PVM_VAL_ARR_NALLOCATED (arr) < base + nelem)
+        {
+          PVM_VAL_ARR_NALLOCATED (arr) = base + nelem;
+          PVM_VAL_ARR_ELEMS (arr)
+            = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
+                           PVM_VAL_ARR_NALLOCATED (arr)
+                           * sizeof (struct pvm_array_elem));
+        }
+    }
+
+  /* Integers of the widths supported by the host are read directly
+     into the storage of packed arrays, all at once.  */
+  if (packed_p && native_p)
+    {
+      ret = ios_read_uint_array (io, boffset, 0 /* flags */, bits, endian,
+                                 ((uint8_t *) PVM_VAL_ARR_PACKED (arr)
+                                  + base * (bits / 8)),
+                                 nelem);
+      if (ret != IOS_OK)
+        return ret;
+
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (base + nelem, 64);
+      return IOS_OK;
+    }
+
+  for (i = 0; i < nelem; i += count)
+    {
+      ios_off offset = boffset + i * bits;
+
+      count = (nelem - i < PVM_ARRAY_PEEK_CHUNK
+               ? nelem - i : PVM_ARRAY_PEEK_CHUNK);
+
+      /* Integers of the widths supported by the host are read all at
+         once.  Other integers are read one by one.  */
+      if (native_p)
+        {
+          ret = ios_read_uint_array (io, offset, 0 /* flags */, bits,
+                                     endian, &chunk, count);
+          if (ret != IOS_OK)
+            return ret;
+        }
+      else
+        for (j = 0; j < count; ++j)
+          {
+            ret = ios_read_uint (io, offset + j * bits, 0 /* flags */,
+                                 bits, endian, &chunk.u64[j]);
+            if (ret != IOS_OK)
+              return ret;
+          }
+
+      for (j = 0; j < count; ++j)
+        {
+          uint64_t value;
+          pvm_val val;
+
+          switch (bits)
+            {
+            case 8: value = chunk.u8[j]; break;
+            case 16: value = chunk.u16[j]; break;
+            case 32: value = chunk.u32[j]; break;
+            default: value = chunk.u64[j]; break;
+            }
+
+          if (packed_p)
+            {
+              pvm_array_packed_set (arr, base + i + j, value);
+              continue;
+            }
+
+          if (signed_p)
+            {
+              int64_t svalue;
+
+              /* Sign-extend the value.  */
+              svalue = (int64_t) (value << (64 - bits)) >> (64 - bits);
+              val = (bits <= 32
+                     ? pvm_make_int (svalue, bits)
+                     : pvm_make_long (svalue, bits));
+            }
+          else
+            val = (bits <= 32
+                   ? pvm_make_uint (value, bits)
+                   : pvm_make_ulong (value, bits));
+
+          PVM_VAL_ARR_ELEM_VALUE (arr, base + i + j) = val;
+          PVM_VAL_ARR_ELEM_OFFSET (arr, base + i + j)
+            = pvm_make_ulong (offset + j * bits, 64);
+        }
+
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (base + i + count, 64);
+    }
+
+  return IOS_OK;
+}
+
+void
+pvm_array_insert_lazy (pvm_val arr, uint64_t boffset, uint64_t nelem,
+                       uint64_t esize, pvm_val emapper)
+{
+  uint64_t base = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  uint64_t i;
+
+  if (PVM_VAL_ARR_NALLOCATED (arr) < base + nelem)
+    {
+      PVM_VAL_ARR_NALLOCATED (arr) = base + nelem;
+      PVM_VAL_ARR_ELEMS (arr)
+        = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
+                       PVM_VAL_ARR_NALLOCATED (arr)
+                       * sizeof (struct pvm_array_elem));
+    }
+
+  for (i = 0; i < nelem; ++i)
+    {
+      PVM_VAL_ARR_ELEM_VALUE (arr, base + i) = PVM_NULL;
+      PVM_VAL_ARR_ELEM_OFFSET (arr, base + i)
+        = pvm_make_ulong (boffset + i * esize, 64);
+    }
+
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (base + nelem, 64);
+  PVM_VAL_ARR_EMAPPER (arr) = emapper;
+  PVM_VAL_ARR_ESIZE (arr) = esize;
+}
+
+/* Return the size in bits of the element occupying the position IDX
+   in the array ARR.  Elements of lazily mapped arrays don't need to
+   be mapped to know their size.  */
+
+static uint64_t
+pvm_array_elem_size (pvm_val arr, size_t idx)
+{
+  pvm_val value = PVM_VAL_ARR_ELEM_VALUE (arr, idx);
+
+  return (value == PVM_NULL
+          ? PVM_VAL_ARR_ESIZE (arr) : pvm_sizeof (value));
+}
+
+pvm_val
+pvm_array_elem_value (pvm_val arr, uint64_t idx)
+{
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    return pvm_array_packed_value (arr, idx);
+  else
+    return PVM_VAL_ARR_ELEM_VALUE (arr, idx);
+}
+
+pvm_val
+pvm_array_elem_offset (pvm_val arr, uint64_t idx)
+{
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    {
+      pvm_val offset = PVM_VAL_ARR_OFFSET (arr);
+
+      if (offset == PVM_NULL)
+        return PVM_NULL;
+      return pvm_make_ulong (PVM_VAL_ULONG (offset)
+                             + idx * PVM_VAL_ARR_ESIZE (arr), 64);
+    }
+  else
+    return PVM_VAL_ARR_ELEM_OFFSET (arr, idx);
+}
+
+void
+pvm_array_set_elem_offset (pvm_val arr, uint64_t idx, pvm_val offset)
+{
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    {
+      if (offset == pvm_array_elem_offset (arr, idx)
+          || (offset != PVM_NULL
+              && PVM_VAL_ARR_OFFSET (arr) != PVM_NULL
+              && (PVM_VAL_ULONG (offset)
+                  == PVM_VAL_ULONG (pvm_array_elem_offset (arr, idx)))))
+        return;
+      pvm_array_unpack (arr);
+    }
+
+  PVM_VAL_ARR_ELEM_OFFSET (arr, idx) = offset;
+}
+
 int
 pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
 {
@@ -142,6 +580,25 @@ pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
   if (nelem_to_add > 1024)
     return 0;
 
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    {
+      if (pvm_array_packable_p (arr, val))
+        {
+          uint64_t value = PVM_VAL_INTEGRAL (val);
+
+          if ((nallocated - nelem) < nelem_to_add)
+            pvm_array_packed_reserve (arr, nallocated + nelem_to_add + 16);
+
+          for (i = nelem; i <= index; ++i)
+            pvm_array_packed_set (arr, i, value);
+
+          PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem + nelem_to_add, 64);
+          return 1;
+        }
+
+      pvm_array_unpack (arr);
+    }
+
   /* Make sure there is enough room in the array for the new elements.
      Otherwise, make space for the new elements, plus a buffer of 16
      elements more.  */
@@ -187,6 +644,19 @@ pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
   if (index >= nelem)
     return 0;
 
+  /* Integers stored in packed arrays don't change the bit-offsets of
+     the elements.  */
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    {
+      if (pvm_array_packable_p (arr, val))
+        {
+          pvm_array_packed_set (arr, index, PVM_VAL_INTEGRAL (val));
+          return 1;
+        }
+
+      pvm_array_unpack (arr);
+    }
+
   /* Update the element with the given value.  */
   PVM_VAL_ARR_ELEM_VALUE (arr, index) = val;
 
@@ -199,7 +669,7 @@ pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
   for (i = index + 1; i < nelem; ++i)
     {
       PVM_VAL_ARR_ELEM_OFFSET (arr, i) = pvm_make_ulong (elem_boffset, 64);
-      elem_boffset += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, i));
+      elem_boffset += pvm_array_elem_size (arr, i);
     }
 
   return 1;
@@ -216,24 +686,172 @@ pvm_array_rem (pvm_val arr, pvm_val idx)
   if (index >= nelem)
     return 0;
 
-  for (i = index; i < (nelem - 1); i++)
-    PVM_VAL_ARR_ELEM (arr,i) = PVM_VAL_ARR_ELEM (arr, i + 1);
+  if (PVM_VAL_ARR_PACKED_P (arr))
+    {
+      size_t width = pvm_array_packed_width (PVM_VAL_ARR_ESIZE (arr));
+      uint8_t *packed = PVM_VAL_ARR_PACKED (arr);
+
+      memmove (packed + index * width, packed + (index + 1) * width,
+               (nelem - index - 1) * width);
+    }
+  else
+    for (i = index; i < (nelem - 1); i++)
+      PVM_VAL_ARR_ELEM (arr,i) = PVM_VAL_ARR_ELEM (arr, i + 1);
   PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
 
   return 1;
 }
 
+/* Compute the hash of the struct layout having NFIELDS fields and
+   NMETHODS methods with the given NAMES.  See
+   pvm_make_struct_layout.  */
+
+static uint64_t
+pvm_struct_layout_hash (size_t nfields, size_t nmethods,
+                        const pvm_val *names)
+{
+  uint64_t hash = nfields * 31 + nmethods;
+  size_t i;
+
+  for (i = 0; i < nfields + nmethods; ++i)
+    hash = hash * 31 + ((names ? names[i] : PVM_NULL) >> 3);
+
+  return hash;
+}
+
+/* Allocate a new, not shared, struct layout having NFIELDS fields and
+   NMETHODS methods, and copy the names in NAMES into it.  */
+
+static pvm_struct_layout
+pvm_alloc_struct_layout (size_t nfields, size_t nmethods,
+                         const pvm_val *names)
+{
+  pvm_struct_layout layout
+    = pvm_alloc (sizeof (struct pvm_struct_layout)
+                 + (nfields + nmethods) * sizeof (pvm_val));
+  size_t i;
+
+  layout->nfields = pvm_make_ulong (nfields, 64);
+  layout->nmethods = pvm_make_ulong (nmethods, 64);
+  layout->method_names = layout->field_names + nfields;
+  layout->shared_p = 0;
+
+  for (i = 0; i < PVM_STRUCT_LAYOUT_CACHE_SIZE; ++i)
+    {
+      layout->cache[i].name = PVM_NULL;
+      layout->cache[i].index = -1;
+    }
+
+  for (i = 0; i < nfields + nmethods; ++i)
+    layout->field_names[i] = names ? names[i] : PVM_NULL;
+
+  return layout;
+}
+
+/* Rebuild the table of shared struct layouts, dropping the entries
+   whose layout has been reclaimed, and doubling its size if it is
+   still crowded.  */
+
+static void
+pvm_struct_layouts_rehash (void)
+{
+  struct pvm_struct_layout_ref *refs = NULL, *ref, *next;
+  size_t new_size = struct_layouts_size;
+  size_t i;
+
+  struct_layouts_count = 0;
+  for (i = 0; i < struct_layouts_size; ++i)
+    for (ref = struct_layouts[i]; ref; ref = next)
+      {
+        next = ref->next;
+        if (pvm_alloc_get_weak_ref (&ref->layout) != NULL)
+          {
+            ref->next = refs;
+            refs = ref;
+            struct_layouts_count++;
+          }
+      }
+
+  if (struct_layouts_count >= struct_layouts_size / 2)
+    new_size = struct_layouts_size * 2;
+
+  struct_layouts = pvm_alloc (new_size * sizeof (*struct_layouts));
+  memset (struct_layouts, 0, new_size * sizeof (*struct_layouts));
+  struct_layouts_size = new_size;
+
+  for (ref = refs; ref; ref = next)
+    {
+      next = ref->next;
+      ref->next = struct_layouts[ref->hash % new_size];
+      struct_layouts[ref->hash % new_size] = ref;
+    }
+}
+
+pvm_struct_layout
+pvm_make_struct_layout (pvm_val nfields, pvm_val nmethods,
+                        const pvm_val *names)
+{
+  size_t num_fields = PVM_VAL_ULONG (nfields);
+  size_t num_methods = PVM_VAL_ULONG (nmethods);
+  uint64_t hash = pvm_struct_layout_hash (num_fields, num_methods, names);
+  struct pvm_struct_layout_ref **link, *ref;
+  pvm_struct_layout layout;
+  size_t i;
+
+  link = &struct_layouts[hash % struct_layouts_size];
+  while ((ref = *link) != NULL)
+    {
+      layout = pvm_alloc_get_weak_ref (&ref->layout);
+      if (layout == NULL)
+        {
+          /* The layout has been reclaimed.  */
+          *link = ref->next;
+          struct_layouts_count--;
+          continue;
+        }
+      link = &ref->next;
+
+      if (ref->hash != hash
+          || PVM_VAL_ULONG (layout->nfields) != num_fields
+          || PVM_VAL_ULONG (layout->nmethods) != num_methods)
+        continue;
+
+      for (i = 0; i < num_fields + num_methods; ++i)
+        if (layout->field_names[i] != (names ? names[i] : PVM_NULL))
+          break;
+
+      if (i == num_fields + num_methods)
+        return layout;
+    }
+
+  /* Rebuild the table of layouts if it gets too crowded.  */
+  if (struct_layouts_count >= struct_layouts_size)
+    pvm_struct_layouts_rehash ();
+
+  layout = pvm_alloc_struct_layout (num_fields, num_methods, names);
+  layout->shared_p = 1;
+
+  ref = pvm_alloc (sizeof (struct pvm_struct_layout_ref));
+  ref->hash = hash;
+  pvm_alloc_set_weak_ref (&ref->layout, layout);
+  ref->next = struct_layouts[hash % struct_layouts_size];
+  struct_layouts[hash % struct_layouts_size] = ref;
+  struct_layouts_count++;
+
+  return layout;
+}
+
 pvm_val
 pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
 {
   pvm_val_box box = pvm_make_box (PVM_VAL_TAG_SCT);
-  pvm_struct sct = pvm_alloc (sizeof (struct pvm_struct));
+  size_t num_fields = PVM_VAL_ULONG (nfields);
+  size_t num_methods = PVM_VAL_ULONG (nmethods);
+  pvm_struct sct
+    = pvm_alloc (sizeof (struct pvm_struct)
+                 + num_fields * sizeof (struct pvm_struct_field)
+                 + num_methods * sizeof (pvm_val));
   size_t i;
-  size_t nfieldbytes
-    = sizeof (struct pvm_struct_field) * PVM_VAL_ULONG (nfields);
-  size_t nmethodbytes
-    = sizeof (struct pvm_struct_method) * PVM_VAL_ULONG (nmethods);
-
 
   PVM_MAPINFO_MAPPED_P (sct->mapinfo) = 0;
   PVM_MAPINFO_STRICT_P (sct->mapinfo) = 1;
@@ -247,117 +865,233 @@ pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
   sct->mapper = PVM_NULL;
   sct->writer = PVM_NULL;
   sct->type = type;
+  sct->layout = pvm_make_struct_layout (nfields, nmethods, NULL);
+  sct->methods = (pvm_val *) (sct->fields + num_fields);
+  sct->fields_back = NULL;
 
-  sct->nfields = nfields;
-  sct->fields = pvm_alloc (nfieldbytes);
-  memset (sct->fields, 0, nfieldbytes);
-
-  sct->nmethods = nmethods;
-  sct->methods = pvm_alloc (nmethodbytes);
-  memset (sct->methods, 0, nmethodbytes);
-
-  for (i = 0; i < PVM_VAL_ULONG (sct->nfields); ++i)
+  for (i = 0; i < num_fields; ++i)
     {
       sct->fields[i].offset = PVM_NULL;
-      sct->fields[i].name = PVM_NULL;
       sct->fields[i].value = PVM_NULL;
       sct->fields[i].modified = PVM_MAKE_INT (0, 32);
-      sct->fields[i].modified_back = PVM_NULL;
-      sct->fields[i].offset_back = PVM_NULL;
     }
 
-  for (i = 0; i < PVM_VAL_ULONG (sct->nmethods); ++i)
-    {
-      sct->methods[i].name = PVM_NULL;
-      sct->methods[i].value = PVM_NULL;
-    }
+  for (i = 0; i < num_methods; ++i)
+    sct->methods[i] = PVM_NULL;
 
   PVM_VAL_BOX_SCT (box) = sct;
   return PVM_BOX (box);
 }
 
-pvm_val
-pvm_ref_struct_cstr (pvm_val sct, const char *name)
+void
+pvm_set_struct_field_name (pvm_val sct, uint64_t idx, pvm_val name)
 {
-  size_t nfields, nmethods, i;
-  struct pvm_struct_field *fields;
-  struct pvm_struct_method *methods;
+  pvm_struct_layout layout = PVM_VAL_SCT_LAYOUT (sct);
 
-  assert (PVM_IS_SCT (sct));
+  if (PVM_VAL_SCT_FIELD_NAME (sct, idx) == name)
+    return;
+
+  /* Shared layouts are never modified.  Give the struct its own copy
+     of the layout instead.  */
+  if (layout->shared_p)
+    PVM_VAL_SCT_LAYOUT (sct)
+      = pvm_alloc_struct_layout (PVM_VAL_ULONG (layout->nfields),
+                                 PVM_VAL_ULONG (layout->nmethods),
+                                 layout->field_names);
+
+  PVM_VAL_SCT_FIELD_NAME (sct, idx) = name;
+}
+
+/* Return the backup of the fields of the struct SCT used by the
+   relocation instructions, allocating it if needed.  */
+
+static struct pvm_struct_field_back *
+pvm_struct_fields_back (pvm_val sct)
+{
+  pvm_struct s = PVM_VAL_SCT (sct);
+
+  if (s->fields_back == NULL)
+    {
+      size_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+      size_t i;
+
+      s->fields_back
+        = pvm_alloc (nfields * sizeof (struct pvm_struct_field_back));
+      for (i = 0; i < nfields; ++i)
+        {
+          s->fields_back[i].offset = PVM_NULL;
+          s->fields_back[i].modified = PVM_NULL;
+        }
+    }
+
+  return s->fields_back;
+}
+
+/* Return the index of the field or method named NAME in the struct
+   SCT, or -1 if there is no such field or method.  The methods are
+   indexed after the fields, i.e. the index of the method I is
+   NFIELDS + I.  */
+
+static int64_t
+pvm_struct_lookup (pvm_val sct, const char *name)
+{
+  size_t nfields, nmethods, i;
 
   /* Lookup fields.  */
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
 
   for (i = 0; i < nfields; ++i)
     {
+      pvm_val field_name = PVM_VAL_SCT_FIELD_NAME (sct, i);
+
       if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
-          && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    name))
-        return fields[i].value;
+          && field_name != PVM_NULL
+          && STREQ (PVM_VAL_STR (field_name), name))
+        return i;
     }
 
   /* Lookup methods.  */
   nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
-  methods = PVM_VAL_SCT (sct)->methods;
 
   for (i = 0; i < nmethods; ++i)
     {
-      if (STREQ (PVM_VAL_STR (methods[i].name),
-                 name))
-        return methods[i].value;
+      if (STREQ (PVM_VAL_STR (PVM_VAL_SCT_METHOD_NAME (sct, i)), name))
+        return nfields + i;
     }
 
-  return PVM_NULL;
+  return -1;
+}
+
+/* Like pvm_struct_lookup, but NAME is a string value and the result
+   is remembered in the cache of the layout of SCT, if it is shared.
+
+   Accesses to struct fields are compiled using constant strings, so
+   the same string value is used every time a given access is
+   executed.  Since fields having a name are never absent, a hit in
+   the cache is always valid.  */
+
+static int64_t
+pvm_struct_lookup_cached (pvm_val sct, pvm_val name)
+{
+  pvm_struct_layout layout = PVM_VAL_SCT_LAYOUT (sct);
+  struct pvm_struct_layout_cache_entry *entry;
+  int64_t index;
+
+  if (!layout->shared_p)
+    return pvm_struct_lookup (sct, PVM_VAL_STR (name));
+
+  entry = &layout->cache[(name >> 3) % PVM_STRUCT_LAYOUT_CACHE_SIZE];
+  if (entry->name == name)
+    return entry->index;
+
+  index = pvm_struct_lookup (sct, PVM_VAL_STR (name));
+  if (index != -1)
+    {
+      entry->name = name;
+      entry->index = index;
+    }
+
+  return index;
+}
+
+/* Return the field or method of SCT at the given INDEX, as returned
+   by pvm_struct_lookup.  */
+
+static pvm_val
+pvm_struct_elem (pvm_val sct, int64_t index)
+{
+  size_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+
+  if (index == -1)
+    return PVM_NULL;
+  else if (index < nfields)
+    return PVM_VAL_SCT_FIELD_VALUE (sct, index);
+  else
+    return PVM_VAL_SCT_METHOD_VALUE (sct, index - nfields);
+}
+
+pvm_val
+pvm_ref_struct_cstr (pvm_val sct, const char *name)
+{
+  assert (PVM_IS_SCT (sct));
+  return pvm_struct_elem (sct, pvm_struct_lookup (sct, name));
 }
 
 pvm_val
 pvm_ref_struct (pvm_val sct, pvm_val name)
 {
-  assert (PVM_IS_STR (name));
-  return pvm_ref_struct_cstr (sct, PVM_VAL_STR (name));
+  assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
+  return pvm_struct_elem (sct, pvm_struct_lookup_cached (sct, name));
 }
 
 pvm_val
-pvm_refo_struct (pvm_val sct, pvm_val name)
+pvm_ref_struct_hint (pvm_val sct, pvm_val name, uint64_t index)
 {
-  size_t nfields, i;
-  struct pvm_struct_field *fields;
+  pvm_struct_layout layout;
+  struct pvm_struct_layout_cache_entry *entry;
+  pvm_val field_name;
 
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
-  nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
-
-  for (i = 0; i < nfields; ++i)
+  layout = PVM_VAL_SCT_LAYOUT (sct);
+  if (layout->shared_p)
     {
-      if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
-          && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
-        return fields[i].offset;
+      entry = &layout->cache[(name >> 3) % PVM_STRUCT_LAYOUT_CACHE_SIZE];
+      if (entry->name == name)
+        return pvm_struct_elem (sct, entry->index);
+    }
+  else
+    entry = NULL;
+
+  /* The hint is checked by name only once per layout and access:
+     after that the cache above resolves it with a pointer
+     comparison.  */
+  if (index < PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct))
+      && (field_name = PVM_VAL_SCT_FIELD_NAME (sct, index)) != PVM_NULL
+      && (field_name == name
+          || STREQ (PVM_VAL_STR (field_name), PVM_VAL_STR (name))))
+    {
+      if (entry)
+        {
+          entry->name = name;
+          entry->index = index;
+        }
+      return PVM_VAL_SCT_FIELD_VALUE (sct, index);
     }
 
-  return PVM_NULL;
+  return pvm_struct_elem (sct, pvm_struct_lookup_cached (sct, name));
+}
+
+pvm_val
+pvm_refo_struct (pvm_val sct, pvm_val name)
+{
+  int64_t index;
+
+  assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
+
+  index = pvm_struct_lookup_cached (sct, name);
+  if (index == -1
+      || index >= PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct)))
+    return PVM_NULL;
+
+  return PVM_VAL_SCT_FIELD_OFFSET (sct, index);
 }
 
 int
 pvm_set_struct (pvm_val sct, pvm_val name, pvm_val val)
 {
   size_t nfields, i;
-  struct pvm_struct_field *fields;
 
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
 
   for (i = 0; i < nfields; ++i)
     {
-      if (fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
+      pvm_val field_name = PVM_VAL_SCT_FIELD_NAME (sct, i);
+
+      if (field_name != PVM_NULL
+          && STREQ (PVM_VAL_STR (field_name), PVM_VAL_STR (name)))
         {
           PVM_VAL_SCT_FIELD_VALUE (sct,i) = val;
           PVM_VAL_SCT_FIELD_MODIFIED (sct,i) =
@@ -373,12 +1107,11 @@ pvm_val
 pvm_get_struct_method (pvm_val sct, const char *name)
 {
   size_t i, nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
-  struct pvm_struct_method *methods = PVM_VAL_SCT (sct)->methods;
 
   for (i = 0; i < nmethods; ++i)
     {
-      if (STREQ (PVM_VAL_STR (methods[i].name), name))
-        return methods[i].value;
+      if (STREQ (PVM_VAL_STR (PVM_VAL_SCT_METHOD_NAME (sct, i)), name))
+        return PVM_VAL_SCT_METHOD_VALUE (sct, i);
     }
 
   return PVM_NULL;
@@ -407,6 +1140,12 @@ pvm_make_integral_type (pvm_val size, pvm_val signed_p)
   return itype;
 }
 
+pvm_val
+pvm_integral_type (int size, int signed_p)
+{
+  return integral_types[signed_p][size];
+}
+
 pvm_val
 pvm_make_string_type (void)
 {
@@ -487,18 +1226,89 @@ pvm_make_cls (pvm_program program)
   return PVM_BOX (box);
 }
 
-pvm_val
-pvm_make_offset (pvm_val magnitude, pvm_val unit)
+/* Return the unboxed encoding of the offset with the given MAGNITUDE
+   and UNIT, or PVM_NULL if it can't be encoded that way.  */
+
+static pvm_val
+pvm_make_unboxed_offset (pvm_val magnitude, pvm_val unit)
 {
-  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_OFF);
-  pvm_off off = pvm_alloc (sizeof (struct pvm_off));
+  uint64_t unit_bits, mag;
+  int log2_unit, size, fits_p;
 
-  off->base_type = pvm_typeof (magnitude);
-  off->magnitude = magnitude;
-  off->unit = unit;
+  if (!PVM_IS_ULONG (unit) || PVM_VAL_ULONG_SIZE (unit) != 64)
+    return PVM_NULL;
 
-  PVM_VAL_BOX_OFF (box) = off;
-  return PVM_BOX (box);
+  unit_bits = PVM_VAL_ULONG (unit);
+  if (unit_bits == 0 || (unit_bits & (unit_bits - 1)) != 0)
+    return PVM_NULL;
+  for (log2_unit = 0; (unit_bits >> log2_unit) != 1; ++log2_unit)
+    ;
+  if (log2_unit > PVM_OFF_UNBOXED_MAX_UNIT)
+    return PVM_NULL;
+
+  switch (PVM_VAL_TAG (magnitude))
+    {
+    case PVM_VAL_TAG_INT:
+      size = PVM_VAL_INT_SIZE (magnitude);
+      mag = (uint64_t) (int64_t) PVM_VAL_INT (magnitude);
+      fits_p = 1;
+      break;
+    case PVM_VAL_TAG_UINT:
+      size = PVM_VAL_UINT_SIZE (magnitude);
+      mag = PVM_VAL_UINT (magnitude);
+      fits_p = 1;
+      break;
+    case PVM_VAL_TAG_LONG:
+      size = PVM_VAL_LONG_SIZE (magnitude);
+      mag = (uint64_t) PVM_VAL_LONG (magnitude);
+      fits_p = ((((int64_t) (mag << (64 - PVM_OFF_UNBOXED_BITS)))
+                 >> (64 - PVM_OFF_UNBOXED_BITS))
+                == (int64_t) mag);
+      break;
+    case PVM_VAL_TAG_ULONG:
+      size = PVM_VAL_ULONG_SIZE (magnitude);
+      mag = PVM_VAL_ULONG (magnitude);
+      fits_p = (mag >> PVM_OFF_UNBOXED_BITS) == 0;
+      break;
+    default:
+      return PVM_NULL;
+    }
+
+  if (!fits_p)
+    return PVM_NULL;
+
+  return ((mag << (64 - PVM_OFF_UNBOXED_BITS))
+          | ((uint64_t) log2_unit << 12)
+          | ((uint64_t) ((size - 1) & 0x3f) << 6)
+          | ((uint64_t) PVM_VAL_TAG (magnitude) << 4)
+          | 0x8 | PVM_VAL_TAG_BOX);
+}
+
+pvm_val
+pvm_make_offset (pvm_val magnitude, pvm_val unit)
+{
+  pvm_val res = pvm_make_unboxed_offset (magnitude, unit);
+  struct
+  {
+    struct pvm_val_box box;
+    struct pvm_off off;
+  } *boff;
+
+  if (res != PVM_NULL)
+    return res;
+
+  /* The box and the offset are allocated together, since they have
+     the same lifetime.  They are aligned to 16 bytes like any other
+     box, so they are not mistaken for unboxed offsets.  */
+  boff = pvm_alloc_aligned (16, sizeof (*boff));
+
+  boff->off.base_type = pvm_typeof (magnitude);
+  boff->off.magnitude = magnitude;
+  boff->off.unit = unit;
+
+  PVM_VAL_BOX_TAG (&boff->box) = PVM_VAL_TAG_OFF;
+  PVM_VAL_BOX_OFF (&boff->box) = &boff->off;
+  return PVM_BOX (&boff->box);
 }
 
 int
@@ -609,14 +1419,29 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
                             PVM_VAL_ARR_SIZE_BOUND (val2)))
         return 0;
 
+      /* Packed arrays of the same type and offset have the same
+         element offsets.  */
+      if (PVM_VAL_ARR_PACKED_P (val1) && PVM_VAL_ARR_PACKED_P (val2)
+          && PVM_VAL_ARR_ESIZE (val1) == PVM_VAL_ARR_ESIZE (val2))
+        {
+          size_t width
+            = pvm_array_packed_width (PVM_VAL_ARR_ESIZE (val1));
+
+          return memcmp (PVM_VAL_ARR_PACKED (val1),
+                         PVM_VAL_ARR_PACKED (val2),
+                         pvm_arr1_nelems * width) == 0;
+        }
+
       for (size_t i = 0 ; i < pvm_arr1_nelems ; i++)
         {
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_VALUE (val1, i),
-                                PVM_VAL_ARR_ELEM_VALUE (val2, i)))
+          /* Elements of lazily mapped arrays are mapped before
+             comparing them.  */
+          if (!pvm_val_equal_p (pvm_array_elem_value_mapped (val1, i),
+                                pvm_array_elem_value_mapped (val2, i)))
             return 0;
 
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_OFFSET (val1, i),
-                                PVM_VAL_ARR_ELEM_OFFSET (val2, i)))
+          if (!pvm_val_equal_p (pvm_array_elem_offset (val1, i),
+                                pvm_array_elem_offset (val2, i)))
             return 0;
         }
 
@@ -691,12 +1516,84 @@ pvm_val_writer (pvm_val val)
   return PVM_NULL;
 }
 
+/* Append to the array ARRS the lazily mapped arrays contained in VAL,
+   including VAL itself, having elements that have not been mapped
+   yet.  */
+
+static void
+pvm_val_collect_pending_arrays (pvm_val val, pvm_val arrs)
+{
+  if (PVM_IS_ARR (val))
+    {
+      pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (val));
+      size_t nelem, i;
+      int pending_p = 0;
+
+      /* Integers, offsets and strings don't contain arrays.  */
+      if (PVM_VAL_TYP_CODE (etype) == PVM_TYPE_INTEGRAL
+          || PVM_VAL_TYP_CODE (etype) == PVM_TYPE_OFFSET
+          || PVM_VAL_TYP_CODE (etype) == PVM_TYPE_STRING)
+        return;
+
+      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      for (i = 0; i < nelem; ++i)
+        {
+          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
+
+          if (elem_value == PVM_NULL)
+            pending_p = 1;
+          else
+            pvm_val_collect_pending_arrays (elem_value, arrs);
+        }
+
+      if (pending_p && PVM_VAL_ARR_EMAPPER (val) != PVM_NULL)
+        {
+          size_t narrs = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arrs));
+
+          if (PVM_VAL_ARR_NALLOCATED (arrs) == narrs)
+            {
+              PVM_VAL_ARR_NALLOCATED (arrs) *= 2;
+              PVM_VAL_ARR_ELEMS (arrs)
+                = pvm_realloc (PVM_VAL_ARR_ELEMS (arrs),
+                               PVM_VAL_ARR_NALLOCATED (arrs)
+                               * sizeof (struct pvm_array_elem));
+            }
+
+          PVM_VAL_ARR_ELEM_VALUE (arrs, narrs) = val;
+          PVM_VAL_ARR_ELEM_OFFSET (arrs, narrs) = PVM_NULL;
+          PVM_VAL_ARR_NELEM (arrs) = pvm_make_ulong (narrs + 1, 64);
+        }
+    }
+  else if (PVM_IS_SCT (val))
+    {
+      size_t nfields, i;
+
+      nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      for (i = 0; i < nfields; ++i)
+        {
+          if (!PVM_VAL_SCT_FIELD_ABSENT_P (val, i))
+            pvm_val_collect_pending_arrays (PVM_VAL_SCT_FIELD_VALUE (val, i),
+                                            arrs);
+        }
+    }
+}
+
+pvm_val
+pvm_val_pending_arrays (pvm_val val)
+{
+  pvm_val type = pvm_make_array_type (pvm_make_any_type (), PVM_NULL);
+  pvm_val arrs = pvm_make_array (pvm_make_ulong (0, 64), type);
+
+  pvm_val_collect_pending_arrays (val, arrs);
+  return arrs;
+}
+
 void
 pvm_val_unmap (pvm_val val)
 {
   PVM_VAL_SET_MAPPED_P (val, 0);
 
-  if (PVM_IS_ARR (val))
+  if (PVM_IS_ARR (val) && !PVM_VAL_ARR_PACKED_P (val))
     {
       size_t nelem, i;
 
@@ -724,7 +1621,9 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       size_t nelem, i;
       uint64_t array_offset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (val));
 
-      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      /* The offsets of the elements of packed arrays are implicit.  */
+      nelem = (PVM_VAL_ARR_PACKED_P (val)
+               ? 0 : PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val)));
       for (i = 0; i < nelem; ++i)
         {
           pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
@@ -753,6 +1652,7 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       uint64_t struct_offset = PVM_VAL_ULONG (PVM_VAL_SCT_OFFSET (val));
 
       nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      pvm_struct_fields_back (val);
       for (i = 0; i < nfields; ++i)
         {
           pvm_val field_value = PVM_VAL_SCT_FIELD_VALUE (val, i);
@@ -793,7 +1693,8 @@ pvm_val_ureloc (pvm_val val)
     {
       size_t nelem, i;
 
-      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      nelem = (PVM_VAL_ARR_PACKED_P (val)
+               ? 0 : PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val)));
       for (i = 0; i < nelem; ++i)
         {
           pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
@@ -809,6 +1710,7 @@ pvm_val_ureloc (pvm_val val)
       size_t nfields, i;
 
       nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      pvm_struct_fields_back (val);
       for (i = 0; i < nfields; ++i)
         {
           pvm_val field_value = PVM_VAL_SCT_FIELD_VALUE (val, i);
@@ -821,7 +1723,7 @@ pvm_val_ureloc (pvm_val val)
           pvm_val_ureloc (field_value);
         }
 
-      PVM_VAL_ARR_MAPINFO (val) = PVM_VAL_ARR_MAPINFO_BACK (val);
+      PVM_VAL_SCT_MAPINFO (val) = PVM_VAL_SCT_MAPINFO_BACK (val);
     }
 }
 
@@ -844,8 +1746,11 @@ pvm_sizeof (pvm_val val)
       size_t size = 0;
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_PACKED_P (val))
+        return nelem * PVM_VAL_ARR_ESIZE (val);
+
       for (i = 0; i < nelem; ++i)
-        size += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (val, i));
+        size += pvm_array_elem_size (val, i);
 
       return size;
     }
@@ -1239,8 +2144,8 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
       pk_puts ("[");
       for (idx = 0; idx < nelem; idx++)
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, idx);
-          pvm_val elem_offset = PVM_VAL_ARR_ELEM_OFFSET (val, idx);
+          pvm_val elem_value;
+          pvm_val elem_offset = pvm_array_elem_offset (val, idx);
 
           if (idx != 0)
             pk_puts (",");
@@ -1253,6 +2158,9 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
               break;
             }
 
+          /* Only the elements of lazily mapped arrays that get
+             printed are mapped.  */
+          elem_value = pvm_array_elem_value_mapped (val, idx);
           PVM_PRINT_VAL_1 (elem_value, ndepth);
 
           if (maps && elem_offset != PVM_NULL)
@@ -1523,17 +2431,13 @@ pvm_typeof (pvm_val val)
   pvm_val type;
 
   if (PVM_IS_INT (val))
-    type = pvm_make_integral_type (pvm_make_ulong (PVM_VAL_INT_SIZE (val), 64),
-                                   PVM_MAKE_INT (1, 32));
+    type = integral_types[1][PVM_VAL_INT_SIZE (val)];
   else if (PVM_IS_UINT (val))
-    type = pvm_make_integral_type (pvm_make_ulong (PVM_VAL_UINT_SIZE (val), 64),
-                                   PVM_MAKE_INT (0, 32));
+    type = integral_types[0][PVM_VAL_UINT_SIZE (val)];
   else if (PVM_IS_LONG (val))
-    type = pvm_make_integral_type (pvm_make_ulong (PVM_VAL_LONG_SIZE (val), 64),
-                                   PVM_MAKE_INT (1, 32));
+    type = integral_types[1][PVM_VAL_LONG_SIZE (val)];
   else if (PVM_IS_ULONG (val))
-    type = pvm_make_integral_type (pvm_make_ulong (PVM_VAL_ULONG_SIZE (val), 64),
-                                   PVM_MAKE_INT (0, 32));
+    type = integral_types[0][PVM_VAL_ULONG_SIZE (val)];
   else if (PVM_IS_STR (val))
     type = pvm_make_string_type ();
   else if (PVM_IS_OFF (val))
@@ -1660,15 +2564,15 @@ pvm_make_exception (int code, char *message, int exit_status)
 
   exception = pvm_make_struct (nfields, nmethods, type);
 
-  PVM_VAL_SCT_FIELD_NAME (exception, 0) = code_name;
+  pvm_set_struct_field_name (exception, 0, code_name);
   PVM_VAL_SCT_FIELD_VALUE (exception, 0)
     = PVM_MAKE_INT (code, 32);
 
-  PVM_VAL_SCT_FIELD_NAME (exception, 1) = msg_name;
+  pvm_set_struct_field_name (exception, 1, msg_name);
   PVM_VAL_SCT_FIELD_VALUE (exception, 1)
     = pvm_make_string (message);
 
-  PVM_VAL_SCT_FIELD_NAME (exception, 2) = exit_status_name;
+  pvm_set_struct_field_name (exception, 2, exit_status_name);
   PVM_VAL_SCT_FIELD_VALUE (exception, 2)
     = PVM_MAKE_INT (exit_status, 32);
 
@@ -1684,13 +2588,34 @@ pvm_val_cls_program (pvm_val cls)
 void
 pvm_val_initialize (void)
 {
+  int signed_p, size;
+
   pvm_alloc_add_gc_roots (&string_type, 1);
   pvm_alloc_add_gc_roots (&void_type, 1);
   pvm_alloc_add_gc_roots (&any_type, 1);
+  pvm_alloc_add_gc_roots (&integral_types,
+                          sizeof (integral_types) / sizeof (void *));
+  pvm_alloc_add_gc_roots (&struct_layouts, 1);
+
+  struct_layouts_size = PVM_STRUCT_LAYOUTS_INITIAL_SIZE;
+  struct_layouts_count = 0;
+  struct_layouts = pvm_alloc (struct_layouts_size
+                              * sizeof (*struct_layouts));
+  memset (struct_layouts, 0,
+          struct_layouts_size * sizeof (*struct_layouts));
 
   string_type = pvm_make_type (PVM_TYPE_STRING);
   void_type = pvm_make_type (PVM_TYPE_VOID);
   any_type = pvm_make_type (PVM_TYPE_ANY);
+
+  for (signed_p = 0; signed_p < 2; ++signed_p)
+    {
+      integral_types[signed_p][0] = PVM_NULL;
+      for (size = 1; size <= PVM_MAX_INTEGRAL_SIZE; ++size)
+        integral_types[signed_p][size]
+          = pvm_make_integral_type (pvm_make_ulong (size, 64),
+                                    PVM_MAKE_INT (signed_p, 32));
+    }
 }
 
 void
@@ -1699,4 +2624,7 @@ pvm_val_finalize (void)
   pvm_alloc_remove_gc_roots (&string_type, 1);
   pvm_alloc_remove_gc_roots (&void_type, 1);
   pvm_alloc_remove_gc_roots (&any_type, 1);
+  pvm_alloc_remove_gc_roots (&integral_types,
+                             sizeof (integral_types) / sizeof (void *));
+  pvm_alloc_remove_gc_roots (&struct_layouts, 1);
 }
@@ -45,7 +45,15 @@
 #define PVM_VAL_TAG_TYP 0xc
 #define PVM_VAL_TAG_CLS 0xd
 
-#define PVM_VAL_BOXED_P(V) (PVM_VAL_TAG((V)) > 1)
+/* Note that long integers and offsets may or may not be boxed.  See
+   below.  */
+
+#define PVM_VAL_BOXED_P(V)                                      \
+  (PVM_VAL_TAG((V)) > 1                                         \
+   && !((PVM_VAL_TAG((V)) == PVM_VAL_TAG_LONG                   \
+         || PVM_VAL_TAG((V)) == PVM_VAL_TAG_ULONG)              \
+        && _PVM_VAL_LONG_ULONG_UNBOXED_P ((V)))                 \
+   && !_PVM_VAL_OFF_UNBOXED_P ((V)))
 
 /* Integers up to 32-bit are unboxed and encoded the following way:
 
@@ -77,11 +85,24 @@
 
 #define PVM_MAX_UINT(size) ((1U << (size)) - 1)
 
-/* Long integers, wider than 32-bit and up to 64-bit, are boxed.  A
-   pointer
+/* Long integers, wider than 32-bit and up to 64-bit, are unboxed if
+   their value fits in 54 bits, which covers the bit offsets and sizes
+   of any practical IO space.  They are encoded the following way:
+
+                          val                          bits  tag
+                          ---                          ----  ---
+      vvvv vvvv ... vvvv vvvv vvvv vvvv vvvv vvbb bbbb 1ttt
+
+   BITS+1 is the size of the integral value in bits, from 0 to 63.
+
+   VAL is the value of the integer, sign- or zero-extended to 54
+   bits.
+
+   Other long integers are boxed.  A pointer
+
                                              tag
                                              ---
-         pppp pppp pppp pppp pppp pppp pppp pttt
+         pppp pppp pppp pppp pppp pppp pppp 0ttt
 
    points to a pair of 64-bit words:
 
@@ -95,27 +116,74 @@
    BITS+1 is the size of the integral value in bits, from 0 to 63.
 
    VAL is the value of the integer, sign- or zero-extended to 64 bits.
-   Bits marked with `x' are unused.  */
-
-#define _PVM_VAL_LONG_ULONG_VAL(V) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[0])
-#define _PVM_VAL_LONG_ULONG_SIZE(V) ((int) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[1]) + 1)
-
-#define PVM_MAKE_LONG_ULONG(V,S,T)                       \
-  ({ uint64_t *ll = pvm_alloc (sizeof (uint64_t) * 2);   \
-    ll[0] = (V);                                         \
-    ll[1] = ((S) - 1) & 0x3f;                            \
-    ((uint64_t) (uintptr_t) ll) | (T); })
+   Bits marked with `x' are unused.
+
+   The pair is allocated aligned to 16 bytes, so the bit that
+   distinguishes unboxed long integers is always 0 in the pointer.  */
+
+#define PVM_LONG_ULONG_UNBOXED_BITS 54
+
+#define _PVM_VAL_LONG_ULONG_UNBOXED_P(V) (((V) & 0x8) != 0)
+#define _PVM_VAL_LONG_ULONG_BOX(V) ((int64_t *) ((((uintptr_t) V) & ~0x7)))
+#define _PVM_VAL_LONG_ULONG_VAL(V) (_PVM_VAL_LONG_ULONG_BOX (V)[0])
+#define _PVM_VAL_LONG_ULONG_SIZE(V)                     \
+  (_PVM_VAL_LONG_ULONG_UNBOXED_P (V)                    \
+   ? (int) (((V) >> 4) & 0x3f) + 1                      \
+   : (int) _PVM_VAL_LONG_ULONG_BOX (V)[1] + 1)
+
+#define _PVM_MAKE_LONG_ULONG_UNBOXED(V,S,T)                     \
+  ((((uint64_t) (V)) << (64 - PVM_LONG_ULONG_UNBOXED_BITS))     \
+   | ((uint64_t) (((S) - 1) & 0x3f) << 4)                       \
+   | 0x8 | (T))
+
+#define PVM_MAKE_LONG_ULONG(V,S,T)                                      \
+  ({ uint64_t _v = (V);                                                 \
+     int _s = (S);                                                      \
+     int _fits_p;                                                       \
+     uint64_t _res;                                                     \
+                                                                        \
+     if ((T) == PVM_VAL_TAG_LONG)                                       \
+       {                                                                \
+         _v = (uint64_t) (((int64_t) (_v << (64 - _s))) >> (64 - _s));  \
+         _fits_p                                                        \
+           = ((((int64_t) (_v << (64 - PVM_LONG_ULONG_UNBOXED_BITS)))   \
+               >> (64 - PVM_LONG_ULONG_UNBOXED_BITS))                   \
+              == (int64_t) _v);                                         \
+       }                                                                \
+     else                                                               \
+       {                                                                \
+         _v = (_v << (64 - _s)) >> (64 - _s);                           \
+         _fits_p = (_v >> PVM_LONG_ULONG_UNBOXED_BITS) == 0;            \
+       }                                                                \
+                                                                        \
+     if (_fits_p)                                                       \
+       _res = _PVM_MAKE_LONG_ULONG_UNBOXED (_v, _s, (T));               \
+     else                                                               \
+       {                                                                \
+         uint64_t *ll = pvm_alloc_aligned (16, sizeof (uint64_t) * 2);  \
+                                                                        \
+         ll[0] = _v;                                                    \
+         ll[1] = (_s - 1) & 0x3f;                                       \
+         _res = ((uint64_t) (uintptr_t) ll) | (T);                      \
+       }                                                                \
+     _res; })
 
 #define PVM_VAL_LONG_SIZE(V) (_PVM_VAL_LONG_ULONG_SIZE (V))
-#define PVM_VAL_LONG(V) (_PVM_VAL_LONG_ULONG_VAL ((V))           \
-                         << (64 - PVM_VAL_LONG_SIZE ((V)))      \
-                         >> (64 - PVM_VAL_LONG_SIZE ((V))))
+#define PVM_VAL_LONG(V)                                                 \
+  (_PVM_VAL_LONG_ULONG_UNBOXED_P (V)                                    \
+   ? ((int64_t) (V)) >> (64 - PVM_LONG_ULONG_UNBOXED_BITS)              \
+   : ((int64_t) ((uint64_t) _PVM_VAL_LONG_ULONG_VAL ((V))               \
+                 << (64 - PVM_VAL_LONG_SIZE ((V)))))                    \
+     >> (64 - PVM_VAL_LONG_SIZE ((V))))
 #define PVM_MAKE_LONG(V,S)                              \
   (PVM_MAKE_LONG_ULONG ((V),(S),PVM_VAL_TAG_LONG))
 
 #define PVM_VAL_ULONG_SIZE(V) (_PVM_VAL_LONG_ULONG_SIZE (V))
-#define PVM_VAL_ULONG(V) (_PVM_VAL_LONG_ULONG_VAL ((V))                 \
-                          & ((uint64_t) (~( ((~0ull) << ((PVM_VAL_ULONG_SIZE ((V)))-1)) << 1 ))))
+#define PVM_VAL_ULONG(V)                                                \
+  (_PVM_VAL_LONG_ULONG_UNBOXED_P (V)                                    \
+   ? ((uint64_t) (V)) >> (64 - PVM_LONG_ULONG_UNBOXED_BITS)             \
+   : (_PVM_VAL_LONG_ULONG_VAL ((V))                                     \
+      & ((uint64_t) (~( ((~0ull) << ((PVM_VAL_ULONG_SIZE ((V)))-1)) << 1 )))))
 #define PVM_MAKE_ULONG(V,S)                             \
   (PVM_MAKE_LONG_ULONG ((V),(S),PVM_VAL_TAG_ULONG))
 
@@ -127,11 +195,12 @@
 /* XXX: implement big integers.  */
 
 /* A pointer to a boxed value is encoded in the most significative 61
-   bits of pvm_val (32 bits for 32-bit hosts).  Note that this assumes
-   all pointers are aligned to 8 bytes.  The allocator for the boxed
-   values makes sure this is always the case.  */
+   bits of pvm_val (32 bits for 32-bit hosts).  Boxes are allocated
+   aligned to 16 bytes, so the bit 3 of the pointer is always 0.  If
+   it is set, the value is an unboxed offset instead.  See below.  */
 
 #define PVM_VAL_BOX(V) ((pvm_val_box) ((((uintptr_t) V) & ~0x7)))
+#define _PVM_VAL_BOX_P(V) (((V) & 0xf) == PVM_VAL_TAG_BOX)
 
 /* This constructor should be used in order to build boxes.  */
 
@@ -242,7 +311,36 @@ struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
    NALLOCATED is the number of elements allocated in the array.
 
    ELEMS is a list of elements.  The order of the elements is
-   relevant.  */
+   relevant.
+
+   EMAPPER is a closure that maps an element of the array.  It is
+   PVM_NULL unless the array has been mapped lazily, i.e. unless some
+   of its elements may not have been mapped yet.  These elements have
+   a PVM_NULL value, and are mapped the first time they are accessed
+   by calling EMAPPER with the strictness and the IO space of the
+   array and the bit-offset of the element as arguments.  See
+   RAS_MACRO_AREF in pkl-asm.pks.
+
+   VM is the virtual machine in which EMAPPER runs when the elements
+   are accessed from C.  See pvm_array_elem_value_mapped in pvm.h.
+
+   ESIZE is the size in bits of every element of a lazily mapped
+   array or a packed array, and 0 for other arrays.
+
+   PACKED is a buffer holding the elements of arrays of integers,
+   which are stored there as native integers of 8, 16, 32 or 64 bits,
+   the smallest able to hold ESIZE bits.  ELEMS is not used in that
+   case.  The bit-offset of the element at index I is then implicit,
+   OFFSET + I * ESIZE, provided OFFSET is not PVM_NULL.  Storing a
+   value of any other kind in the array turns it into a regular
+   array, and PACKED is then NULL.  See pvm_array_unpack in
+   pvm-val.c.
+
+   PACKED_SIGNED_P is 1 if the integers in PACKED are signed, 0
+   otherwise.
+
+   Note that PVM_VAL_ARR_ELEM_* shall not be used with packed arrays.
+   Use pvm_array_elem_value and pvm_array_elem_offset instead.  */
 
 #define PVM_VAL_ARR(V) (PVM_VAL_BOX_ARR (PVM_VAL_BOX ((V))))
 #define PVM_VAL_ARR_MAPINFO(V) (PVM_VAL_ARR(V)->mapinfo)
@@ -260,6 +358,12 @@ struct pvm_mapinfo pvm_make_mapinfo (int mapped_p, pvm_val ios,
 #define PVM_VAL_ARR_NALLOCATED(V) (PVM_VAL_ARR(V)->nallocated)
 #define PVM_VAL_ARR_ELEMS(V) (PVM_VAL_ARR(V)->elems)
 #define PVM_VAL_ARR_ELEM(V,I) (PVM_VAL_ARR(V)->elems[(I)])
+#define PVM_VAL_ARR_EMAPPER(V) (PVM_VAL_ARR(V)->emapper)
+#define PVM_VAL_ARR_VM(V) (PVM_VAL_ARR(V)->vm)
+#define PVM_VAL_ARR_ESIZE(V) (PVM_VAL_ARR(V)->esize)
+#define PVM_VAL_ARR_PACKED(V) (PVM_VAL_ARR(V)->packed)
+#define PVM_VAL_ARR_PACKED_P(V) (PVM_VAL_ARR_PACKED ((V)) != NULL)
+#define PVM_VAL_ARR_PACKED_SIGNED_P(V) (PVM_VAL_ARR(V)->packed_signed_p)
 
 struct pvm_array
 {
@@ -273,6 +377,11 @@ struct pvm_array
   pvm_val nelem;
   uint64_t nallocated;
   struct pvm_array_elem *elems;
+  pvm_val emapper;
+  struct pvm *vm;
+  uint64_t esize;
+  void *packed;
+  int packed_signed_p;
 };
 
 typedef struct pvm_array *pvm_array;
@@ -287,7 +396,9 @@ typedef struct pvm_array *pvm_array;
    OFFSET_BACK is a backup area used by the reloc instructions.
 
    VALUE is the value contained in the element.  If the array is
-   mapped this is the cached value, which is returned by `aref'.  */
+   mapped this is the cached value, which is returned by `arefc'.  It
+   is PVM_NULL if the array is mapped lazily and the element has not
+   been mapped yet.  */
 
 #define PVM_VAL_ARR_ELEM_OFFSET(V,I) (PVM_VAL_ARR_ELEM((V),(I)).offset)
 #define PVM_VAL_ARR_ELEM_OFFSET_BACK(V,I) (PVM_VAL_ARR_ELEM((V),(I)).offset_back)
@@ -314,15 +425,21 @@ struct pvm_array_elem
    TYPE is the type of the struct.  This includes the types of the
    struct fields.
 
-   NFIELDS is the number of fields conforming the structure.
+   LAYOUT is the layout of the struct, which contains the number of
+   fields and methods and their names.  Layouts are usually shared by
+   many struct values.  See struct pvm_struct_layout below.
 
-   FIELDS is a list of fields.  The order of the fields is
-   relevant.
+   METHODS is a list of NMETHODS closures, one per method.  The names
+   of the methods are in the layout.  The order of the methods is
+   irrelevant.
 
-   NMETHODS is the number of methods defined in the structure.
+   FIELDS_BACK is a backup of the offsets and modified flags of the
+   fields, used by the relocation instructions.  It is allocated the
+   first time the struct is relocated.
 
-   METHODS is a list of methods.  The order of the methods is
-   irrelevant.  */
+   FIELDS is a list of NFIELDS fields.  The order of the fields is
+   relevant.  The fields and the methods are allocated along with the
+   struct.  */
 
 #define PVM_VAL_SCT(V) (PVM_VAL_BOX_SCT (PVM_VAL_BOX ((V))))
 #define PVM_VAL_SCT_MAPINFO(V) (PVM_VAL_SCT((V))->mapinfo)
@@ -334,24 +451,55 @@ struct pvm_array_elem
 #define PVM_VAL_SCT_MAPPER(V) (PVM_VAL_SCT((V))->mapper)
 #define PVM_VAL_SCT_WRITER(V) (PVM_VAL_SCT((V))->writer)
 #define PVM_VAL_SCT_TYPE(V) (PVM_VAL_SCT((V))->type)
-#define PVM_VAL_SCT_NFIELDS(V) (PVM_VAL_SCT((V))->nfields)
+#define PVM_VAL_SCT_LAYOUT(V) (PVM_VAL_SCT((V))->layout)
+#define PVM_VAL_SCT_NFIELDS(V) (PVM_VAL_SCT_LAYOUT((V))->nfields)
 #define PVM_VAL_SCT_FIELD(V,I) (PVM_VAL_SCT((V))->fields[(I)])
-#define PVM_VAL_SCT_NMETHODS(V) (PVM_VAL_SCT((V))->nmethods)
-#define PVM_VAL_SCT_METHOD(V,I) (PVM_VAL_SCT((V))->methods[(I)])
+#define PVM_VAL_SCT_NMETHODS(V) (PVM_VAL_SCT_LAYOUT((V))->nmethods)
 
-struct pvm_struct
+/* Struct layouts contain the information that is common to all the
+   struct values having the same fields and methods, i.e. the number
+   of fields and methods and their names.
+
+   NFIELDS is the number of fields conforming the structure.
+
+   NMETHODS is the number of methods defined in the structure.
+
+   FIELD_NAMES contains the names of the fields.  A name is PVM_NULL
+   if the field is anonymous or absent.
+
+   METHOD_NAMES contains the names of the methods.  It is allocated
+   along with the layout, after FIELD_NAMES.
+
+   Layouts created by pvm_make_struct_layout are SHARED_P, and shall
+   not be modified.  Use pvm_set_struct_field_name in order to change
+   the name of a field of a struct value.
+
+   CACHE maps the names used to access the fields and methods of the
+   structs sharing the layout to their indexes in FIELD_NAMES, which
+   are followed by the names of the methods.  It is indexed by the
+   address of the accessing name, and it is only used in shared
+   layouts, whose names never change.  */
+
+#define PVM_STRUCT_LAYOUT_CACHE_SIZE 8
+
+struct pvm_struct_layout_cache_entry
+{
+  pvm_val name;
+  int64_t index;
+};
+
+struct pvm_struct_layout
 {
-  struct pvm_mapinfo mapinfo;
-  struct pvm_mapinfo mapinfo_back;
-  pvm_val mapper;
-  pvm_val writer;
-  pvm_val type;
   pvm_val nfields;
-  struct pvm_struct_field *fields;
   pvm_val nmethods;
-  struct pvm_struct_method *methods;
+  pvm_val *method_names;
+  int shared_p;
+  struct pvm_struct_layout_cache_entry cache[PVM_STRUCT_LAYOUT_CACHE_SIZE];
+  pvm_val field_names[];
 };
 
+typedef struct pvm_struct_layout *pvm_struct_layout;
+
 /* Struct fields hold the data of the fields, and/or information on
    how to obtain these values.
 
@@ -360,7 +508,8 @@ struct pvm_struct
    resides when stored.
 
    NAME is a string containing the name of the struct field.  This
-   name should be unique in the struct.
+   name should be unique in the struct.  It is stored in the layout
+   of the struct.
 
    VALUE is the value contained in the field.  If the struct is
    mapped then this is the cached value, which is returned by
@@ -374,14 +523,15 @@ struct pvm_struct
    struct is mapped.
 
    MODIFIED_BACK and OFFSET_BACK are backup storage used by the
-   relocation instructions.  */
+   relocation instructions.  They are stored in the FIELDS_BACK of
+   the struct.  */
 
 #define PVM_VAL_SCT_FIELD_OFFSET(V,I) (PVM_VAL_SCT_FIELD((V),(I)).offset)
-#define PVM_VAL_SCT_FIELD_NAME(V,I) (PVM_VAL_SCT_FIELD((V),(I)).name)
+#define PVM_VAL_SCT_FIELD_NAME(V,I) (PVM_VAL_SCT_LAYOUT((V))->field_names[(I)])
 #define PVM_VAL_SCT_FIELD_VALUE(V,I) (PVM_VAL_SCT_FIELD((V),(I)).value)
 #define PVM_VAL_SCT_FIELD_MODIFIED(V,I) (PVM_VAL_SCT_FIELD((V),(I)).modified)
-#define PVM_VAL_SCT_FIELD_MODIFIED_BACK(V,I) (PVM_VAL_SCT_FIELD((V),(I)).modified_back)
-#define PVM_VAL_SCT_FIELD_OFFSET_BACK(V,I) (PVM_VAL_SCT_FIELD((V),(I)).offset_back)
+#define PVM_VAL_SCT_FIELD_MODIFIED_BACK(V,I) (PVM_VAL_SCT((V))->fields_back[(I)].modified)
+#define PVM_VAL_SCT_FIELD_OFFSET_BACK(V,I) (PVM_VAL_SCT((V))->fields_back[(I)].offset)
 #define PVM_VAL_SCT_FIELD_ABSENT_P(V,I)         \
   (PVM_VAL_SCT_FIELD_NAME ((V),(I)) == PVM_NULL \
    && PVM_VAL_SCT_FIELD_VALUE ((V),(I)) == PVM_NULL)
@@ -389,29 +539,40 @@ struct pvm_struct
 struct pvm_struct_field
 {
   pvm_val offset;
-  pvm_val offset_back;
-  pvm_val name;
   pvm_val value;
   pvm_val modified;
-  pvm_val modified_back;
+};
+
+struct pvm_struct_field_back
+{
+  pvm_val offset;
+  pvm_val modified;
+};
+
+struct pvm_struct
+{
+  struct pvm_mapinfo mapinfo;
+  struct pvm_mapinfo mapinfo_back;
+  pvm_val mapper;
+  pvm_val writer;
+  pvm_val type;
+  struct pvm_struct_layout *layout;
+  pvm_val *methods;
+  struct pvm_struct_field_back *fields_back;
+  struct pvm_struct_field fields[];
 };
 
 /* Struct methods are closures associated with the struct, which can
    be invoked as functions.
 
    NAME is a string containing the name of the method.  This name
-   should be unique in the struct.
+   should be unique in the struct.  It is stored in the layout of the
+   struct.
 
    VALUE is a PVM closure.  */
 
-#define PVM_VAL_SCT_METHOD_NAME(V,I) (PVM_VAL_SCT_METHOD((V),(I)).name)
-#define PVM_VAL_SCT_METHOD_VALUE(V,I) (PVM_VAL_SCT_METHOD((V),(I)).value)
-
-struct pvm_struct_method
-{
-  pvm_val name;
-  pvm_val value;
-};
+#define PVM_VAL_SCT_METHOD_NAME(V,I) (PVM_VAL_SCT_LAYOUT((V))->method_names[(I)])
+#define PVM_VAL_SCT_METHOD_VALUE(V,I) (PVM_VAL_SCT((V))->methods[(I)])
 
 typedef struct pvm_struct *pvm_struct;
 
@@ -512,13 +673,72 @@ struct pvm_cls
 
 typedef struct pvm_cls *pvm_cls;
 
-/* Offsets are boxed values.  */
+/* Offsets whose unit is a power of two up to 2^53, like bits,
+   nibbles and bytes, and whose magnitude fits in 46 bits are not
+   boxed.  They are encoded the following way:
+
+            magnitude            unit    bits  mt     tag
+            ---------            ----    ----  --     ---
+     mmmm mmmm ... mmmm mmmm mm uuuu uubb bbbb mm 1110
+
+   MT is the tag of the magnitude, one of PVM_VAL_TAG_INT,
+   PVM_VAL_TAG_UINT, PVM_VAL_TAG_LONG or PVM_VAL_TAG_ULONG.  BITS+1 is
+   its size in bits.  MAGNITUDE is its value, sign- or zero-extended
+   to 46 bits.  UNIT is the base 2 logarithm of the unit.
+
+   The tag is the one of boxed values, with the bit 3 set: this bit
+   is always 0 in the pointers to boxes.
+
+   Other offsets are boxed values.  The base type of an offset is
+   always the type of its magnitude.  For unboxed offsets it is
+   derived from MT and BITS, without making the magnitude.  */
+
+#define PVM_OFF_UNBOXED_BITS 46
+#define PVM_OFF_UNBOXED_MAX_UNIT 53
+
+#define _PVM_VAL_OFF_UNBOXED_P(V) (((V) & 0xf) == (0x8 | PVM_VAL_TAG_BOX))
+#define _PVM_VAL_OFF_UNBOXED_MAGNITUDE(V)                               \
+  ({ pvm_val _off = (V);                                                \
+     int _off_size = (int) ((_off >> 6) & 0x3f) + 1;                    \
+     int64_t _off_mag = ((int64_t) _off) >> (64 - PVM_OFF_UNBOXED_BITS); \
+     uint64_t _off_umag = _off >> (64 - PVM_OFF_UNBOXED_BITS);          \
+     pvm_val _off_res;                                                  \
+                                                                        \
+     switch ((_off >> 4) & 0x3)                                         \
+       {                                                                \
+       case PVM_VAL_TAG_INT:                                            \
+         _off_res = PVM_MAKE_INT (_off_mag, _off_size);                 \
+         break;                                                         \
+       case PVM_VAL_TAG_UINT:                                           \
+         _off_res = PVM_MAKE_UINT (_off_umag, _off_size);               \
+         break;                                                         \
+       case PVM_VAL_TAG_LONG:                                           \
+         _off_res = _PVM_MAKE_LONG_ULONG_UNBOXED (_off_mag, _off_size,  \
+                                                  PVM_VAL_TAG_LONG);    \
+         break;                                                         \
+       default:                                                         \
+         _off_res = _PVM_MAKE_LONG_ULONG_UNBOXED (_off_umag, _off_size, \
+                                                  PVM_VAL_TAG_ULONG);   \
+         break;                                                         \
+       }                                                                \
+     _off_res; })
 
 #define PVM_VAL_OFF(V) (PVM_VAL_BOX_OFF (PVM_VAL_BOX ((V))))
 
-#define PVM_VAL_OFF_MAGNITUDE(V) (PVM_VAL_OFF((V))->magnitude)
-#define PVM_VAL_OFF_UNIT(V) (PVM_VAL_OFF((V))->unit)
-#define PVM_VAL_OFF_BASE_TYPE(V) (PVM_VAL_OFF((V))->base_type)
+#define PVM_VAL_OFF_MAGNITUDE(V)                        \
+  (_PVM_VAL_OFF_UNBOXED_P ((V))                         \
+   ? _PVM_VAL_OFF_UNBOXED_MAGNITUDE ((V))               \
+   : PVM_VAL_OFF((V))->magnitude)
+#define PVM_VAL_OFF_UNIT(V)                                             \
+  (_PVM_VAL_OFF_UNBOXED_P ((V))                                         \
+   ? _PVM_MAKE_LONG_ULONG_UNBOXED ((uint64_t) 1 << (((V) >> 12) & 0x3f), \
+                                   64, PVM_VAL_TAG_ULONG)               \
+   : PVM_VAL_OFF((V))->unit)
+#define PVM_VAL_OFF_BASE_TYPE(V)                                \
+  (_PVM_VAL_OFF_UNBOXED_P ((V))                                 \
+   ? pvm_integral_type ((int) (((V) >> 6) & 0x3f) + 1,          \
+                        !(((V) >> 4) & 0x1))                    \
+   : PVM_VAL_OFF((V))->base_type)
 
 #define PVM_VAL_OFF_UNIT_BITS 1
 #define PVM_VAL_OFF_UNIT_NIBBLES 4
@@ -552,23 +772,24 @@ typedef struct pvm_off *pvm_off;
 #define PVM_IS_LONG(V) (PVM_VAL_TAG(V) == PVM_VAL_TAG_LONG)
 #define PVM_IS_ULONG(V) (PVM_VAL_TAG(V) == PVM_VAL_TAG_ULONG)
 #define PVM_IS_STR(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+  (_PVM_VAL_BOX_P ((V))                                                 \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_STR)
 #define PVM_IS_ARR(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+  (_PVM_VAL_BOX_P ((V))                                                 \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_ARR)
 #define PVM_IS_SCT(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+  (_PVM_VAL_BOX_P ((V))                                                 \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_SCT)
 #define PVM_IS_TYP(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+  (_PVM_VAL_BOX_P ((V))                                                 \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_TYP)
 #define PVM_IS_CLS(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+  (_PVM_VAL_BOX_P ((V))                                                 \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_CLS)
 #define PVM_IS_OFF(V)                                                   \
-  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
-   && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_OFF)
+  (_PVM_VAL_OFF_UNBOXED_P ((V))                                         \
+   || (_PVM_VAL_BOX_P ((V))                                             \
+       && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_OFF))
 
 
 #define PVM_IS_INTEGRAL(V)                                      \
@@ -697,6 +918,24 @@ typedef struct pvm_off *pvm_off;
         PVM_VAL_ARR_SIZE_BOUND ((V)) = (O);     \
     } while (0)
 
+/* Return a shared struct layout having NFIELDS fields and NMETHODS
+   methods.  NAMES contains the names of the fields followed by the
+   names of the methods.  If NAMES is NULL, all the names are
+   PVM_NULL.
+
+   Struct values having the same names get the same layout, provided
+   the names are the same PVM values.  Shared layouts are reclaimed by
+   the garbage collector once no struct uses them.  */
+
+pvm_struct_layout pvm_make_struct_layout (pvm_val nfields, pvm_val nmethods,
+                                          const pvm_val *names);
+
+/* Return the type of the integers of SIZE bits, which are signed if
+   SIGNED_P is set.  These types are made once and shared, so this
+   doesn't allocate memory.  */
+
+pvm_val pvm_integral_type (int size, int signed_p);
+
 void pvm_allocate_struct_attrs (pvm_val nfields, pvm_val **fnames,
                                 pvm_val **ftypes);
 void pvm_allocate_closure_attrs (pvm_val nargs, pvm_val **atypes);
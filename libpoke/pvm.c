@@ -29,6 +29,7 @@
 
 #include "pvm-alloc.h"
 #include "pvm-program.h"
+#include "pvm-val.h"
 #include "pvm-vm.h"
 
 /* The following struct defines a Poke Virtual Machine.  */
@@ -53,6 +54,8 @@
   ((PVM)->pvm_state.pvm_state_runtime.obase)
 #define PVM_STATE_OMAPS(PVM)                            \
   ((PVM)->pvm_state.pvm_state_runtime.omaps)
+#define PVM_STATE_LAZY_MAPS(PVM)                        \
+  ((PVM)->pvm_state.pvm_state_runtime.lazy_maps)
 #define PVM_STATE_ODEPTH(PVM)                           \
   ((PVM)->pvm_state.pvm_state_runtime.odepth)
 #define PVM_STATE_OINDENT(PVM)                          \
@@ -70,6 +73,13 @@ struct pvm
   /* If not NULL, this is the compiler to be used when the PVM needs
      to build programs.  */
   pkl_compiler compiler;
+
+  /* Program used by pvm_array_elem_value_mapped to map elements of
+     lazily mapped arrays, or NULL if it has not been built yet.  It
+     is built once and takes the array and the index of the element
+     from the two elements of AREF_ARGS.  */
+  pvm_program aref_program;
+  pvm_val aref_args;
 };
 
 static void
@@ -80,6 +90,7 @@ pvm_initialize_state (pvm apvm, struct pvm_state *state)
 
   /* Register GC roots.  */
   pvm_alloc_add_gc_roots (&state->pvm_state_runtime.env, 1);
+  pvm_alloc_add_gc_roots (&apvm->aref_args, 1);
   pvm_alloc_add_gc_roots
     (state->pvm_state_backing.jitter_stack_stack_backing.memory,
      state->pvm_state_backing.jitter_stack_stack_backing.element_no);
@@ -193,14 +204,80 @@ pvm_call_closure (pvm vm, pvm_val cls, ...)
 
 }
 
+/* Build the program run by pvm_array_elem_value_mapped in VM.  */
+
+static void
+pvm_build_aref_program (pvm vm)
+{
+  pvm_val type = pvm_make_array_type (pvm_make_any_type (), PVM_NULL);
+  pkl_asm pasm;
+
+  vm->aref_args = pvm_make_array (pvm_make_ulong (2, 64), type);
+  PVM_VAL_ARR_NELEM (vm->aref_args) = pvm_make_ulong (2, 64);
+
+  pasm = pkl_asm_new (NULL /* ast */,
+                      pvm_compiler (vm), 1 /* prologue */);
+
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, vm->aref_args);   /* ARGS */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (0, 64));
+  pkl_asm_insn (pasm, PKL_INSN_AREFC);                 /* ARGS 0UL ARR */
+  pkl_asm_insn (pasm, PKL_INSN_NIP);                   /* ARGS ARR */
+  pkl_asm_insn (pasm, PKL_INSN_SWAP);                  /* ARR ARGS */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (1, 64));
+  pkl_asm_insn (pasm, PKL_INSN_AREFC);                 /* ARR ARGS 1UL IDX */
+  pkl_asm_insn (pasm, PKL_INSN_NIP2);                  /* ARR IDX */
+
+  /* The `aref' macro-instruction maps the element and caches its
+     value in the array.  */
+  pkl_asm_insn (pasm, PKL_INSN_AREF);                  /* ARR IDX VAL */
+  pkl_asm_insn (pasm, PKL_INSN_NIP2);                  /* VAL */
+
+  vm->aref_program = pkl_asm_finish (pasm, 1 /* epilogue */);
+  pvm_program_make_executable (vm->aref_program);
+}
+
+pvm_val
+pvm_array_elem_value_mapped (pvm_val arr, uint64_t idx)
+{
+  pvm vm = PVM_VAL_ARR_VM (arr);
+  pvm_val val = pvm_array_elem_value (arr, idx);
+
+  if (val != PVM_NULL
+      || PVM_VAL_ARR_EMAPPER (arr) == PVM_NULL
+      || vm == NULL
+      || pvm_compiler (vm) == NULL)
+    return val;
+
+  if (vm->aref_program == NULL)
+    pvm_build_aref_program (vm);
+
+  /* The arguments are on the stack once the program starts, so the
+     mapper may use pvm_array_elem_value_mapped recursively.  */
+  PVM_VAL_ARR_ELEM_VALUE (vm->aref_args, 0) = arr;
+  PVM_VAL_ARR_ELEM_VALUE (vm->aref_args, 1) = pvm_make_ulong (idx, 64);
+  if (pvm_run (vm, vm->aref_program, &val) != PVM_EXIT_OK)
+    val = PVM_NULL;
+
+  /* Do not keep the array alive.  */
+  PVM_VAL_ARR_ELEM_VALUE (vm->aref_args, 0) = PVM_NULL;
+  PVM_VAL_ARR_ELEM_VALUE (vm->aref_args, 1) = PVM_NULL;
+
+  return val;
+}
+
 void
 pvm_shutdown (pvm apvm)
 {
   /* Finalize pvm-program.  */
   pvm_program_fini ();
 
+  /* Destroy the program used to map array elements.  */
+  if (apvm->aref_program)
+    pvm_destroy_program (apvm->aref_program);
+
   /* Deregister GC roots.  */
   pvm_alloc_remove_gc_roots (&PVM_STATE_ENV (apvm), 1);
+  pvm_alloc_remove_gc_roots (&apvm->aref_args, 1);
   pvm_alloc_remove_gc_roots
     (apvm->pvm_state.pvm_state_backing.jitter_stack_stack_backing.memory,
      apvm->pvm_state.pvm_state_backing.jitter_stack_stack_backing.element_no);
@@ -298,6 +375,18 @@ pvm_set_omaps (pvm apvm, int omaps)
   PVM_STATE_OMAPS (apvm) = omaps;
 }
 
+int
+pvm_lazy_maps (pvm apvm)
+{
+  return PVM_STATE_LAZY_MAPS (apvm);
+}
+
+void
+pvm_set_lazy_maps (pvm apvm, int lazy_maps)
+{
+  PVM_STATE_LAZY_MAPS (apvm) = lazy_maps;
+}
+
 unsigned int
 pvm_oindent (pvm apvm)
 {
@@ -233,6 +233,11 @@ pvm_val pvm_make_offset (pvm_val magnitude, pvm_val unit);
 
 pvm_val pvm_make_array (pvm_val nelem, pvm_val type);
 
+/* Make an array PVM value of type uint<8>[] containing the COUNT
+   bytes in BYTES.  */
+
+pvm_val pvm_make_byte_array (const uint8_t *bytes, size_t count);
+
 /* Make a struct PVM value.
 
    NFIELDS is an ulong<64> PVM value specifying the number of fields
@@ -266,6 +271,13 @@ void pvm_print_string (pvm_val string);
 pvm_val pvm_ref_struct (pvm_val sct, pvm_val name);
 pvm_val pvm_ref_struct_cstr (pvm_val sct, const char *name);
 
+/* Like pvm_ref_struct, but INDEX is the expected position of the
+   field NAME in SCT.  If the hint is wrong the field is looked up by
+   name.  Repeated accesses using the same NAME are resolved by the
+   cache of the layout of SCT without comparing strings.  */
+
+pvm_val pvm_ref_struct_hint (pvm_val sct, pvm_val name, uint64_t index);
+
 /* Given a struct value SCT and the name of a field in NAME, return
    the bit-offset of the referred field in BOFF.
 
@@ -275,6 +287,11 @@ pvm_val pvm_refo_struct (pvm_val sct, pvm_val name);
 
 int pvm_set_struct (pvm_val sct, pvm_val name, pvm_val val);
 
+/* Set the name of the field occupying the position IDX in the struct
+   SCT to NAME.  */
+
+void pvm_set_struct_field_name (pvm_val sct, uint64_t idx, pvm_val name);
+
 pvm_val pvm_get_struct_method (pvm_val sct, const char *name);
 
 pvm_val pvm_make_integral_type (pvm_val size, pvm_val signed_p);
@@ -302,6 +319,43 @@ int pvm_type_equal_p (pvm_val type1, pvm_val type2);
 
 pvm_program pvm_val_cls_program (pvm_val cls);
 
+/* Append NELEM integers of size BITS to the array ARR, peeking them
+   from the space IO at the bit-offset BOFFSET, where they are stored
+   one after the other.  The integers are signed if SIGNED_P is not
+   zero, and are read with the byte endianness ENDIAN.
+
+   Integers of 8, 16, 32 and 64 bits are read in bulk.  Return IOS_OK
+   if all the integers could be read, or an IOS error code otherwise.  */
+
+int pvm_array_peek_integral (pvm_val arr, ios io, ios_off boffset,
+                             uint64_t nelem, int bits, int signed_p,
+                             enum ios_endian endian);
+
+/* Append NELEM elements to the array ARR, to be mapped lazily.  The
+   elements are ESIZE bits long and are stored one after the other in
+   IO, starting at the bit-offset BOFFSET.  Their values are PVM_NULL
+   until they are mapped by the closure EMAPPER, which is installed in
+   the array.  */
+
+void pvm_array_insert_lazy (pvm_val arr, uint64_t boffset, uint64_t nelem,
+                            uint64_t esize, pvm_val emapper);
+
+/* Return the value of the element occupying the position IDX in the
+   array ARR.  This works for both packed and unpacked arrays.  */
+
+pvm_val pvm_array_elem_value (pvm_val arr, uint64_t idx);
+
+/* Return the bit-offset of the element occupying the position IDX in
+   the array ARR, or PVM_NULL if the element has no offset.  */
+
+pvm_val pvm_array_elem_offset (pvm_val arr, uint64_t idx);
+
+/* Set the bit-offset of the element occupying the position IDX in the
+   array ARR to OFFSET.  If the array is packed and OFFSET is not the
+   implicit offset of the element, the array is unpacked.  */
+
+void pvm_array_set_elem_offset (pvm_val arr, uint64_t idx, pvm_val offset);
+
 /* Insert the value VAL in the array ARR past to the last element.
    IDX is an ulong<64> denoting the index of the new element.
 
@@ -359,6 +413,12 @@ void pvm_val_ureloc (pvm_val val);
    map-able then this is a no-operation.  */
 void pvm_val_unmap (pvm_val val);
 
+/* Return an array with the lazily mapped arrays contained in VAL,
+   including VAL itself, having elements that have not been mapped
+   yet.  The returned array is empty if there are no such arrays.  */
+
+pvm_val pvm_val_pending_arrays (pvm_val val);
+
 /* Return a PVM value for an exception with the given CODE, MESSAGE
    and EXIT_STATUS.  */
 
@@ -589,6 +649,13 @@ enum pvm_exit_code pvm_run (pvm vm,
 
 void pvm_call_closure (pvm vm, pvm_val cls, ...);
 
+/* Return the value of the element occupying the position IDX in the
+   array ARR, like pvm_array_elem_value, but mapping the element first
+   if the array was mapped lazily and the element has not been mapped
+   yet.  Return PVM_NULL if mapping the element fails.  */
+
+pvm_val pvm_array_elem_value_mapped (pvm_val arr, uint64_t idx);
+
 /* Get/set the current byte endianness of a virtual machine.
 
    The current endianness is used by certain VM instructions that
@@ -622,6 +689,17 @@ int pvm_pretty_print (pvm pvm);
 
 void pvm_set_pretty_print (pvm pvm, int pretty_print_p);
 
+/* Get/set the lazy maps flag in a virtual machine.
+
+   LAZY_MAPS_P is a boolean indicating whether to map the elements of
+   arrays lazily, i.e. the first time they are accessed, when the
+   size of the elements and the number of elements in the arrays are
+   known.  */
+
+int pvm_lazy_maps (pvm pvm);
+
+void pvm_set_lazy_maps (pvm pvm, int lazy_maps_p);
+
 /* Get/set the output parameters configured in a virtual machine.
 
    OBASE is the numeration based to be used when printing PVM values.
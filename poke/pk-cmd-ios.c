@@ -22,6 +22,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <readline.h>
 #include "xalloc.h"
@@ -181,6 +183,17 @@ print_info_ios (pk_ios io, void *data)
     free (size);
   }
 
+  /* Modified data pending to be written to the device.  */
+  {
+    struct pk_ios_stats stats;
+    char *size;
+
+    pk_ios_get_stats (io, &stats);
+    asprintf (&size, "0x%08jx#B", stats.dirty);
+    pk_table_column_cl (table, size, "offset");
+    free (size);
+  }
+
   /* Name.  */
 #if HAVE_HSERVER
   if (poke_hserver_p)
@@ -200,6 +213,74 @@ print_info_ios (pk_ios io, void *data)
   pk_table_column (table, pk_ios_handler (io));
 }
 
+static void
+print_info_ios_stats (pk_ios io, void *data)
+{
+  struct pk_ios_stats stats;
+  pk_table table = (pk_table) data;
+  uint64_t requests;
+  char *str;
+
+  pk_ios_get_stats (io, &stats);
+  requests = stats.reads + stats.writes;
+
+  pk_table_row (table);
+
+  /* Id.  */
+  asprintf (&str, "%s#%d",
+            io == pk_ios_cur (poke_compiler) ? "* " : "  ",
+            pk_ios_get_id (io));
+  pk_table_column (table, str);
+  free (str);
+
+  /* Number of requests.  */
+  asprintf (&str, "%ju", stats.reads);
+  pk_table_column (table, str);
+  free (str);
+  asprintf (&str, "%ju", stats.writes);
+  pk_table_column (table, str);
+  free (str);
+
+  /* Bytes transferred, and average size of the requests.  */
+  asprintf (&str, "%ju#B", stats.bytes_read);
+  pk_table_column_cl (table, str, "offset");
+  free (str);
+  asprintf (&str, "%ju#B", stats.bytes_written);
+  pk_table_column_cl (table, str, "offset");
+  free (str);
+  asprintf (&str, "%ju#B",
+            requests
+            ? (stats.bytes_read + stats.bytes_written) / requests : 0);
+  pk_table_column_cl (table, str, "offset");
+  free (str);
+
+  /* Cache lookups, and writes absorbed by the cache.  */
+  asprintf (&str, "%ju", stats.cache_hits);
+  pk_table_column (table, str);
+  free (str);
+  asprintf (&str, "%ju", stats.cache_misses);
+  pk_table_column (table, str);
+  free (str);
+  asprintf (&str, "%ju", stats.cache_writes);
+  pk_table_column (table, str);
+  free (str);
+
+  /* Time spent in the device requests.  */
+  asprintf (&str, "%.3fms", stats.nsecs / 1e6);
+  pk_table_column (table, str);
+  free (str);
+}
+
+static void
+reset_ios_stats (pk_ios io, void *data)
+{
+  pk_ios_reset_stats (io);
+}
+
+#define PK_INFO_IOS_UFLAGS "sr"
+#define PK_INFO_IOS_F_STATS 0x1
+#define PK_INFO_IOS_F_RESET 0x2
+
 static int
 pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
@@ -207,12 +288,40 @@ pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 
   assert (argc == 0);
 
-  table = pk_table_new (5);
+  if (uflags & PK_INFO_IOS_F_STATS)
+    {
+      table = pk_table_new (10);
+      pk_table_row_cl (table, "table-header");
+      pk_table_column (table, "  Id");
+      pk_table_column (table, "Reads");
+      pk_table_column (table, "Writes");
+      pk_table_column (table, "Read");
+      pk_table_column (table, "Written");
+      pk_table_column (table, "Avg");
+      pk_table_column (table, "Hits");
+      pk_table_column (table, "Misses");
+      pk_table_column (table, "Absorbed");
+      pk_table_column (table, "Time");
+
+      pk_ios_map (poke_compiler, print_info_ios_stats, table);
+
+      pk_table_print (table);
+      pk_table_free (table);
+    }
+
+  if (uflags & PK_INFO_IOS_F_RESET)
+    pk_ios_map (poke_compiler, reset_ios_stats, NULL);
+
+  if (uflags)
+    return 1;
+
+  table = pk_table_new (6);
   pk_table_row_cl (table, "table-header");
   pk_table_column (table, "  Id");
   pk_table_column (table, "Type");
   pk_table_column (table, "Mode");
   pk_table_column (table, "Size");
+  pk_table_column (table, "Dirty");
   pk_table_column (table, "Name");
 
   pk_ios_map (poke_compiler, print_info_ios, table);
@@ -367,6 +476,167 @@ pk_cmd_nbd (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 }
 #endif /* HAVE_LIBNBD */
 
+/* Return the IO space denoted by the optional tag argument ARG,
+   which defaults to the current IO space, or NULL if there is no
+   such space.  */
+
+static pk_ios
+pk_cmd_cow_ios (struct pk_cmd_arg arg)
+{
+  int io_id;
+  pk_ios io;
+
+  if (PK_CMD_ARG_TYPE (arg) == PK_CMD_ARG_NULL)
+    return pk_ios_cur (poke_compiler);
+
+  io_id = PK_CMD_ARG_TAG (arg);
+  io = pk_ios_search_by_id (poke_compiler, io_id);
+  if (io == NULL)
+    pk_printf (_("No such IO space: #%d\n"), io_id);
+  return io;
+}
+
+static int
+pk_cmd_cow_open (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* cow open #ID */
+
+  char *handler;
+  int io_id;
+
+  assert (argc == 1);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_TAG);
+
+  io_id = PK_CMD_ARG_TAG (argv[0]);
+  if (pk_ios_search_by_id (poke_compiler, io_id) == NULL)
+    {
+      pk_printf (_("No such IO space: #%d\n"), io_id);
+      return 0;
+    }
+
+  if (asprintf (&handler, "cow:%d", io_id) == -1)
+    pk_fatal (_("out of memory"));
+
+  if (pk_ios_search (poke_compiler, handler) != NULL)
+    {
+      pk_printf (_("Buffer %s already opened.  Use `.ios #N' to switch.\n"),
+                 handler);
+      free (handler);
+      return 0;
+    }
+
+  if (PK_IOS_NOID == pk_ios_open (poke_compiler, handler, 0, 1))
+    {
+      pk_printf (_("Error creating COW IOS %s\n"), handler);
+      free (handler);
+      return 0;
+    }
+
+  free (handler);
+
+  if (poke_interactive_p && !poke_quiet_p)
+    pk_printf (_("The current IOS is now `%s'.\n"),
+               pk_ios_handler (pk_ios_cur (poke_compiler)));
+
+  return 1;
+}
+
+static int
+pk_cmd_cow_commit (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* cow commit [#ID] */
+
+  pk_ios io;
+
+  assert (argc == 1);
+
+  io = pk_cmd_cow_ios (argv[0]);
+  if (io == NULL)
+    return 0;
+
+  switch (pk_ios_commit_changes (io))
+    {
+    case PK_OK:
+      return 1;
+    case PK_EINVAL:
+      pk_printf (_("IO space #%d is not a COW overlay\n"),
+                 pk_ios_get_id (io));
+      return 0;
+    default:
+      pk_printf (_("Error writing changes to the base of IO space #%d\n"),
+                 pk_ios_get_id (io));
+      return 0;
+    }
+}
+
+/* Write a changed range of bytes to the file in DATA, as a record
+   made of its byte offset and its length, both encoded as 64-bit
+   big-endian numbers, followed by the bytes themselves.  */
+
+static int
+pk_cmd_cow_export_range (void *data, const void *buf, size_t count,
+                         uint64_t offset)
+{
+  FILE *out = data;
+  uint8_t header[16];
+  int i;
+
+  for (i = 0; i < 8; ++i)
+    {
+      header[i] = offset >> (56 - i * 8);
+      header[8 + i] = (uint64_t) count >> (56 - i * 8);
+    }
+
+  if (fwrite (header, 1, sizeof (header), out) != sizeof (header)
+      || fwrite (buf, 1, count, out) != count)
+    return PK_ERROR;
+
+  return PK_OK;
+}
+
+static int
+pk_cmd_cow_export (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* cow export FILE-NAME [,#ID] */
+
+  const char *filename;
+  pk_ios io;
+  FILE *out;
+  int ret;
+
+  assert (argc == 2);
+  assert (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_STR);
+
+  filename = PK_CMD_ARG_STR (argv[0]);
+  io = pk_cmd_cow_ios (argv[1]);
+  if (io == NULL)
+    return 0;
+
+  out = fopen (filename, "wb");
+  if (out == NULL)
+    {
+      pk_printf (_("Error opening %s: %s\n"), filename, strerror (errno));
+      return 0;
+    }
+
+  ret = pk_ios_export_changes (io, pk_cmd_cow_export_range, out);
+  if (fclose (out) != 0 && ret == PK_OK)
+    ret = PK_ERROR;
+
+  switch (ret)
+    {
+    case PK_OK:
+      return 1;
+    case PK_EINVAL:
+      pk_printf (_("IO space #%d is not a COW overlay\n"),
+                 pk_ios_get_id (io));
+      return 0;
+    default:
+      pk_printf (_("Error writing to %s\n"), filename);
+      return 0;
+    }
+}
+
 static char *
 ios_completion_function (const char *x, int state)
 {
@@ -387,11 +657,42 @@ const struct pk_cmd nbd_cmd =
   {"nbd", "s", "", 0, NULL, pk_cmd_nbd, "nbd URI", NULL};
 #endif
 
+const struct pk_cmd cow_open_cmd =
+  {"open", "t", "", 0, NULL, pk_cmd_cow_open, "open #ID",
+   ios_completion_function};
+
+const struct pk_cmd cow_commit_cmd =
+  {"commit", "?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_cow_commit,
+   "commit [#ID]", ios_completion_function};
+
+const struct pk_cmd cow_export_cmd =
+  {"export", "f,?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_cow_export,
+   "export FILE-NAME [,#ID]", rl_filename_completion_function};
+
+extern struct pk_cmd null_cmd; /* pk-cmd.c  */
+
+const struct pk_cmd *cow_cmds[] =
+{
+  &cow_open_cmd,
+  &cow_commit_cmd,
+  &cow_export_cmd,
+  &null_cmd,
+};
+
+struct pk_trie *cow_trie;
+
+const struct pk_cmd cow_cmd =
+  {"cow", "", "", 0, &cow_trie, NULL, "cow (open|commit|export)", NULL};
+
 const struct pk_cmd close_cmd =
   {"close", "?t", "", PK_CMD_F_REQ_IO, NULL, pk_cmd_close, "close [#ID]", ios_completion_function};
 
 const struct pk_cmd info_ios_cmd =
-  {"ios", "", "", 0, NULL, pk_cmd_info_ios, "info ios", NULL};
+  {"ios", "", PK_INFO_IOS_UFLAGS, 0, NULL, pk_cmd_info_ios,
+   "info ios[/sr]\n\
+Flags:\n\
+  s (show the statistics of the accesses to the IO spaces)\n\
+  r (reset the statistics)", NULL};
 
 const struct pk_cmd load_cmd =
   {"load", "f", "", 0, NULL, pk_cmd_load_file, "load FILE-NAME", rl_filename_completion_function};
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <arpa/inet.h> /* For htonl */
 #include <stdlib.h>
+#include <inttypes.h>
 #include "xalloc.h"
 
 #include "poke.h"
@@ -331,6 +332,110 @@ pk_cmd_set_oacutoff (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_set_string_max (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* set string-max [MAX]  */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    pk_printf ("%" PRIu64 "\n", pk_string_max (poke_compiler));
+  else
+    {
+      int64_t max = PK_CMD_ARG_INT (argv[0]);
+
+      if (max < 0)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts (_(" string-max should not be negative.\n"));
+          return 0;
+        }
+
+      pk_set_string_max (poke_compiler, max);
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_set_lazy_maps (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* set lazy-maps {yes|no} */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    {
+      if (pk_lazy_maps (poke_compiler))
+        pk_puts ("yes\n");
+      else
+        pk_puts ("no\n");
+    }
+  else
+    {
+      int lazy_maps_p = 0;
+      const char *arg = PK_CMD_ARG_STR (argv[0]);
+
+      if (STREQ (arg, "yes"))
+        lazy_maps_p = 1;
+      else if (STREQ (arg, "no"))
+        lazy_maps_p = 0;
+      else
+        {
+          pk_term_class ("error");
+          pk_puts (_("error: "));
+          pk_term_end_class ("error");
+          pk_puts (_(" lazy-maps should be one of `yes' or `no'.\n"));
+          return 0;
+        }
+
+      pk_set_lazy_maps (poke_compiler, lazy_maps_p);
+    }
+
+  return 1;
+}
+
+static int
+pk_cmd_set_ios_timing (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* set ios-timing {yes|no} */
+
+  assert (argc == 1);
+
+  if (PK_CMD_ARG_TYPE (argv[0]) == PK_CMD_ARG_NULL)
+    {
+      if (pk_ios_timing (poke_compiler))
+        pk_puts ("yes\n");
+      else
+        pk_puts ("no\n");
+    }
+  else
+    {
+      int timing_p = 0;
+      const char *arg = PK_CMD_ARG_STR (argv[0]);
+
+      if (STREQ (arg, "yes"))
+        timing_p = 1;
+      else if (STREQ (arg, "no"))
+        timing_p = 0;
+      else
+        {
+          pk_term_class ("error");
+          pk_puts (_("error: "));
+          pk_term_end_class ("error");
+          pk_puts (_(" ios-timing should be one of `yes' or `no'.\n"));
+          return 0;
+        }
+
+      pk_set_ios_timing (poke_compiler, timing_p);
+    }
+
+  return 1;
+}
+
 static int
 pk_cmd_set_odepth (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
@@ -603,6 +708,18 @@ const struct pk_cmd set_prompt_maps =
   {"prompt-maps", "s?", "", 0, NULL, pk_cmd_set_prompt_maps,
    "set prompt-maps (yes|no)", NULL};
 
+const struct pk_cmd set_string_max_cmd =
+  {"string-max", "?i", "", 0, NULL, pk_cmd_set_string_max,
+   "set string-max [MAX]", NULL};
+
+const struct pk_cmd set_lazy_maps_cmd =
+  {"lazy-maps", "?s", "", 0, NULL, pk_cmd_set_lazy_maps,
+   "set lazy-maps (yes|no)", NULL};
+
+const struct pk_cmd set_ios_timing_cmd =
+  {"ios-timing", "?s", "", 0, NULL, pk_cmd_set_ios_timing,
+   "set ios-timing (yes|no)", NULL};
+
 const struct pk_cmd *set_cmds[] =
   {
    &set_oacutoff_cmd,
@@ -618,6 +735,9 @@ const struct pk_cmd *set_cmds[] =
    &set_doc_viewer,
    &set_auto_map,
    &set_prompt_maps,
+   &set_string_max_cmd,
+   &set_lazy_maps_cmd,
+   &set_ios_timing_cmd,
    &null_cmd
   };
 
@@ -40,6 +40,7 @@
 extern const struct pk_cmd ios_cmd; /* pk-cmd-ios.c */
 extern const struct pk_cmd file_cmd; /* pk-cmd-ios.c  */
 extern const struct pk_cmd mem_cmd; /* pk-cmd-ios.c */
+extern const struct pk_cmd cow_cmd; /* pk-cmd-ios.c */
 #ifdef HAVE_LIBNBD
 extern const struct pk_cmd nbd_cmd; /* pk-cmd-ios.c */
 #endif
@@ -79,6 +80,7 @@ static const struct pk_cmd *dot_cmds[] =
     &map_cmd,
     &editor_cmd,
     &mem_cmd,
+    &cow_cmd,
 #ifdef HAVE_LIBNBD
     &nbd_cmd,
 #endif
@@ -571,6 +573,9 @@ extern struct pk_trie *map_trie; /* pk-cmd-map.c */
 extern const struct pk_cmd *map_entry_cmds[]; /* pk-cmd-map.c  */
 extern struct pk_trie *map_entry_trie; /* pk-cmd-map.c  */
 
+extern const struct pk_cmd *cow_cmds[]; /* pk-cmd-ios.c */
+extern struct pk_trie *cow_trie; /* pk-cmd-ios.c */
+
 static struct pk_trie *cmds_trie;
 
 #define IS_COMMAND(input, cmd) \
@@ -727,6 +732,7 @@ pk_cmd_init (void)
   set_trie = pk_trie_from_cmds (set_cmds);
   map_trie = pk_trie_from_cmds (map_cmds);
   map_entry_trie = pk_trie_from_cmds (map_entry_cmds);
+  cow_trie = pk_trie_from_cmds (cow_cmds);
 
   /* Compile commands written in Poke.  */
   if (!pk_load (poke_compiler, "pk-cmd"))
@@ -744,6 +750,7 @@ pk_cmd_shutdown (void)
   pk_trie_free (set_trie);
   pk_trie_free (map_trie);
   pk_trie_free (map_entry_trie);
+  pk_trie_free (cow_trie);
 }
 
 
@@ -21,6 +21,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <err.h>
 #include "read-file.h"
 #include "libpoke.h"
@@ -98,6 +101,279 @@ test_pk_compiler_free (pk_compiler pkc)
   pk_compiler_free (pkc);
 }
 
+/* Return the byte at OFFSET in the file FILENAME, or -1 if it can't
+   be read.  */
+
+static int
+file_byte (const char *filename, long offset)
+{
+  FILE *fp = fopen (filename, "rb");
+  int c = -1;
+
+  if (fp)
+    {
+      if (fseek (fp, offset, SEEK_SET) == 0)
+        c = getc (fp);
+      fclose (fp);
+    }
+  return c;
+}
+
+static void
+test_pk_ios_cache (pk_compiler pkc)
+{
+  char filename[] = "api-cache-XXXXXX";
+  struct pk_ios_stats stats;
+  pk_val val;
+  pk_ios ios;
+  FILE *fp;
+  int fd, i;
+
+  fd = mkstemp (filename);
+  if (fd == -1 || (fp = fdopen (fd, "wb")) == NULL)
+    {
+      fail ("pk_ios_cache");
+      return;
+    }
+  for (i = 0; i < 3 * 4096; ++i)
+    putc (i & 0xff, fp);
+  fclose (fp);
+
+  if (pk_ios_open (pkc, filename, 0, 1) == PK_IOS_NOID
+      || (ios = pk_ios_search (pkc, filename)) == NULL)
+    {
+      fail ("pk_ios_cache");
+      unlink (filename);
+      return;
+    }
+
+  T ("pk_ios_cache_size_1", pk_ios_cache_size (ios) > 0);
+
+  /* The first access to a block misses, the following ones hit.  */
+  pk_ios_reset_stats (ios);
+  T ("pk_ios_cache_hits_1",
+     pk_compile_expression (pkc, "uint<8> @ 5#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 5
+     && pk_compile_expression (pkc, "uint<8> @ 6#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 6);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_cache_hits_2", stats.cache_hits == 1);
+  T ("pk_ios_cache_misses_1", stats.cache_misses == 1);
+  T ("pk_ios_cache_misses_2", stats.reads >= 1);
+
+  /* Shrinking the cache writes back the modified data.  */
+  T ("pk_ios_set_cache_size_1",
+     pk_compile_statement (pkc, "uint<8> @ 10#B = 0xab;", NULL,
+                           &val) == PK_OK);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_set_cache_size_2",
+     stats.dirty == 1 && file_byte (filename, 10) == 10);
+  T ("pk_ios_set_cache_size_3",
+     pk_ios_set_cache_size (ios, 4096) == PK_OK
+     && pk_ios_cache_size (ios) == 4096);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_set_cache_size_4",
+     stats.dirty == 0 && file_byte (filename, 10) == 0xab);
+
+  /* With a single block, alternating between two blocks always
+     misses.  */
+  pk_ios_reset_stats (ios);
+  T ("pk_ios_set_cache_size_5",
+     pk_compile_expression (pkc, "uint<8> @ 10#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 0xab
+     && pk_compile_expression (pkc, "uint<8> @ 8193#B", NULL,
+                               &val) == PK_OK
+     && pk_uint_value (val) == 1
+     && pk_compile_expression (pkc, "uint<8> @ 11#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 11);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_set_cache_size_6",
+     stats.cache_hits == 0 && stats.cache_misses == 3);
+
+  /* A size of zero disables the cache.  Writes go straight to the
+     file.  */
+  T ("pk_ios_set_cache_size_7",
+     pk_ios_set_cache_size (ios, 0) == PK_OK
+     && pk_ios_cache_size (ios) == 0);
+  pk_ios_reset_stats (ios);
+  T ("pk_ios_set_cache_size_8",
+     pk_compile_statement (pkc, "uint<8> @ 12#B = 0xcd;", NULL,
+                           &val) == PK_OK
+     && file_byte (filename, 12) == 0xcd
+     && pk_compile_expression (pkc, "uint<8> @ 12#B", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 0xcd);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_set_cache_size_9",
+     stats.cache_hits == 0 && stats.cache_misses == 0
+     && stats.reads == 1 && stats.writes == 1);
+
+  pk_ios_close (pkc, ios);
+  unlink (filename);
+
+  /* IO spaces not backed by a cacheable device have no cache.  */
+  if (pk_ios_open (pkc, "*api-cache*", 0, 1) != PK_IOS_NOID
+      && (ios = pk_ios_search (pkc, "*api-cache*")) != NULL)
+    {
+      T ("pk_ios_cache_size_2", pk_ios_cache_size (ios) == 0);
+      T ("pk_ios_set_cache_size_10",
+         pk_ios_set_cache_size (ios, 4096) == PK_EINVAL);
+      pk_ios_close (pkc, ios);
+    }
+  else
+    fail ("pk_ios_cache_size_2");
+}
+
+/* Big arrays mapped from a file are loaded in its cache with a single
+   batch of reads, and reading a file block after block makes the
+   following blocks be read ahead.  With liburing, both go through
+   the io_uring of the file device.  */
+
+static void
+test_pk_ios_prefetch (pk_compiler pkc)
+{
+  char filename[] = "api-prefetch-XXXXXX";
+  struct pk_ios_stats stats;
+  int lazy_maps = pk_lazy_maps (pkc);
+  pk_val val;
+  pk_ios ios;
+  FILE *fp;
+  int fd, i;
+
+  fd = mkstemp (filename);
+  if (fd == -1 || (fp = fdopen (fd, "wb")) == NULL)
+    {
+      fail ("pk_ios_prefetch");
+      return;
+    }
+  for (i = 0; i < 64 * 4096; ++i)
+    putc (i / 4096, fp);
+  fclose (fp);
+
+  if (pk_ios_open (pkc, filename, 0, 1) == PK_IOS_NOID
+      || (ios = pk_ios_search (pkc, filename)) == NULL)
+    {
+      fail ("pk_ios_prefetch");
+      unlink (filename);
+      return;
+    }
+
+  /* The elements of the array are mapped eagerly, after loading the
+     64 blocks of the file.  */
+  pk_set_lazy_maps (pkc, 0);
+  pk_ios_reset_stats (ios);
+  T ("pk_ios_prefetch_1",
+     pk_compile_expression (pkc, "(uint<8>[4][65536] @ 0#B)[65535][3]",
+                            NULL, &val) == PK_OK
+     && pk_uint_value (val) == 63);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_prefetch_2", stats.reads == 1 && stats.cache_misses == 64);
+  pk_set_lazy_maps (pkc, lazy_maps);
+  pk_ios_close (pkc, ios);
+
+  if (pk_ios_open (pkc, filename, 0, 1) == PK_IOS_NOID
+      || (ios = pk_ios_search (pkc, filename)) == NULL)
+    {
+      fail ("pk_ios_readahead");
+      unlink (filename);
+      return;
+    }
+
+  pk_ios_reset_stats (ios);
+  T ("pk_ios_readahead_1",
+     pk_compile_statement (pkc, "var pf_sum = 0UL;", NULL, &val) == PK_OK
+     && pk_compile_statement (pkc,
+                              "for (var i = 0; i < 64; i++)"
+                              "  pf_sum += uint<8> @ i * 4096#B;",
+                              NULL, &val) == PK_OK
+     && pk_compile_expression (pkc, "pf_sum", NULL, &val) == PK_OK
+     && pk_uint_value (val) == 2016);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_readahead_2", stats.cache_hits > 0 && stats.reads < 64);
+
+  pk_ios_close (pkc, ios);
+  unlink (filename);
+}
+
+#if HAVE_IOS_DEV_PID
+
+/* The memory of a child process is read with batches of scattered
+   ranges once the cache of its IO space is enabled.  */
+
+static uint8_t pid_bytes[64 * 4096];
+
+static void
+test_pk_ios_pid (pk_compiler pkc)
+{
+  char handler[64], expr[128];
+  struct pk_ios_stats stats;
+  int lazy_maps = pk_lazy_maps (pkc);
+  uintptr_t addr = (uintptr_t) pid_bytes;
+  pk_val val;
+  pk_ios ios;
+  pid_t child;
+  int i;
+
+  for (i = 0; i < 64 * 4096; ++i)
+    pid_bytes[i] = i / 4096 + 1;
+
+  child = fork ();
+  if (child == -1)
+    {
+      fail ("pk_ios_pid");
+      return;
+    }
+  if (child == 0)
+    {
+      pause ();
+      _exit (0);
+    }
+
+  sprintf (handler, "pid://%ld", (long) child);
+  if (pk_ios_open (pkc, handler, PK_IOS_F_READ, 1) == PK_IOS_NOID
+      || (ios = pk_ios_search (pkc, handler)) == NULL)
+    {
+      fail ("pk_ios_pid");
+      goto done;
+    }
+
+  /* The cache is disabled by default.  */
+  T ("pk_ios_pid_1", pk_ios_cache_size (ios) == 0);
+  T ("pk_ios_pid_2", pk_ios_set_cache_size (ios, 256 * 4096) == PK_OK);
+
+  /* Load two blocks in the middle of the bytes, so the rest of them
+     are scattered ranges.  */
+  pk_ios_reset_stats (ios);
+  for (i = 1; i <= 2; ++i)
+    {
+      sprintf (expr, "uint<8> @ %luUL#B",
+               (unsigned long) addr + i * 20 * 4096);
+      if (pk_compile_expression (pkc, expr, NULL, &val) != PK_OK
+          || pk_uint_value (val) != i * 20 + 1)
+        break;
+    }
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_pid_3", i > 2 && stats.reads == 2);
+
+  pk_set_lazy_maps (pkc, 0);
+  pk_ios_reset_stats (ios);
+  sprintf (expr, "(uint<8>[4][65536] @ %luUL#B)[65535][3]",
+           (unsigned long) addr);
+  T ("pk_ios_pid_4",
+     pk_compile_expression (pkc, expr, NULL, &val) == PK_OK
+     && pk_uint_value (val) == 64);
+  pk_ios_get_stats (ios, &stats);
+  T ("pk_ios_pid_5", stats.reads == 1 && stats.cache_misses > 0);
+  pk_set_lazy_maps (pkc, lazy_maps);
+
+  pk_ios_close (pkc, ios);
+
+ done:
+  kill (child, SIGKILL);
+  waitpid (child, NULL, 0);
+}
+
+#endif /* HAVE_IOS_DEV_PID */
+
 int
 main ()
 {
@@ -105,6 +381,11 @@ main ()
 
   pkc = test_pk_compiler_new ();
 
+  test_pk_ios_cache (pkc);
+  test_pk_ios_prefetch (pkc);
+#if HAVE_IOS_DEV_PID
+  test_pk_ios_pid (pkc);
+#endif
   test_pk_compiler_free (pkc);
 
   return 0;
@@ -262,11 +262,65 @@ test_pk_val_equal_p ()
   closedir (directory);
 }
 
+/* Test that the elements of lazily mapped arrays are mapped when they
+   are accessed through the values interface.  */
+
+void
+test_lazy_maps ()
+{
+  static const char *code =
+    "type Foo = struct { uint<8> a; uint<8> b; };\n"
+    "var m = open (\"*m*\");\n"
+    "for (var i = 0; i < 16; i++) uint<8> @ m : i#B = i;\n";
+  static const char *map = "Foo[8] @ m : 0#B";
+  pk_compiler pkc;
+  pk_val lazy, eager, elem;
+
+  pkc = pk_compiler_new (&poke_term_if);
+
+  if (!pkc)
+    goto error;
+
+  if (pk_compile_buffer (pkc, code, NULL) != PK_OK)
+    goto error;
+
+  if (pk_compile_expression (pkc, map, NULL, &eager) != PK_OK)
+    goto error;
+
+  pk_set_lazy_maps (pkc, 1);
+
+  if (pk_compile_expression (pkc, map, NULL, &lazy) != PK_OK)
+    goto error;
+
+  elem = pk_array_elem_val (lazy, 3);
+  if (elem != PK_NULL
+      && pk_uint_value (pk_struct_field_value (elem, 1)) == 7)
+    pass ("pk_array_elem_val_lazy");
+  else
+    fail ("pk_array_elem_val_lazy");
+
+  if (pk_compile_expression (pkc, map, NULL, &lazy) != PK_OK)
+    goto error;
+
+  if (pk_val_equal_p (lazy, eager) && pk_val_equal_p (eager, lazy))
+    pass ("pk_val_equal_p_lazy");
+  else
+    fail ("pk_val_equal_p_lazy");
+
+  pk_compiler_free (pkc);
+  return;
+
+error:
+  pk_compiler_free (pkc);
+  fail ("test_lazy_maps");
+}
+
 int
 main (int argc, char *argv[])
 {
   test_simple_values ();
   test_pk_val_equal_p ();
+  test_lazy_maps ();
 
   totals ();
   return 0;